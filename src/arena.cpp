@@ -0,0 +1,64 @@
+#include "arena.h"
+#include <new>
+
+// Every allocation is rounded up to this, so pointers and atomics placed in it are aligned.
+const size_t ALIGNMENT = alignof(void *);
+
+Arena::~Arena()
+{
+    reset();
+}
+
+// Adds a block to the list; the caller holds _mutex.
+Arena::Block *Arena::new_block(size_t size)
+{
+    Block *block = static_cast<Block *>(::operator new(sizeof(Block) + size));
+    block->prev = _blocks;
+    block->size = size;
+    new (&block->used) std::atomic<size_t>(0);
+    _blocks = block;
+    _usage.fetch_add(sizeof(Block) + size, std::memory_order_relaxed);
+    return block;
+}
+
+char *Arena::allocate(size_t bytes)
+{
+    bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (bytes > BLOCK_SIZE / 4)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        Block *block = new_block(bytes);
+        block->used.store(bytes, std::memory_order_relaxed);
+        return block->data();
+    }
+    while (true)
+    {
+        Block *block = _current.load(std::memory_order_acquire);
+        if (block)
+        {
+            size_t offset = block->used.fetch_add(bytes, std::memory_order_relaxed);
+            if (offset + bytes <= block->size)
+            {
+                return block->data() + offset;
+            }
+        }
+        // The block is full: the first thread to get here starts the next one
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_current.load(std::memory_order_relaxed) == block)
+        {
+            _current.store(new_block(BLOCK_SIZE), std::memory_order_release);
+        }
+    }
+}
+
+void Arena::reset()
+{
+    while (_blocks)
+    {
+        Block *prev = _blocks->prev;
+        ::operator delete(_blocks);
+        _blocks = prev;
+    }
+    _current.store(nullptr, std::memory_order_relaxed);
+    _usage.store(0, std::memory_order_relaxed);
+}
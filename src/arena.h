@@ -0,0 +1,66 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+/**
+ * @brief A bump allocator that hands out memory from large blocks and frees it all at once.
+ * Allocation is a single atomic add on the current block, so several threads can allocate
+ * at the same time; only starting a new block takes a lock. Nothing is freed individually:
+ * reset() returns every block with one free per block, however many objects they hold.
+ */
+class Arena
+{
+public:
+    /**
+     * @brief Size of a regular block. Requests larger than a quarter of this get a block of
+     * their own, so big values do not waste the tail of the current block.
+     */
+    static const size_t BLOCK_SIZE = 256 * 1024;
+
+    Arena() = default;
+
+    /**
+     * @brief Frees every block.
+     */
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    /**
+     * @brief Returns bytes aligned for any pointer-sized type, valid until reset().
+     * Safe to call from several threads at once.
+     */
+    char *allocate(size_t bytes);
+
+    /**
+     * @brief Frees every block. Not safe while other threads allocate or use the memory.
+     */
+    void reset();
+
+    /**
+     * @brief Bytes obtained from the system for blocks, including their unused tails.
+     */
+    size_t memory_usage() const { return _usage.load(std::memory_order_relaxed); }
+
+private:
+    struct Block
+    {
+        Block *prev;               // Every block, newest first
+        size_t size;               // Usable bytes after the header
+        std::atomic<size_t> used;  // May run past size when racing allocations overflow it
+        char *data() { return reinterpret_cast<char *>(this + 1); }
+    };
+
+    Block *new_block(size_t size);
+
+    std::atomic<Block *> _current{nullptr};
+    std::mutex _mutex; // Held while blocks are added
+    Block *_blocks = nullptr;
+    std::atomic<size_t> _usage{0};
+};
+
+#endif // ARENA_H
@@ -0,0 +1,112 @@
+#include "block_cache.h"
+
+// Bookkeeping charged per block on top of its bytes: the list node, the index slot and the string.
+const size_t ENTRY_OVERHEAD = 96;
+
+size_t BlockCache::KeyHash::operator()(const Key &key) const
+{
+    // The MurmurHash3 finalizer over both halves; offsets are multiples of similar block
+    // sizes, so their low bits alone would spread poorly
+    uint64_t h = key.file_id ^ (key.offset * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+}
+
+BlockCache::BlockCache(size_t capacity)
+{
+    set_capacity(capacity);
+}
+
+BlockCache::Shard &BlockCache::shard_of(const Key &key)
+{
+    // High bits pick the shard; the hash table inside it uses the low ones
+    return _shards[(static_cast<uint64_t>(KeyHash()(key)) >> 32) % SHARDS];
+}
+
+std::shared_ptr<const std::string> BlockCache::lookup(uint64_t file_id, uint64_t offset)
+{
+    Key key{file_id, offset};
+    Shard &shard = shard_of(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.index.find(key);
+    if (it == shard.index.end())
+    {
+        _misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    _hits.fetch_add(1, std::memory_order_relaxed);
+    return it->second->block;
+}
+
+void BlockCache::insert(uint64_t file_id, uint64_t offset, std::shared_ptr<const std::string> block)
+{
+    Key key{file_id, offset};
+    Shard &shard = shard_of(key);
+    size_t charge = block->size() + ENTRY_OVERHEAD;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (charge > shard.capacity)
+    {
+        return;
+    }
+    auto it = shard.index.find(key);
+    if (it != shard.index.end())
+    {
+        // Another reader cached the same block first; keep the newer copy
+        shard.usage -= it->second->charge;
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+    shard.lru.push_front(Entry{key, std::move(block), charge});
+    shard.index.emplace(key, shard.lru.begin());
+    shard.usage += charge;
+    evict(shard);
+}
+
+void BlockCache::evict(Shard &shard)
+{
+    while (shard.usage > shard.capacity && !shard.lru.empty())
+    {
+        Entry &victim = shard.lru.back();
+        shard.usage -= victim.charge;
+        shard.index.erase(victim.key);
+        shard.lru.pop_back();
+    }
+}
+
+void BlockCache::set_capacity(size_t capacity)
+{
+    _capacity.store(capacity, std::memory_order_relaxed);
+    for (Shard &shard : _shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.capacity = (capacity + SHARDS - 1) / SHARDS;
+        evict(shard);
+    }
+}
+
+void BlockCache::clear()
+{
+    for (Shard &shard : _shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.lru.clear();
+        shard.index.clear();
+        shard.usage = 0;
+    }
+}
+
+size_t BlockCache::usage()
+{
+    size_t total = 0;
+    for (Shard &shard : _shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total += shard.usage;
+    }
+    return total;
+}
@@ -0,0 +1,113 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * @brief A cache of decoded SSTable data blocks shared by every table, bounded in bytes.
+ * Blocks are keyed by the file they come from and their offset in it. The cache is split
+ * into shards picked by a hash of the key, each with its own lock and its own LRU list,
+ * so lookups of different blocks rarely wait for each other. Blocks are handed out as
+ * shared pointers, so an evicted block stays valid for readers still holding it.
+ */
+class BlockCache
+{
+public:
+    /**
+     * @brief Number of shards; the capacity is divided evenly between them.
+     */
+    static const size_t SHARDS = 16;
+
+    /**
+     * @brief Creates a cache.
+     * @param capacity The most bytes of blocks to keep; 0 disables caching.
+     */
+    explicit BlockCache(size_t capacity);
+
+    BlockCache(const BlockCache &) = delete;
+    BlockCache &operator=(const BlockCache &) = delete;
+
+    /**
+     * @brief Finds a block, marking it as recently used.
+     * @param file_id The identity of the block's file.
+     * @param offset The offset of the block in the file.
+     * @return The block, or nullptr if it is not cached.
+     */
+    std::shared_ptr<const std::string> lookup(uint64_t file_id, uint64_t offset);
+
+    /**
+     * @brief Adds a block, evicting the least recently used blocks of its shard to make room.
+     * A block larger than a whole shard is not kept.
+     */
+    void insert(uint64_t file_id, uint64_t offset, std::shared_ptr<const std::string> block);
+
+    /**
+     * @brief Changes the capacity, evicting blocks if it shrinks; 0 empties the cache and
+     * disables it.
+     */
+    void set_capacity(size_t capacity);
+
+    /**
+     * @brief Drops every block.
+     */
+    void clear();
+
+    size_t capacity() const { return _capacity.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the bytes currently charged to cached blocks.
+     */
+    size_t usage();
+
+    uint64_t hits() const { return _hits.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return _misses.load(std::memory_order_relaxed); }
+
+private:
+    struct Key
+    {
+        uint64_t file_id;
+        uint64_t offset;
+        bool operator==(const Key &other) const { return file_id == other.file_id && offset == other.offset; }
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const;
+    };
+
+    struct Entry
+    {
+        Key key;
+        std::shared_ptr<const std::string> block;
+        size_t charge;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        // Most recently used first
+        std::list<Entry> lru;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        size_t usage = 0;
+        size_t capacity = 0;
+    };
+
+    Shard &shard_of(const Key &key);
+
+    // Drops least recently used entries until the shard fits its capacity; the shard must be locked.
+    static void evict(Shard &shard);
+
+    Shard _shards[SHARDS];
+    std::atomic<size_t> _capacity{0};
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+};
+
+#endif // BLOCK_CACHE_H
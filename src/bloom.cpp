@@ -0,0 +1,100 @@
+#include "bloom.h"
+#include <algorithm>
+#include <cstring>
+
+const size_t LINE_BYTES = 64;
+const uint32_t LINE_BITS = 512;
+const int MAX_PROBES = 30;
+
+uint64_t BloomFilter::hash(std::string_view key)
+{
+    // FNV-1a, then the MurmurHash3 finalizer: shard routing already uses plain FNV-1a,
+    // so its low bits are nearly constant among the keys of one shard
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : key)
+    {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Picks the cache line of a hash from its high half, without a division.
+static size_t line_of(uint64_t h, size_t lines)
+{
+    return static_cast<size_t>(((h >> 32) * lines) >> 32);
+}
+
+std::string BloomFilter::build(const std::vector<uint64_t> &hashes, int bits_per_key)
+{
+    bits_per_key = std::max(1, bits_per_key);
+    size_t bits = std::max<size_t>(hashes.size() * bits_per_key, LINE_BITS);
+    size_t lines = (bits + LINE_BITS - 1) / LINE_BITS;
+    // k = bits_per_key * ln(2) minimizes the false positive rate
+    int probes = std::min(MAX_PROBES, std::max(1, static_cast<int>(bits_per_key * 0.69)));
+
+    std::vector<uint64_t> words(lines * 8, 0);
+    for (uint64_t h : hashes)
+    {
+        uint64_t *line = &words[line_of(h, lines) * 8];
+        uint32_t bit = static_cast<uint32_t>(h);
+        uint32_t delta = (bit >> 17) | (bit << 15);
+        for (int i = 0; i < probes; ++i)
+        {
+            uint32_t pos = bit % LINE_BITS;
+            line[pos / 64] |= uint64_t(1) << (pos % 64);
+            bit += delta;
+        }
+    }
+
+    std::string encoded(lines * LINE_BYTES + 1, '\0');
+    memcpy(&encoded[0], words.data(), lines * LINE_BYTES);
+    encoded[lines * LINE_BYTES] = static_cast<char>(probes);
+    return encoded;
+}
+
+bool BloomFilter::load(std::string_view encoded)
+{
+    _lines.clear();
+    _probes = 0;
+    if (encoded.size() < LINE_BYTES + 1 || (encoded.size() - 1) % LINE_BYTES != 0)
+    {
+        return false;
+    }
+    int probes = static_cast<unsigned char>(encoded.back());
+    if (probes < 1 || probes > MAX_PROBES)
+    {
+        return false;
+    }
+    _lines.resize((encoded.size() - 1) / LINE_BYTES);
+    memcpy(_lines.data(), encoded.data(), _lines.size() * LINE_BYTES);
+    _probes = probes;
+    return true;
+}
+
+bool BloomFilter::may_contain(std::string_view key) const
+{
+    if (_lines.empty())
+    {
+        return true;
+    }
+    uint64_t h = hash(key);
+    const uint64_t *line = _lines[line_of(h, _lines.size())].words;
+    uint32_t bit = static_cast<uint32_t>(h);
+    uint32_t delta = (bit >> 17) | (bit << 15);
+    for (int i = 0; i < _probes; ++i)
+    {
+        uint32_t pos = bit % LINE_BITS;
+        if (!(line[pos / 64] & (uint64_t(1) << (pos % 64))))
+        {
+            return false;
+        }
+        bit += delta;
+    }
+    return true;
+}
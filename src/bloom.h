@@ -0,0 +1,63 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A blocked Bloom filter over the keys of one SSTable.
+ * Every key maps to a single 64-byte cache line and sets all of its probe bits inside that
+ * line, so a lookup costs at most one cache miss however many probes it checks.
+ * Encoded as the lines followed by one byte holding the number of probes per key.
+ */
+class BloomFilter
+{
+public:
+    /**
+     * @brief Bits per key used when nothing else is configured; about a 1% false positive rate.
+     */
+    static const int DEFAULT_BITS_PER_KEY = 10;
+
+    /**
+     * @brief Hashes a key for build(); the same hash is used by may_contain().
+     */
+    static uint64_t hash(std::string_view key);
+
+    /**
+     * @brief Encodes a filter over a set of keys.
+     * @param hashes The hash() of every key.
+     * @param bits_per_key Filter bits spent per key; more bits mean fewer false positives.
+     * @return The encoded filter.
+     */
+    static std::string build(const std::vector<uint64_t> &hashes, int bits_per_key);
+
+    /**
+     * @brief Takes an encoded filter, copying it into cache-line aligned memory.
+     * @return False if the encoding is malformed; the filter is then empty.
+     */
+    bool load(std::string_view encoded);
+
+    /**
+     * @brief Checks whether a key may be in the set. Never false for a key that is;
+     * always true when no filter is loaded.
+     */
+    bool may_contain(std::string_view key) const;
+
+    /**
+     * @brief Checks whether a filter is loaded.
+     */
+    bool empty() const { return _lines.empty(); }
+
+private:
+    struct alignas(64) Line
+    {
+        uint64_t words[8];
+    };
+
+    std::vector<Line> _lines;
+    int _probes = 0;
+};
+
+#endif // BLOOM_H
@@ -0,0 +1,208 @@
+#include "compress.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+const size_t MIN_MATCH = 4;
+const size_t MAX_OFFSET = 65535;
+// Largest match table; small inputs use one about their own size.
+const int HASH_BITS = 14;
+// After this many positions without a match, the search starts skipping ahead faster.
+const int SKIP_TRIGGER = 6;
+
+static uint32_t read32(const char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t hash4(const char *p, int bits)
+{
+    return (read32(p) * 2654435761u) >> (32 - bits);
+}
+
+// Writes the part of a length that does not fit in its token nibble.
+static void put_length(std::string &out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+    {
+        out.push_back(static_cast<char>(255));
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+static void put_sequence(std::string &out, const char *literals, size_t literal_count, size_t offset, size_t match_length)
+{
+    size_t match_code = match_length >= MIN_MATCH ? match_length - MIN_MATCH : 0;
+    unsigned token = (literal_count < 15 ? literal_count : 15) << 4 | (match_code < 15 ? match_code : 15);
+    out.push_back(static_cast<char>(token));
+    if (literal_count >= 15)
+    {
+        put_length(out, literal_count - 15);
+    }
+    out.append(literals, literal_count);
+    if (match_length == 0)
+    {
+        return; // The last sequence
+    }
+    out.push_back(static_cast<char>(offset & 0xff));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (match_code >= 15)
+    {
+        put_length(out, match_code - 15);
+    }
+}
+
+std::string LzCodec::compress(std::string_view input)
+{
+    std::string out;
+    out.reserve(input.size() / 2 + 16);
+    for (uint64_t length = input.size(); ; length >>= 7)
+    {
+        if (length < 0x80)
+        {
+            out.push_back(static_cast<char>(length));
+            break;
+        }
+        out.push_back(static_cast<char>(length | 0x80));
+    }
+
+    const char *base = input.data();
+    size_t n = input.size();
+    size_t anchor = 0;
+    if (n >= MIN_MATCH + 1)
+    {
+        int bits = 8;
+        while (bits < HASH_BITS && (size_t(1) << bits) < n)
+        {
+            ++bits;
+        }
+        // Positions plus one, so zero means empty
+        std::vector<uint32_t> table(size_t(1) << bits, 0);
+        size_t pos = 0;
+        size_t misses = 0;
+        while (pos + MIN_MATCH <= n)
+        {
+            uint32_t h = hash4(base + pos, bits);
+            size_t candidate = table[h];
+            table[h] = static_cast<uint32_t>(pos + 1);
+            if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET ||
+                read32(base + candidate - 1) != read32(base + pos))
+            {
+                pos += 1 + (misses++ >> SKIP_TRIGGER);
+                continue;
+            }
+            size_t match = candidate - 1;
+            size_t length = MIN_MATCH;
+            while (pos + length < n && base[match + length] == base[pos + length])
+            {
+                ++length;
+            }
+            put_sequence(out, base + anchor, pos - anchor, pos - match, length);
+            pos += length;
+            anchor = pos;
+            misses = 0;
+        }
+    }
+    put_sequence(out, base + anchor, n - anchor, 0, 0);
+    return out;
+}
+
+// Reads the continuation of a length whose nibble was 15.
+static bool get_length(std::string_view in, size_t &pos, size_t &length)
+{
+    while (true)
+    {
+        if (pos >= in.size())
+        {
+            return false;
+        }
+        unsigned char byte = static_cast<unsigned char>(in[pos++]);
+        length += byte;
+        if (byte != 255)
+        {
+            return true;
+        }
+    }
+}
+
+bool LzCodec::decompress(std::string_view input, std::string &output)
+{
+    size_t pos = 0;
+    uint64_t expected = 0;
+    for (int shift = 0;; shift += 7)
+    {
+        if (pos >= input.size() || shift >= 64)
+        {
+            return false;
+        }
+        unsigned char byte = static_cast<unsigned char>(input[pos++]);
+        expected |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            break;
+        }
+    }
+    // Every input byte expands to at most 255 + 19 output bytes, which bounds a corrupt length
+    if (expected > (input.size() - pos) * 274 + 15)
+    {
+        return false;
+    }
+    output.clear();
+    output.reserve(expected);
+
+    while (true)
+    {
+        if (pos >= input.size())
+        {
+            return false;
+        }
+        unsigned token = static_cast<unsigned char>(input[pos++]);
+        size_t literals = token >> 4;
+        if (literals == 15 && !get_length(input, pos, literals))
+        {
+            return false;
+        }
+        if (input.size() - pos < literals || expected - output.size() < literals)
+        {
+            return false;
+        }
+        output.append(input.data() + pos, literals);
+        pos += literals;
+        if (output.size() == expected)
+        {
+            return pos == input.size();
+        }
+
+        if (input.size() - pos < 2)
+        {
+            return false;
+        }
+        size_t offset = static_cast<unsigned char>(input[pos]) | static_cast<unsigned char>(input[pos + 1]) << 8;
+        pos += 2;
+        size_t length = token & 15;
+        if (length == 15 && !get_length(input, pos, length))
+        {
+            return false;
+        }
+        length += MIN_MATCH;
+        if (offset == 0 || offset > output.size() || expected - output.size() < length)
+        {
+            return false;
+        }
+        size_t from = output.size() - offset;
+        if (offset >= length)
+        {
+            output.append(output, from, length);
+        }
+        else
+        {
+            // The match overlaps the bytes it produces, e.g. a run of one repeated byte
+            for (size_t i = 0; i < length; ++i)
+            {
+                output.push_back(output[from + i]);
+            }
+        }
+    }
+}
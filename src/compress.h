@@ -0,0 +1,33 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <string>
+#include <string_view>
+
+/**
+ * @brief A small LZ77 codec in the style of LZ4, used for SSTable blocks.
+ * The output is the input length as a varint followed by sequences. Each sequence is a token
+ * byte (literal count in the high nibble, match length minus 4 in the low one; 15 means more
+ * length bytes follow, each adding up to 255), the literals, a 2-byte little-endian match
+ * offset and the extra match length bytes. The last sequence carries only literals.
+ * Compression finds matches through a hash of the next four bytes; decompression is a loop
+ * of copies and checks every length against both buffers, so corrupt input fails cleanly.
+ */
+class LzCodec
+{
+public:
+    /**
+     * @brief Compresses a buffer.
+     */
+    static std::string compress(std::string_view input);
+
+    /**
+     * @brief Decompresses the output of compress().
+     * @param input The compressed bytes.
+     * @param output Receives the original bytes.
+     * @return False if the input is malformed.
+     */
+    static bool decompress(std::string_view input, std::string &output);
+};
+
+#endif // COMPRESS_H
@@ -1,296 +1,1045 @@
 #include "database.h"
+#include "compress.h"
+#include "uring.h"
 #include <fstream>
 #include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-const std::string DATADIR = "data/"; // Define DATADIR for use in this file
 
 MemTable::MemTable()
 {
     // _storage_path = "./"; // Removed as it's no longer used
 }
 
-SSTable *MemTable::flush(const string &filename)
+SSTable *MemTable::flush(const string &filename, const string &directory)
 {
-    std::cerr << "MemTable::flush called for filename: " << filename << std::endl;
-    std::vector<KeyValuePair> sorted_data;
-    for (auto const &[key, val] : data)
+    SSTable *new_sst = write_to_disk(filename, directory);
+    if (new_sst)
     {
-        sorted_data.push_back({key, val});
+        this->clear(); // Clear the MemTable after successful flush
     }
-    // SSTables require sorted data
-    std::sort(sorted_data.begin(), sorted_data.end());
-
-    std::cerr << "Flushing " << sorted_data.size() << " key-value pairs to SSTable." << std::endl;
+    return new_sst;
+}
 
-    SSTable *new_sst = new SSTable(DATADIR + filename, false); // Use DATADIR
-    if (!new_sst->writeFromMemory(sorted_data))
+SSTable *MemTable::write_to_disk(const string &filename, const string &directory) const
+{
+    // SSTables require sorted data, which is the skip list's iteration order, so the pairs
+    // stream straight from the skip list into the table
+    SSTableBuilder builder(directory + filename);
+    SkipList::Iterator it(&data);
+    for (it.seek_to_first(); it.valid() && builder.ok(); it.next())
+    {
+        builder.add(it.key(), it.value());
+    }
+    if (!builder.finish())
     {
         std::cerr << "Error: Failed to write MemTable to SSTable file: " << filename << std::endl;
-        delete new_sst;
-        return nullptr; // Handle error
+        return nullptr; // The builder removes the partial file
     }
-    this->clear(); // Clear the MemTable after successful flush
-    return new_sst;
+    return new SSTable(directory + filename, false);
 }
 
-bool MemTable::put(const string &key, const string &payload)
+bool MemTable::put(string_view key, string_view payload)
 {
-    data[key] = payload;
+    data.put(key, payload);
     return true;
 }
 
-string MemTable::get(const string &key) const
+string MemTable::get(string_view key) const
 {
-    auto it = data.find(key);
-    if (it != data.end())
+    string value;
+    if (data.get(key, value))
     {
-        return it->second;
+        return value;
     }
-    printf("Key not found: %s", key.c_str());
+    printf("Key not found: %.*s", static_cast<int>(key.size()), key.data());
     return "";
 }
 
+void MemTable::get_many(const vector<string_view> &keys, vector<optional<string>> &values) const
+{
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (values[i].has_value())
+        {
+            continue;
+        }
+        string value;
+        if (data.get(keys[i], value) && !value.empty())
+        {
+            values[i] = std::move(value); // An empty value counts as absent, as in get()
+        }
+    }
+}
+
 void MemTable::clear()
 {
     data.clear();
 }
 
-long long MemTable::get_size_bytes() const
+// The last eight bytes of every SSTable with a footer are "VRDBSST" followed by the
+// format version as an ASCII digit (little-endian, so the digit is the top byte).
+const uint64_t SSTABLE_MAGIC = 0x0054535342445256ULL;
+const uint64_t SSTABLE_MAGIC_MASK = 0x00ffffffffffffffULL;
+// Version 1 added the filter block; version 2 added byte-sized blocks with restart points;
+// version 3 added prefix-compressed keys and varint lengths inside blocks;
+// version 4 added a trailing type byte to every block, which may be compressed.
+const uint32_t SSTABLE_FORMAT = 4;
+// Block type bytes.
+const char BLOCK_RAW = 0;
+const char BLOCK_LZ = 1;
+// Filter offset, index offset and magic number.
+const std::streamoff FOOTER_SIZE = 3 * sizeof(uint64_t);
+// Every this many entries, a block records a restart point.
+const size_t RESTART_INTERVAL = 16;
+
+int SSTable::bloomBitsPerKey = BloomFilter::DEFAULT_BITS_PER_KEY;
+bool SSTable::mmapReads = true;
+uint64_t SSTable::mmapLimit = uint64_t(1) << 30;
+BlockCache SSTable::blockCache(8 << 20);
+size_t SSTable::blockSize = 4096;
+bool SSTable::compressBlocks = true;
+
+std::shared_ptr<const MappedFile> MappedFile::map(int fd, uint64_t size)
 {
-    long long size_bytes = 0;
-    for (const auto &pair : data)
+    if (size == 0)
+    {
+        return nullptr;
+    }
+    void *address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED)
     {
-        size_bytes += pair.first.length();
-        size_bytes += pair.second.length();
+        return nullptr;
     }
-    return size_bytes;
+    // Lookups touch one block at a time; read-ahead would only pull in blocks nobody asked for
+    madvise(address, size, MADV_RANDOM);
+    return std::shared_ptr<const MappedFile>(new MappedFile(static_cast<const char *>(address), size));
 }
 
-// The number of key-value pairs to store in each data block.
-// A smaller number means a larger index but smaller reads from disk.
-const size_t BLOCK_SIZE = 4;
+MappedFile::~MappedFile()
+{
+    munmap(const_cast<char *>(_data), _size);
+}
 
-SSTable::SSTable(const std::string &filePath, bool loadData) : filePath(filePath) // Use DATADIR
+// Encoding helpers for building blocks in memory.
+static void putUint32(std::string &out, uint32_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void putUint64(std::string &out, uint64_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// Appends an unsigned integer seven bits per byte, low bits first; the top bit marks continuation.
+static void putVarint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+SSTable::SSTable(const std::string &filePath, bool loadData) : filePath(filePath)
 {
     if (loadData)
     {
-        // Load all data into memory for merge operations
-        std::ifstream infile(this->filePath, std::ios::binary);
-        if (!infile.is_open())
+        // Load all data into memory for merge operations.
+        // First, load the index to find where each data block starts and the data ends
+        if (!this->loadIndex())
         {
-            std::cerr << "Error: Could not open file for reading during loadData: " << filePath << std::endl;
-            return; // Or throw an exception
+            return;
         }
+        indexLoaded.store(true, std::memory_order_release);
 
-        // First, read the footer to find where the index starts
-        infile.seekg(-static_cast<std::streamoff>(sizeof(uint64_t)), std::ios::end);
-        uint64_t index_start_offset = this->readUint64(infile);
-
-        // Now, seek back to the beginning of the data and read all blocks
-        infile.seekg(0, std::ios::beg);
-
-        while (static_cast<uint64_t>(infile.tellg()) < index_start_offset)
+        // Now take all the data blocks, from the mapping or with one read, and decode them one by one
+        std::string blocks;
+        std::string_view region;
+        if (mapping)
+        {
+            region = mapping->view(0, dataEnd);
+        }
+        else
         {
-            uint64_t pairsInBlock = this->readUint64(infile);
-            for (uint64_t i = 0; i < pairsInBlock; ++i)
+            blocks.assign(dataEnd, '\0');
+            if (!readBlock(0, blocks))
             {
-                string key = this->readString(infile);
-                string value = this->readString(infile);
-                this->data[key] = value;
+                std::cerr << "Error: Could not read the data blocks of " << filePath << std::endl;
+                return;
+            }
+            region = blocks;
+        }
+        std::vector<KeyValuePair> entries;
+        std::string scratch;
+        for (size_t i = 0; i < blockIndex.size(); ++i)
+        {
+            uint64_t blockOffset = blockIndex.offset(i);
+            uint64_t blockEnd = i + 1 < blockIndex.size() ? blockIndex.offset(i + 1) : dataEnd;
+            entries.clear();
+            std::string_view contents;
+            if (blockOffset >= blockEnd || blockEnd > region.size() ||
+                !unpackBlock(region.substr(blockOffset, blockEnd - blockOffset), scratch, contents) ||
+                !decodeBlock(contents, entries))
+            {
+                std::cerr << "Error: Corrupt data block at offset " << blockOffset << " in " << filePath << std::endl;
+                return;
+            }
+            for (auto &entry : entries)
+            {
+                this->data[std::move(entry.key)] = std::move(entry.value);
             }
         }
-        infile.close();
     }
 }
 
-// Writes a string with its length prefixed for easy deserialization.
-void SSTable::writeString(std::ofstream &out, const std::string &str)
+SSTable::~SSTable()
 {
-    uint64_t len = str.length();
-    this->writeUint64(out, len);
-    out.write(str.c_str(), len);
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
 }
 
-// Reads a string that was written with writeString.
-std::string SSTable::readString(std::ifstream &in)
+bool SSTable::writeFromMemory(const std::vector<KeyValuePair> &memtable)
 {
-    uint64_t len = this->readUint64(in);
-    std::vector<char> buffer(len);
-    in.read(buffer.data(), len);
-    return std::string(buffer.begin(), buffer.end());
+    SSTableBuilder builder(filePath);
+    for (const auto &pair : memtable)
+    {
+        if (!builder.add(pair.key, pair.value))
+        {
+            return false;
+        }
+    }
+    return builder.finish();
 }
 
-// Writes a 64-bit integer in a portable binary format (little-endian).
-void SSTable::writeUint64(std::ofstream &out, uint64_t value)
+SSTableBuilder::SSTableBuilder(const std::string &filePath) : filePath(filePath)
 {
-    out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+    std::filesystem::path dir_path = std::filesystem::path(filePath).parent_path();
+    std::error_code ec;
+    // Only fail if create_directories fails AND reports an actual error
+    // (a bare file name has no parent directory to create)
+    if (!dir_path.empty() && !std::filesystem::create_directories(dir_path, ec) && ec)
+    {
+        std::cerr << "Error creating directories: " << dir_path << ", error: " << ec.message() << std::endl;
+        failed = true;
+        return;
+    }
+    fd = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Error: Could not open file for writing: " << filePath << " (errno: " << errno << ")" << std::endl;
+        failed = true;
+        return;
+    }
+    created = true;
+    out.reserve(BUFFER_SIZE + SSTable::blockSize);
 }
 
-// Reads a 64-bit integer.
-uint64_t SSTable::readUint64(std::ifstream &in)
+SSTableBuilder::~SSTableBuilder()
 {
-    uint64_t value;
-    in.read(reinterpret_cast<char *>(&value), sizeof(value));
-    return value;
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+    if (created && !finished)
+    {
+        ::unlink(filePath.c_str()); // Never leave a partial table behind
+    }
 }
 
-bool SSTable::writeFromMemory(const std::vector<KeyValuePair> &memtable)
+bool SSTableBuilder::add(std::string_view key, std::string_view value)
 {
-    std::cerr << "SSTable::writeFromMemory called for file: " << filePath << " with " << memtable.size() << " entries." << std::endl;
-    std::filesystem::path dir_path = std::filesystem::path(filePath).parent_path();
-    std::cerr << "Attempting to create directories: " << dir_path << std::endl;
-    std::error_code ec;
-    // Only return false if create_directories fails AND reports an actual error
-    if (!std::filesystem::create_directories(dir_path, ec) && ec)
+    if (failed)
     {
-        std::cerr << "Error creating directories: " << dir_path << ", error: " << ec.message() << std::endl;
         return false;
     }
-
-    std::cerr << "Attempting to open file for writing: " << filePath << std::endl;
-    std::ofstream outFile(filePath, std::ios::binary | std::ios::trunc);
-    if (!outFile.is_open())
+    if (count > 0 && key.compare(lastKey) <= 0)
     {
-        std::cerr << "Error: Could not open file for writing: " << filePath << " (errno: " << errno << ")" << std::endl;
+        std::cerr << "Error: SSTable keys must be added in ascending order: " << filePath << std::endl;
+        failed = true;
         return false;
     }
+    if (pairsInBlock == 0)
+    {
+        // Record the start of the block and its first key for the index
+        putUint64(index, key.size());
+        index.append(key);
+        putUint64(index, offset + out.size());
+        ++indexEntries;
+    }
+    // Each entry stores only what its key does not share with the previous key,
+    // except at restart points, which hold the full key
+    size_t shared = 0;
+    if (pairsInBlock % RESTART_INTERVAL == 0)
+    {
+        restarts.push_back(static_cast<uint32_t>(block.size()));
+    }
+    else
+    {
+        size_t limit = std::min(lastKey.size(), key.size());
+        while (shared < limit && lastKey[shared] == key[shared])
+        {
+            ++shared;
+        }
+    }
+    putVarint(block, shared);
+    putVarint(block, key.size() - shared);
+    putVarint(block, value.size());
+    block.append(key.substr(shared));
+    block.append(value);
+    lastKey.assign(key);
+    ++pairsInBlock;
+    ++count;
+    if (SSTable::bloomBitsPerKey > 0)
+    {
+        hashes.push_back(BloomFilter::hash(key));
+    }
 
-    std::cerr << "File opened successfully for writing: " << filePath << std::endl;
-
-    std::map<std::string, uint64_t> tempIndex;
-    uint64_t currentOffset = 0;
-
-    // --- 1. Write Data Blocks ---
-    for (size_t i = 0; i < memtable.size(); i += BLOCK_SIZE)
+    // Close the block once it reaches the target size
+    if (block.size() >= SSTable::blockSize)
     {
-        // Record the start of the block and its first key for the index.
-        tempIndex[memtable[i].key] = currentOffset;
-        std::cerr << "Writing block starting with key: " << memtable[i].key << " at offset: " << currentOffset << std::endl;
+        closeBlock();
+    }
+    return flushIfFull();
+}
 
-        // Determine the end of the current block.
-        size_t end = std::min(i + BLOCK_SIZE, memtable.size());
+void SSTableBuilder::closeBlock()
+{
+    for (uint32_t restart : restarts)
+    {
+        putUint32(block, restart);
+    }
+    putUint32(block, static_cast<uint32_t>(restarts.size()));
+    char type = BLOCK_RAW;
+    if (SSTable::compressBlocks)
+    {
+        // Keep the compressed form only when it saves at least an eighth
+        std::string packed = LzCodec::compress(block);
+        if (packed.size() < block.size() - block.size() / 8)
+        {
+            block.swap(packed);
+            type = BLOCK_LZ;
+        }
+    }
+    out.append(block);
+    out.push_back(type);
+    block.clear();
+    restarts.clear();
+    pairsInBlock = 0;
+}
 
-        // Write the number of pairs in this block.
-        this->writeUint64(outFile, end - i);
+bool SSTableBuilder::flushIfFull()
+{
+    return out.size() < BUFFER_SIZE || flush();
+}
 
-        // Write the key-value pairs in this block.
-        for (size_t j = i; j < end; ++j)
+bool SSTableBuilder::flush()
+{
+    size_t done = 0;
+    while (done < out.size())
+    {
+        ssize_t n = ::write(fd, out.data() + done, out.size() - done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
         {
-            this->writeString(outFile, memtable[j].key);
-            this->writeString(outFile, memtable[j].value);
-            std::cerr << "  Wrote key: '" << memtable[j].key << "', value: '" << memtable[j].value << "'" << std::endl;
+            std::cerr << "Error: Could not write to " << filePath << " (errno: " << errno << ")" << std::endl;
+            failed = true;
+            return false;
         }
-        // Update offset for the next block
-        currentOffset = outFile.tellp();
-        std::cerr << "Block ended, next offset: " << currentOffset << std::endl;
+        done += n;
     }
+    offset += out.size();
+    out.clear();
+    return true;
+}
 
-    // --- 2. Write Index Block ---
-    uint64_t indexOffset = currentOffset;
-    std::cerr << "Writing index block at offset: " << indexOffset << std::endl;
+bool SSTableBuilder::finish()
+{
+    if (failed || finished)
+    {
+        return false;
+    }
+    if (pairsInBlock > 0)
+    {
+        closeBlock();
+    }
 
-    // Write the total number of index entries.
-    this->writeUint64(outFile, tempIndex.size());
-    for (const auto &entry : tempIndex)
+    // --- Filter Block ---
+    uint64_t filterOffset = offset + out.size();
+    if (SSTable::bloomBitsPerKey > 0)
     {
-        this->writeString(outFile, entry.first);  // The key
-        this->writeUint64(outFile, entry.second); // The offset
-        std::cerr << "  Wrote index entry: key='" << entry.first << "', offset=" << entry.second << std::endl;
+        out.append(BloomFilter::build(hashes, SSTable::bloomBitsPerKey));
     }
 
-    // --- 3. Write Footer (Index Block Offset) ---
-    // The footer is a fixed-size pointer at the very end of the file
-    // that tells us where the index block begins.
-    this->writeUint64(outFile, indexOffset);
-    std::cerr << "Writing footer with index offset: " << indexOffset << std::endl;
+    // --- Index Block: the number of entries, then each first key and block offset ---
+    uint64_t indexOffset = offset + out.size();
+    putUint64(out, indexEntries);
+    out.append(index);
 
-    outFile.close();
-    std::cerr << "SSTable::writeFromMemory finished, file closed: " << filePath << std::endl;
+    // --- Footer: the filter and index offsets and the magic number with the format version ---
+    putUint64(out, filterOffset);
+    putUint64(out, indexOffset);
+    putUint64(out, SSTABLE_MAGIC | (static_cast<uint64_t>('0' + SSTABLE_FORMAT) << 56));
+
+    if (!flush() || ::close(fd) != 0)
+    {
+        fd = -1;
+        failed = true;
+        return false;
+    }
+    fd = -1;
+    finished = true;
     return true;
 }
 
 bool SSTable::loadIndex()
 {
-    std::ifstream inFile(filePath, std::ios::binary);
-    if (!inFile.is_open())
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+    mapping.reset();
+    int file = ::open(filePath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (file < 0)
     {
         std::cerr << "Error: Could not open file for reading: " << filePath << std::endl;
         return false;
     }
+    struct stat st;
+    if (fstat(file, &st) != 0)
+    {
+        ::close(file);
+        std::cerr << "Error: Could not stat file: " << filePath << std::endl;
+        return false;
+    }
+    fd = file; // Kept open for block reads; closed by the destructor
+    uint64_t fileSize = st.st_size;
+    // Names are reused and files rewritten in place, so the cache tells versions apart by
+    // their inode, size and modification time
+    uint64_t identity[4] = {static_cast<uint64_t>(st.st_dev), static_cast<uint64_t>(st.st_ino), fileSize,
+                            static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ULL + st.st_mtim.tv_nsec};
+    fileId = BloomFilter::hash(std::string_view(reinterpret_cast<const char *>(identity), sizeof(identity)));
 
-    // --- 1. Read Footer to find Index Block ---
-    inFile.seekg(-static_cast<std::streamoff>(sizeof(uint64_t)), std::ios::end);
-    uint64_t indexOffset = this->readUint64(inFile);
+    // --- 1. Read Footer to find the Filter and Index Blocks ---
+    std::string tail(std::min<uint64_t>(fileSize, FOOTER_SIZE), '\0');
+    uint64_t filterOffset = 0;
+    uint64_t indexOffset = 0;
+    uint64_t indexEnd = 0;
+    if (!readBlock(fileSize - tail.size(), tail) ||
+        !this->decodeFooter(tail, fileSize, filterOffset, indexOffset, indexEnd, formatVersion))
+    {
+        std::cerr << "Error: SSTable file is too short: " << filePath << std::endl;
+        return false;
+    }
+    dataEnd = filterOffset;
 
-    // --- 2. Seek to and Read the Index Block ---
-    inFile.seekg(indexOffset);
-    uint64_t indexSize = this->readUint64(inFile);
+    // --- 2. Read the Filter and Index Blocks with one read ---
+    std::string meta(indexEnd - filterOffset, '\0');
+    if (!readBlock(filterOffset, meta))
+    {
+        std::cerr << "Error: Could not read the index of " << filePath << std::endl;
+        return false;
+    }
+    std::string_view metaView(meta);
+    if (indexOffset > filterOffset && !filter.load(metaView.substr(0, indexOffset - filterOffset)))
+    {
+        std::cerr << "Warning: Ignoring unreadable Bloom filter in " << filePath << std::endl;
+    }
 
-    sparseIndex.clear();
+    // --- 3. Decode the Index Block ---
+    std::string_view indexBlock = metaView.substr(indexOffset - filterOffset);
+    size_t pos = 0;
+    uint64_t indexSize = 0;
+    blockIndex.clear();
+    // Every entry takes at least its two 8-byte fields after the count, which bounds a corrupt count
+    if (!decodeUint64(indexBlock, pos, indexSize) || indexSize > (indexBlock.size() - pos) / (2 * sizeof(uint64_t)))
+    {
+        std::cerr << "Error: Corrupt index block in " << filePath << std::endl;
+        return false;
+    }
+    blockIndex.reserve(indexSize, indexBlock.size() - pos - indexSize * 2 * sizeof(uint64_t));
     for (uint64_t i = 0; i < indexSize; ++i)
     {
-        std::string key = this->readString(inFile);
-        uint64_t offset = this->readUint64(inFile);
-        sparseIndex[key] = offset;
+        std::string_view key;
+        uint64_t offset = 0;
+        if (!decodeSlice(indexBlock, pos, key) || !decodeUint64(indexBlock, pos, offset) ||
+            !blockIndex.add(key, offset))
+        {
+            std::cerr << "Error: Corrupt index block in " << filePath << std::endl;
+            blockIndex.clear();
+            return false;
+        }
     }
 
-    inFile.close();
+    // --- 4. Map the File for Block Reads, unless it is too large ---
+    if (mmapReads && fileSize <= mmapLimit)
+    {
+        mapping = MappedFile::map(fd, fileSize);
+    }
+    if (mapping)
+    {
+        ::close(fd); // The mapping keeps the file referenced
+        fd = -1;
+    }
     return true;
 }
 
-std::optional<std::string> SSTable::find(const std::string &key)
+bool SSTable::decodeFooter(std::string_view tail, uint64_t fileSize, uint64_t &filterOffset, uint64_t &indexOffset,
+                           uint64_t &indexEnd, uint32_t &version)
 {
-    // Load the index into memory if it hasn't been already.
-    if (sparseIndex.empty())
+    size_t pos = 0;
+    if (tail.size() == static_cast<size_t>(FOOTER_SIZE))
+    {
+        uint64_t magic = 0;
+        decodeUint64(tail, pos, filterOffset);
+        decodeUint64(tail, pos, indexOffset);
+        decodeUint64(tail, pos, magic);
+        char digit = static_cast<char>(magic >> 56);
+        if ((magic & SSTABLE_MAGIC_MASK) == SSTABLE_MAGIC && digit >= '1' && digit <= '9')
+        {
+            version = digit - '0';
+            indexEnd = fileSize - FOOTER_SIZE;
+            return filterOffset <= indexOffset && indexOffset <= indexEnd;
+        }
+    }
+    if (tail.size() < sizeof(uint64_t))
+    {
+        return false;
+    }
+    // An older file: the footer is only the index offset, and there is no filter block
+    pos = tail.size() - sizeof(uint64_t);
+    decodeUint64(tail, pos, indexOffset);
+    filterOffset = indexOffset;
+    indexEnd = fileSize - sizeof(uint64_t);
+    version = 0;
+    return indexOffset <= indexEnd;
+}
+
+bool SSTable::ensureIndex()
+{
+    if (!indexLoaded.load(std::memory_order_acquire))
     {
-        if (!loadIndex())
+        std::lock_guard<std::mutex> lock(indexMutex);
+        if (!indexLoaded.load(std::memory_order_relaxed))
         {
-            return std::nullopt; // Failed to load index
+            if (!loadIndex())
+            {
+                return false;
+            }
+            indexLoaded.store(true, std::memory_order_release);
         }
     }
-    if (sparseIndex.empty())
+    return true;
+}
+
+bool SSTable::locateBlock(std::string_view key, uint64_t &blockOffset, uint64_t &blockEnd)
+{
+    // Load the index into memory if it hasn't been already.
+    if (!ensureIndex())
+    {
+        return false; // Failed to load index
+    }
+    if (!filter.may_contain(key))
     {
-        return std::nullopt; // Index is empty, key cannot exist
+        return false; // Definitely absent; no data block needs to be read
+    }
+    // Find the last block whose first key is less than or equal to the target key.
+    size_t block = blockIndex.find(key);
+    if (block == blockIndex.size())
+    {
+        // The index is empty, or the key is smaller than its first key, so it can't exist.
+        return false;
     }
 
+    blockOffset = blockIndex.offset(block);
+    // A block ends where the next one starts, or at the filter block for the last one.
+    blockEnd = block + 1 < blockIndex.size() ? blockIndex.offset(block + 1) : dataEnd;
+    return true;
+}
+
+std::optional<std::string> SSTable::find(std::string_view key)
+{
+    ValueRef value;
+    if (findRef(key, value))
+    {
+        return std::string(value.view()); // Key found!
+    }
+    return std::nullopt; // Key not found.
+}
+
+bool SSTable::findRef(std::string_view key, ValueRef &value)
+{
     // --- 1. Use the Sparse Index to Find the Right Data Block ---
-    // Find the last key in the index that is less than or equal to the target key.
-    auto it = sparseIndex.upper_bound(key);
-    if (it == sparseIndex.begin())
+    uint64_t blockOffset = 0;
+    uint64_t blockEnd = 0;
+    if (!locateBlock(key, blockOffset, blockEnd))
+    {
+        return false;
+    }
+
+    // --- 2. Get the Block: a view of the mapping, a cached block, or one read from disk ---
+    std::shared_ptr<const std::string> cached;
+    std::string_view contents;
+    if (!blockContents(blockOffset, blockEnd, cached, contents))
+    {
+        return false;
+    }
+
+    // --- 3. Search the Block for the Key ---
+    std::string_view found;
+    if (!searchBlock(contents, key, found))
+    {
+        return false; // Key not found in the block.
+    }
+    if (!cached && mapping)
+    {
+        value._pin = mapping; // The value lies in the mapping itself
+        value._view = found;
+        value._copy.clear();
+    }
+    else
+    {
+        value._pin.reset();
+        value._copy.assign(found);
+    }
+    return true;
+}
+
+void SSTable::findMany(const std::vector<std::string_view> &keys, std::vector<std::optional<std::string>> &values,
+                       size_t first, size_t last)
+{
+    // The block read last; consecutive keys usually land in the same block.
+    std::shared_ptr<const std::string> cached;
+    std::string_view block;
+    uint64_t loadedOffset = 0;
+    bool loaded = false;
+
+    for (size_t i = first; i < std::min(last, keys.size()); ++i)
+    {
+        if (values[i].has_value())
+        {
+            continue;
+        }
+        uint64_t blockOffset = 0;
+        uint64_t blockEnd = 0;
+        if (!locateBlock(keys[i], blockOffset, blockEnd))
+        {
+            continue;
+        }
+        if (!loaded || blockOffset != loadedOffset)
+        {
+            loaded = blockContents(blockOffset, blockEnd, cached, block);
+            loadedOffset = blockOffset;
+            if (!loaded)
+            {
+                continue;
+            }
+        }
+        std::string_view value;
+        if (searchBlock(block, keys[i], value))
+        {
+            values[i] = std::string(value);
+        }
+    }
+}
+
+bool SSTable::blockContents(uint64_t offset, uint64_t end, std::shared_ptr<const std::string> &cached,
+                            std::string_view &contents, bool fillCache)
+{
+    blockReads.fetch_add(1, std::memory_order_relaxed);
+    cached.reset();
+    if (offset >= end)
+    {
+        return false;
+    }
+    std::string_view stored;
+    if (mapping)
+    {
+        if (end > mapping->size())
+        {
+            return false;
+        }
+        stored = mapping->view(offset, end - offset);
+        if (formatVersion < 4 || stored.back() == BLOCK_RAW)
+        {
+            // Already in memory as it is; caching would only hold a second copy
+            std::string unused;
+            return unpackBlock(stored, unused, contents);
+        }
+    }
+
+    cached = blockCache.lookup(fileId, offset);
+    if (cached)
+    {
+        contents = *cached;
+        return true;
+    }
+    if (!mapping)
+    {
+        // Reused by every read on this thread, so a miss allocates only the block it caches
+        static thread_local std::string buffer;
+        buffer.resize(end - offset);
+        if (!readBlock(offset, buffer))
+        {
+            return false;
+        }
+        stored = buffer;
+    }
+    std::string decoded;
+    std::string_view view;
+    if (!unpackBlock(stored, decoded, view))
+    {
+        return false;
+    }
+    if (decoded.empty())
+    {
+        decoded.assign(view); // Stored raw in the read buffer
+    }
+    cached = std::make_shared<const std::string>(std::move(decoded));
+    if (fillCache)
+    {
+        blockCache.insert(fileId, offset, cached);
+    }
+    contents = *cached;
+    return true;
+}
+
+SSTable::Iterator::Iterator(SSTable &table) : table(table)
+{
+    if (!table.ensureIndex())
+    {
+        healthy = false;
+        return;
+    }
+    readNextBlock();
+}
+
+void SSTable::Iterator::next()
+{
+    if (++position >= entries.size())
+    {
+        readNextBlock();
+    }
+}
+
+void SSTable::Iterator::readNextBlock()
+{
+    entries.clear();
+    position = 0;
+    const FenceIndex &index = table.blockIndex;
+    while (entries.empty() && nextBlock < index.size())
+    {
+        uint64_t offset = index.offset(nextBlock);
+        uint64_t end = nextBlock + 1 < index.size() ? index.offset(nextBlock + 1) : table.dataEnd;
+        ++nextBlock;
+        std::shared_ptr<const std::string> cached;
+        std::string_view contents;
+        if (!table.blockContents(offset, end, cached, contents, false) || !table.decodeBlock(contents, entries))
+        {
+            std::cerr << "Error: Corrupt data block at offset " << offset << " in " << table.filePath << std::endl;
+            entries.clear();
+            healthy = false;
+            return;
+        }
+    }
+}
+
+bool SSTable::unpackBlock(std::string_view block, std::string &scratch, std::string_view &contents) const
+{
+    if (formatVersion < 4)
+    {
+        contents = block; // No type byte
+        return true;
+    }
+    if (block.empty())
+    {
+        return false;
+    }
+    char type = block.back();
+    block.remove_suffix(1);
+    if (type == BLOCK_RAW)
+    {
+        contents = block;
+        return true;
+    }
+    if (type != BLOCK_LZ || !LzCodec::decompress(block, scratch))
+    {
+        return false;
+    }
+    contents = scratch;
+    return true;
+}
+
+bool SSTable::searchBlock(std::string_view block, std::string_view key, std::string_view &value) const
+{
+    if (formatVersion < 2)
+    {
+        // Older blocks: a pair count, then the pairs; scan them in order
+        size_t pos = 0;
+        uint64_t pairsInBlock = 0;
+        if (!decodeUint64(block, pos, pairsInBlock))
+        {
+            return false;
+        }
+        std::string currentKey;
+        for (uint64_t i = 0; i < pairsInBlock; ++i)
+        {
+            std::string_view currentValue;
+            if (!decodeString(block, pos, currentKey) || !decodeSlice(block, pos, currentValue))
+            {
+                return false;
+            }
+            if (currentKey == key)
+            {
+                value = currentValue;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::string_view entries;
+    const char *restarts = nullptr;
+    uint32_t count = 0;
+    if (!parseRestarts(block, entries, restarts, count))
+    {
+        return false;
+    }
+    auto restartAt = [restarts](uint32_t i)
     {
-        // The key is smaller than the first key in the index, so it can't exist.
-        return std::nullopt;
+        uint32_t offset;
+        memcpy(&offset, restarts + i * sizeof(uint32_t), sizeof(offset));
+        return static_cast<size_t>(offset);
+    };
+
+    // Binary search for the last restart point whose key is not greater than the target
+    std::string currentKey;
+    std::string_view currentValue;
+    uint32_t left = 0;
+    uint32_t right = count - 1;
+    while (left < right)
+    {
+        uint32_t mid = left + (right - left + 1) / 2;
+        size_t pos = restartAt(mid);
+        if (!decodeEntry(entries, pos, currentKey, currentValue))
+        {
+            return false;
+        }
+        if (currentKey.compare(key) <= 0)
+        {
+            left = mid;
+        }
+        else
+        {
+            right = mid - 1;
+        }
+    }
+
+    // Scan forward from there; the key is within this restart interval if it is in the block
+    size_t pos = restartAt(left);
+    while (pos < entries.size())
+    {
+        if (!decodeEntry(entries, pos, currentKey, currentValue))
+        {
+            return false;
+        }
+        int order = currentKey.compare(key);
+        if (order == 0)
+        {
+            value = currentValue;
+            return true;
+        }
+        if (order > 0)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool SSTable::decodeBlock(std::string_view block, std::vector<KeyValuePair> &entries) const
+{
+    std::string key;
+    std::string_view value;
+    if (formatVersion < 2)
+    {
+        size_t pos = 0;
+        uint64_t pairsInBlock = 0;
+        // Every pair takes at least two length fields, which bounds a corrupt count
+        if (!decodeUint64(block, pos, pairsInBlock) || pairsInBlock > block.size() / (2 * sizeof(uint64_t)))
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i < pairsInBlock; ++i)
+        {
+            if (!decodeString(block, pos, key) || !decodeSlice(block, pos, value))
+            {
+                return false;
+            }
+            entries.emplace_back(key, std::string(value));
+        }
+        return true;
+    }
+
+    std::string_view region;
+    const char *restarts = nullptr;
+    uint32_t count = 0;
+    if (!parseRestarts(block, region, restarts, count))
+    {
+        return false;
+    }
+    size_t pos = 0;
+    while (pos < region.size())
+    {
+        if (!decodeEntry(region, pos, key, value))
+        {
+            return false;
+        }
+        entries.emplace_back(key, std::string(value));
+    }
+    return true;
+}
+
+bool SSTable::parseRestarts(std::string_view block, std::string_view &entries, const char *&restarts, uint32_t &count)
+{
+    if (block.size() < sizeof(uint32_t))
+    {
+        return false;
+    }
+    memcpy(&count, block.data() + block.size() - sizeof(uint32_t), sizeof(count));
+    size_t trailer = block.size() - sizeof(uint32_t);
+    if (count == 0 || trailer / sizeof(uint32_t) < count)
+    {
+        return false;
+    }
+    size_t restartsStart = trailer - count * sizeof(uint32_t);
+    entries = block.substr(0, restartsStart);
+    restarts = block.data() + restartsStart;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t offset;
+        memcpy(&offset, restarts + i * sizeof(uint32_t), sizeof(offset));
+        if (offset >= entries.size())
+        {
+            return false;
+        }
     }
-    // The correct block is the one preceding the upper_bound.
-    --it;
+    return true;
+}
 
-    uint64_t blockOffset = it->second;
+bool SSTable::decodeEntry(std::string_view entries, size_t &pos, std::string &key, std::string_view &value) const
+{
+    if (formatVersion < 3)
+    {
+        return decodeString(entries, pos, key) && decodeSlice(entries, pos, value);
+    }
+    uint64_t shared = 0;
+    uint64_t unshared = 0;
+    uint64_t valueLength = 0;
+    if (!decodeVarint(entries, pos, shared) || !decodeVarint(entries, pos, unshared) ||
+        !decodeVarint(entries, pos, valueLength) || shared > key.size() ||
+        entries.size() - pos < unshared || entries.size() - pos - unshared < valueLength)
+    {
+        return false;
+    }
+    key.resize(shared);
+    key.append(entries.data() + pos, unshared);
+    pos += unshared;
+    value = entries.substr(pos, valueLength);
+    pos += valueLength;
+    return true;
+}
 
-    // --- 2. Read the Relevant Data Block from Disk ---
-    std::ifstream inFile(filePath, std::ios::binary);
-    if (!inFile.is_open())
+bool SSTable::readBlock(uint64_t offset, std::string &buffer)
+{
+    IoRing *ring = IoRing::current();
+    if (ring)
     {
-        return std::nullopt;
+        ssize_t n = ring->read_sync(fd, &buffer[0], buffer.size(), offset);
+        return n == static_cast<ssize_t>(buffer.size());
     }
 
-    inFile.seekg(blockOffset);
-    uint64_t pairsInBlock = this->readUint64(inFile);
+    // pread leaves the file position alone, so threads can share the descriptor
+    size_t done = 0;
+    while (done < buffer.size())
+    {
+        ssize_t n = ::pread(fd, &buffer[done], buffer.size() - done, offset + done);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
 
-    // --- 3. Scan the Block for the Key ---
-    for (uint64_t i = 0; i < pairsInBlock; ++i)
+bool SSTable::decodeUint64(std::string_view buffer, size_t &pos, uint64_t &value)
+{
+    if (buffer.size() - pos < sizeof(value))
     {
-        std::string currentKey = this->readString(inFile);
-        std::string currentValue = this->readString(inFile);
-        if (currentKey == key)
+        return false;
+    }
+    memcpy(&value, buffer.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+bool SSTable::decodeVarint(std::string_view buffer, size_t &pos, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < buffer.size(); shift += 7)
+    {
+        uint64_t byte = static_cast<unsigned char>(buffer[pos++]);
+        value |= (byte & 0x7f) << shift;
+        if (!(byte & 0x80))
         {
-            return currentValue; // Key found!
+            return true;
         }
     }
+    return false;
+}
+
+bool SSTable::decodeSlice(std::string_view buffer, size_t &pos, std::string_view &value)
+{
+    uint64_t len = 0;
+    if (!decodeUint64(buffer, pos, len) || buffer.size() - pos < len)
+    {
+        return false;
+    }
+    value = buffer.substr(pos, len);
+    pos += len;
+    return true;
+}
 
-    return std::nullopt; // Key not found in the block.
+bool SSTable::decodeString(std::string_view buffer, size_t &pos, std::string &value)
+{
+    std::string_view slice;
+    if (!decodeSlice(buffer, pos, slice))
+    {
+        return false;
+    }
+    value.assign(slice);
+    return true;
 }
 
 string SSTable::get(const string &key)
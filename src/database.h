@@ -3,10 +3,18 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <fstream>
 #include <optional>
+#include <memory>
+#include <atomic>
+#include <mutex>
 #include <cstdint> // For uint64_t
+#include "bloom.h"
+#include "block_cache.h"
+#include "fence_index.h"
+#include "skiplist.h"
 using namespace std;
 
 class SSTable; // Forward declaration
@@ -14,6 +22,8 @@ class SSTable; // Forward declaration
 /**
  * @brief The MemTable class represents an in-memory key-value store.
  * It is responsible for temporarily storing data before flushing to disk as an SSTable.
+ * Entries live in a lock-free skip list, so puts from several threads and lookups may run
+ * at the same time; clear() needs the table to itself.
  */
 class MemTable
 {
@@ -25,8 +35,16 @@ public:
     bool readonly = false;
     /**
      * @brief The maximum number of key-value pairs this MemTable can hold before triggering a flush.
+     * 0 means no limit on the count; max_bytes still applies.
      */
-    long max_size = 1000000;
+    long max_size = 0;
+    /**
+     * @brief The memory budget, in bytes as reported by memory_usage(), at which the MemTable
+     * triggers a flush. Values replaced by later puts stay allocated until the MemTable is
+     * cleared, so they count against it and a single key overwritten over and over still
+     * fills it.
+     */
+    size_t max_bytes = 64 << 20;
 
     /**
      * @brief Constructs a new MemTable object.
@@ -38,7 +56,16 @@ public:
      * @param key The key to look up.
      * @return The value associated with the key, or an empty string if the key is not found.
      */
-    string get(const string &) const;
+    string get(string_view key) const;
+
+    /**
+     * @brief Looks up a batch of keys.
+     * @param keys The keys to look up.
+     * @param values Receives the value of every key found, at the key's position; keys with an
+     * empty value are treated as not found, like get() does. Entries that already hold a value
+     * are left alone and their keys are not looked up.
+     */
+    void get_many(const vector<string_view> &keys, vector<optional<string>> &values) const;
 
     /**
      * @brief Inserts or updates a key-value pair in the MemTable.
@@ -46,20 +73,34 @@ public:
      * @param payload The value to associate with the key.
      * @return True if the operation was successful.
      */
-    bool put(const string &, const string &);
+    bool put(string_view key, string_view payload);
 
     /**
      * @brief Flushes the current contents of the MemTable to a new SSTable file on disk.
      * @param filename The name of the file to create for the SSTable.
+     * @param directory The directory to create the file in, with a trailing slash.
      * @return A pointer to the newly created SSTable object.
      */
-    SSTable *flush(const string &filename);
+    SSTable *flush(const string &filename, const string &directory = "data/");
 
     /**
-     * @brief Checks if the MemTable has exceeded its maximum size.
-     * @return True if the number of entries is greater than or equal to max_size, false otherwise.
+     * @brief Writes the contents of the MemTable to a new SSTable file without clearing it,
+     * so it can keep serving reads while the file is written.
+     * @param filename The name of the file to create for the SSTable.
+     * @param directory The directory to create the file in, with a trailing slash.
+     * @return A pointer to the newly created SSTable object, or nullptr if writing failed.
      */
-    bool oversize() { return data.size() >= static_cast<std::map<string, string>::size_type>(max_size); }
+    SSTable *write_to_disk(const string &filename, const string &directory = "data/") const;
+
+    /**
+     * @brief Checks if the MemTable has exceeded its maximum size. Costs O(1).
+     * @return True if memory_usage() has reached max_bytes, or max_size is set and the number
+     * of entries has reached it; false otherwise.
+     */
+    bool oversize() const
+    {
+        return data.memory_usage() >= max_bytes || (max_size > 0 && data.size() >= static_cast<size_t>(max_size));
+    }
 
     /**
      * @brief Clears all key-value pairs from the MemTable.
@@ -73,14 +114,25 @@ public:
     bool is_empty() const { return data.empty(); }
 
     /**
-     * @brief Calculates the approximate size in bytes of the data currently in the MemTable.
-     * This is based on the sum of key and value string lengths.
-     * @return The approximate size of the MemTable data in bytes.
+     * @brief Returns the size in bytes of the data currently in the MemTable: the sum of the
+     * key and value lengths. Maintained on every put, so it costs O(1).
+     * @return The size of the MemTable data in bytes.
+     */
+    long long get_size_bytes() const { return static_cast<long long>(data.data_bytes()); }
+
+    /**
+     * @brief Returns the memory the MemTable holds, including node overhead, replaced values
+     * and the unused tail of its current arena block. Costs O(1).
+     */
+    size_t memory_usage() const { return data.memory_usage(); }
+
+    /**
+     * @brief Gives read access to the entries in key order, for iteration.
      */
-    long long get_size_bytes() const;
+    const SkipList &entries() const { return data; }
 
 private:
-    map<string, string> data;
+    SkipList data;
     string _storage_path;
 };
 
@@ -112,13 +164,122 @@ struct KeyValuePair
     }
 };
 
+/**
+ * @brief A read-only memory mapping of a whole file, unmapped when the last reference goes.
+ */
+class MappedFile
+{
+public:
+    /**
+     * @brief Maps an open file for reading; the descriptor may be closed afterwards.
+     * @param fd The file, open for reading.
+     * @param size The size of the file.
+     * @return The mapping, or nullptr if the file cannot be mapped or is empty.
+     */
+    static std::shared_ptr<const MappedFile> map(int fd, uint64_t size);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    size_t size() const { return _size; }
+
+    /**
+     * @brief Returns a view of part of the file; the range must lie inside it.
+     */
+    std::string_view view(uint64_t offset, uint64_t length) const { return std::string_view(_data + offset, length); }
+
+private:
+    MappedFile(const char *data, size_t size) : _data(data), _size(size) {}
+
+    const char *_data;
+    size_t _size;
+};
+
+/**
+ * @brief A value found by SSTable::findRef. Values of uncompressed blocks in a mapped table
+ * are views straight into the mapping, which the ref keeps mapped even if the table goes away;
+ * any other value is copied into the ref.
+ */
+class ValueRef
+{
+public:
+    /**
+     * @brief Returns the value; valid as long as this ref is alive and unchanged.
+     */
+    std::string_view view() const { return _pin ? _view : std::string_view(_copy); }
+
+    /**
+     * @brief Checks whether the value is read from the mapping without a copy.
+     */
+    bool zero_copy() const { return _pin != nullptr; }
+
+private:
+    friend class SSTable;
+    std::shared_ptr<const MappedFile> _pin;
+    std::string_view _view;
+    std::string _copy;
+};
+
 /**
  * @brief A simplified implementation of a Sorted String Table (SSTable).
  * SSTables are immutable files on disk that store sorted key-value pairs.
+ * File layout: data blocks, a Bloom filter block over every key, the sparse index block,
+ * and a footer holding the filter offset, the index offset and a magic number that carries
+ * the format version. Data blocks fill up to about blockSize bytes and end with an array of
+ * restart points (the offsets of every 16th entry) and their count, so a lookup binary
+ * searches the restart keys and scans at most one interval. Each entry is three varints
+ * (bytes of the key shared with the previous key, remaining key bytes, value length), the
+ * remaining key bytes and the value; entries at restart points share nothing. A block is
+ * stored followed by a type byte: raw, or compressed with LzCodec as a whole.
+ * Older files are still read: without a magic number there is no filter block, before
+ * format 2 every block starts with its pair count and has no restart points, and before
+ * format 3 keys are stored whole with 8-byte lengths, and before format 4 blocks have no
+ * type byte.
  */
 class SSTable
 {
 public:
+    /**
+     * @brief Bloom filter bits per key for tables written from now on; 0 writes no filter.
+     * Lookups for keys a table's filter rules out never read a data block.
+     */
+    static int bloomBitsPerKey;
+
+    /**
+     * @brief Target size in bytes of the data blocks of tables written from now on. A block is
+     * closed once it reaches this size, so it holds at least one pair however large.
+     */
+    static size_t blockSize;
+
+    /**
+     * @brief Whether tables written from now on compress their data blocks. A block that does
+     * not shrink by at least an eighth is stored raw either way.
+     */
+    static bool compressBlocks;
+
+    /**
+     * @brief Whether tables map their file when they load their index, so block reads are
+     * plain memory accesses with no syscalls and values can be returned without copies.
+     * When false, every block is read from the file.
+     */
+    static bool mmapReads;
+
+    /**
+     * @brief Files larger than this many bytes are not mapped even when mmapReads is set.
+     * They keep one descriptor open instead and read each block with a single pread, which
+     * spares address space and page-table work for tables much larger than memory.
+     */
+    static uint64_t mmapLimit;
+
+    /**
+     * @brief Decoded data blocks shared by all tables, so hot blocks are neither read nor
+     * decompressed again. Raw blocks of mapped tables bypass it since they are already in
+     * memory as they are. Holds 8 MiB unless resized.
+     */
+    static BlockCache blockCache;
+
     /**
      * @brief Constructs a new SSTable object.
      * If loadData is true, the constructor loads the entire SSTable data from the specified file into memory.
@@ -128,6 +289,11 @@ public:
      */
     explicit SSTable(const string &filePath, bool loadData = false);
 
+    /**
+     * @brief Closes the file, if it is still open for block reads.
+     */
+    ~SSTable();
+
     /**
      * @brief Retrieves the value associated with a given key from the SSTable.
      * If the SSTable was loaded with all data into memory (loadData = true), it searches the in-memory map.
@@ -166,8 +332,7 @@ public:
     std::vector<KeyValuePair> getAllKeyValues() const;
 
     /**
-     * @brief Writes a vector of sorted key-value pairs (representing a Memtable) to the file.
-     * This method is used when flushing a MemTable to disk.
+     * @brief Writes a vector of sorted key-value pairs to the file through an SSTableBuilder.
      * @param memtable A vector of KeyValuePair objects to write to the file.
      * @return True on success, false on failure.
      */
@@ -178,7 +343,77 @@ public:
      * @param key The key to search for.
      * @return An optional<string> which is empty if the key is not found, otherwise contains the value.
      */
-    std::optional<std::string> find(const std::string &key);
+    std::optional<std::string> find(std::string_view key);
+
+    /**
+     * @brief Finds a value like find(), but hands it out as a ValueRef, which for a mapped
+     * table with an uncompressed block is a view into the mapping instead of a copy.
+     * @param key The key to search for.
+     * @param value Receives the value if the key is found.
+     * @return True if the key is found.
+     */
+    bool findRef(std::string_view key, ValueRef &value);
+
+    /**
+     * @brief Finds the values of a batch of keys, reading each data block at most once.
+     * Because the keys are sorted, all keys that fall into one block are resolved
+     * from a single read of that block.
+     * @param keys The keys to search for, in ascending order.
+     * @param values Receives the value of every key found, at the key's position. Entries that
+     * already hold a value are left alone and their keys are not searched for.
+     * @param first, last Only keys[first, last) are searched for; by default, all of them.
+     */
+    void findMany(const std::vector<std::string_view> &keys, std::vector<std::optional<std::string>> &values,
+                  size_t first = 0, size_t last = SIZE_MAX);
+
+    /**
+     * @brief Walks every pair of the file in key order, one data block at a time, so memory
+     * stays at one decoded block however large the table is. Blocks are read past the block
+     * cache, so a scan does not evict the blocks lookups keep hot.
+     */
+    class Iterator
+    {
+    public:
+        /**
+         * @brief Positions the iterator at the first pair of a table, loading its index if needed.
+         */
+        explicit Iterator(SSTable &table);
+
+        /**
+         * @brief Checks whether the iterator is positioned at a pair.
+         */
+        bool valid() const { return position < entries.size(); }
+
+        /**
+         * @brief Returns the current key; the iterator must be valid.
+         */
+        const std::string &key() const { return entries[position].key; }
+
+        /**
+         * @brief Returns the current value; the iterator must be valid.
+         */
+        const std::string &value() const { return entries[position].value; }
+
+        /**
+         * @brief Moves to the next pair, reading the next block when this one is used up.
+         */
+        void next();
+
+        /**
+         * @brief Checks that no block failed to read or decode. A failed iterator stops being valid.
+         */
+        bool ok() const { return healthy; }
+
+    private:
+        // Decodes blocks from the next unread one on until one has pairs, or none are left.
+        void readNextBlock();
+
+        SSTable &table;
+        size_t nextBlock = 0;
+        std::vector<KeyValuePair> entries;
+        size_t position = 0;
+        bool healthy = true;
+    };
 
     /**
      * @brief Returns the full file path of this SSTable.
@@ -186,12 +421,33 @@ public:
      */
     std::string get_filename() const; // New method declaration
 
+    /**
+     * @brief Returns how many data blocks lookups have read from the file so far.
+     */
+    uint64_t getBlockReads() const { return blockReads.load(std::memory_order_relaxed); }
+
 private:
     std::string filePath;
     map<string, string> data;
-    // The in-memory representation of the SSTable's index.
-    // Maps the first key of a data block to the offset of that block in the file.
-    std::map<std::string, uint64_t> sparseIndex;
+    // The in-memory representation of the SSTable's index: the first key and file offset
+    // of every data block, in key order.
+    FenceIndex blockIndex;
+    // Offset where the data blocks end (the start of the filter block), known once the index is loaded.
+    uint64_t dataEnd = 0;
+    // Filter over every key in the file, loaded with the index; empty for files without one.
+    BloomFilter filter;
+    // Format version from the footer: 0 for files without a magic number.
+    uint32_t formatVersion = 0;
+    // The whole file, mapped with the index when mmapReads is set and it is within mmapLimit.
+    std::shared_ptr<const MappedFile> mapping;
+    // The file, kept open from loading the index on when it is not mapped; -1 otherwise.
+    int fd = -1;
+    // Identifies this version of the file in blockCache.
+    uint64_t fileId = 0;
+    std::atomic<uint64_t> blockReads{0};
+    // The index is loaded lazily by the first lookup; lookups may come from several threads.
+    std::mutex indexMutex;
+    std::atomic<bool> indexLoaded{false};
 
     /**
      * @brief Loads the sparse index from the SSTable file into memory.
@@ -200,34 +456,104 @@ private:
      */
     bool loadIndex();
 
-    // Helper functions for serializing/deserializing data to/from the file.
     /**
-     * @brief Writes a string to an output filestream.
-     * @param out The output filestream.
-     * @param str The string to write.
+     * @brief Decodes the footer of an SSTable file.
+     * @param tail The last FOOTER_SIZE bytes of the file, or the whole file if it is shorter.
+     * @param fileSize The size of the file.
+     * @param filterOffset Receives the end of the data blocks, where the filter block starts.
+     * @param indexOffset Receives the start of the index block, where the filter block ends.
+     * @param indexEnd Receives the end of the index block, where the footer starts.
+     * @param version Receives the format version.
+     * @return False if the file is too short to have a footer or the offsets are out of order.
+     */
+    static bool decodeFooter(std::string_view tail, uint64_t fileSize, uint64_t &filterOffset, uint64_t &indexOffset,
+                             uint64_t &indexEnd, uint32_t &version);
+
+    /**
+     * @brief Loads the index unless it is loaded already. Safe to call from several threads at once.
+     * @return False if the index cannot be loaded.
+     */
+    bool ensureIndex();
+
+    /**
+     * @brief Finds the data block that may hold a key, loading the index first if needed.
+     * Safe to call from several threads at once.
+     * @param key The key to locate.
+     * @param blockOffset Receives the file offset of the block.
+     * @param blockEnd Receives the offset just past the block.
+     * @return False if the Bloom filter rules the key out, the key sorts before every block,
+     * or the index cannot be loaded.
+     */
+    bool locateBlock(std::string_view key, uint64_t &blockOffset, uint64_t &blockEnd);
+
+    /**
+     * @brief Reads one whole data block into memory with a single positioned read on the
+     * table's open descriptor. Goes through the calling thread's io_uring when the server
+     * installed one, and through pread otherwise; either way threads can read at once.
+     * @param offset The file offset of the block.
+     * @param buffer Receives the block; its size is the number of bytes to read.
+     * @return True if the whole block was read.
+     */
+    bool readBlock(uint64_t offset, std::string &buffer);
+
+    /**
+     * @brief Gets the contents of one data block: a view of the mapping, or the decoded block
+     * from blockCache, read from the file and decompressed first if it is not cached yet.
+     * @param offset The file offset of the block.
+     * @param end The offset just past the block.
+     * @param cached Holds the contents when they are not a view of the mapping; null otherwise.
+     * @param contents Receives the contents.
+     * @param fillCache Whether a block that is not cached yet is added to blockCache.
+     * @return False if the block cannot be read or is malformed.
+     */
+    bool blockContents(uint64_t offset, uint64_t end, std::shared_ptr<const std::string> &cached,
+                       std::string_view &contents, bool fillCache = true);
+
+    /**
+     * @brief Turns a data block as stored in the file into its contents, removing the type
+     * byte and decompressing if needed.
+     * @param block The block as stored.
+     * @param scratch Receives the decompressed bytes, if the block is compressed.
+     * @param contents Receives the contents: part of block, or scratch.
+     * @return False if the type is unknown or the block does not decompress.
+     */
+    bool unpackBlock(std::string_view block, std::string &scratch, std::string_view &contents) const;
+
+    /**
+     * @brief Looks a key up in one data block already in memory.
+     * @param block The block.
+     * @param key The key to look up.
+     * @param value Receives a view of the value inside the block if the key is found.
+     * @return True if the key is in the block.
      */
-    void writeString(std::ofstream &out, const std::string &str);
+    bool searchBlock(std::string_view block, std::string_view key, std::string_view &value) const;
 
     /**
-     * @brief Reads a string from an input filestream.
-     * @param in The input filestream.
-     * @return The string read from the stream.
+     * @brief Decodes every pair of one data block already in memory, in key order.
+     * @return False if the block is malformed.
      */
-    std::string readString(std::ifstream &in);
+    bool decodeBlock(std::string_view block, std::vector<KeyValuePair> &entries) const;
 
     /**
-     * @brief Writes a uint64_t value to an output filestream.
-     * @param out The output filestream.
-     * @param value The uint64_t value to write.
+     * @brief Splits a block with restart points into its entries and its restart array.
+     * @return False if the trailer is malformed.
      */
-    void writeUint64(std::ofstream &out, uint64_t value);
+    static bool parseRestarts(std::string_view block, std::string_view &entries, const char *&restarts, uint32_t &count);
 
     /**
-     * @brief Reads a uint64_t value from an input filestream.
-     * @param in The input filestream.
-     * @return The uint64_t value read from the stream.
+     * @brief Decodes the entry of a block with restart points that starts at pos.
+     * @param key Holds the previous entry's key, whose shared prefix the entry reuses;
+     * receives the entry's key.
+     * @param value Receives a view of the value inside the block.
      */
-    uint64_t readUint64(std::ifstream &in);
+    bool decodeEntry(std::string_view entries, size_t &pos, std::string &key, std::string_view &value) const;
+
+    // Helpers for decoding fields from a block already in memory.
+    // Each advances pos and returns false if the field runs past the end of the buffer.
+    static bool decodeUint64(std::string_view buffer, size_t &pos, uint64_t &value);
+    static bool decodeVarint(std::string_view buffer, size_t &pos, uint64_t &value);
+    static bool decodeSlice(std::string_view buffer, size_t &pos, std::string_view &value);
+    static bool decodeString(std::string_view buffer, size_t &pos, std::string &value);
 
     /**
      * @brief Placeholder method to get the key position within the file. Not fully implemented for in-memory SSTable.
@@ -246,4 +572,82 @@ private:
     string get_value_by_pos(const int offset, const int length);
 };
 
+/**
+ * @brief Writes an SSTable one pair at a time, so flushes and merges stream their output
+ * instead of building the whole table in memory first. Only the open block, the index and
+ * the key hashes for the filter are held; finished blocks collect in an output buffer that
+ * is written with one write() call per BUFFER_SIZE bytes, and file offsets are counted
+ * rather than asked of the stream. The file is only a valid table once finish() succeeds;
+ * a builder destroyed before that deletes its partial file.
+ */
+class SSTableBuilder
+{
+public:
+    /**
+     * @brief Bytes of finished blocks buffered before they are written out.
+     */
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    /**
+     * @brief Creates or truncates the file, creating its directory if needed.
+     * @param filePath The path of the table to write.
+     */
+    explicit SSTableBuilder(const std::string &filePath);
+    ~SSTableBuilder();
+
+    SSTableBuilder(const SSTableBuilder &) = delete;
+    SSTableBuilder &operator=(const SSTableBuilder &) = delete;
+
+    /**
+     * @brief Appends a pair; keys must be added in strictly ascending order.
+     * @return False if the key is out of order or a write failed; the builder is then unusable.
+     */
+    bool add(std::string_view key, std::string_view value);
+
+    /**
+     * @brief Writes the last block, the filter, the index and the footer, and closes the file.
+     * @return True if the whole table was written.
+     */
+    bool finish();
+
+    /**
+     * @brief Returns false once opening, adding or writing has failed.
+     */
+    bool ok() const { return !failed; }
+
+    uint64_t entries() const { return count; }
+
+    /**
+     * @brief Returns the bytes produced so far, written or buffered.
+     */
+    uint64_t fileSize() const { return offset + out.size(); }
+
+private:
+    // Appends the restart array and type byte to the open block and moves it to the output buffer.
+    void closeBlock();
+    // Writes the output buffer once it holds BUFFER_SIZE bytes.
+    bool flushIfFull();
+    // Writes out the whole output buffer.
+    bool flush();
+
+    std::string filePath;
+    int fd = -1;
+    std::string out;
+    // File offset of the first byte in out
+    uint64_t offset = 0;
+    std::string block;
+    std::vector<uint32_t> restarts;
+    size_t pairsInBlock = 0;
+    std::string lastKey;
+    uint64_t count = 0;
+    // The encoded index entries, and how many there are
+    std::string index;
+    uint64_t indexEntries = 0;
+    std::vector<uint64_t> hashes;
+    bool failed = false;
+    // Set once the file is opened; a builder that never opened it must not delete it
+    bool created = false;
+    bool finished = false;
+};
+
 #endif // DATABASE_H
\ No newline at end of file
@@ -0,0 +1,77 @@
+#include "fence_index.h"
+#include <cstring>
+
+uint64_t FenceIndex::prefix(std::string_view key)
+{
+    if (key.size() >= sizeof(uint64_t))
+    {
+        uint64_t value;
+        memcpy(&value, key.data(), sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        value = __builtin_bswap64(value);
+#endif
+        return value;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < key.size(); ++i)
+    {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(key[i])) << (56 - 8 * i);
+    }
+    return value;
+}
+
+void FenceIndex::clear()
+{
+    _fences.clear();
+    _keys.clear();
+}
+
+void FenceIndex::reserve(size_t fences, size_t key_bytes)
+{
+    _fences.reserve(fences);
+    _keys.reserve(key_bytes);
+}
+
+bool FenceIndex::add(std::string_view first_key, uint64_t offset)
+{
+    if (!_fences.empty() && first_key.compare(key(_fences.size() - 1)) <= 0)
+    {
+        return false;
+    }
+    _fences.push_back(Fence{prefix(first_key), offset, static_cast<uint32_t>(_keys.size()),
+                            static_cast<uint32_t>(first_key.size())});
+    _keys.append(first_key);
+    return true;
+}
+
+bool FenceIndex::after(const Fence &fence, uint64_t key_prefix, std::string_view key) const
+{
+    if (fence.prefix != key_prefix)
+    {
+        return fence.prefix > key_prefix;
+    }
+    return std::string_view(_keys.data() + fence.key_offset, fence.key_size).compare(key) > 0;
+}
+
+size_t FenceIndex::find(std::string_view key) const
+{
+    if (_fences.empty())
+    {
+        return 0;
+    }
+    uint64_t key_prefix = prefix(key);
+    // The answer stays within [base, base + n); each step halves n without a branch on the outcome
+    const Fence *base = _fences.data();
+    size_t n = _fences.size();
+    while (n > 1)
+    {
+        size_t half = n / 2;
+        base = after(base[half], key_prefix, key) ? base : base + half;
+        n -= half;
+    }
+    if (after(*base, key_prefix, key))
+    {
+        return _fences.size(); // Only possible for the first fence
+    }
+    return base - _fences.data();
+}
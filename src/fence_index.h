@@ -0,0 +1,80 @@
+#ifndef FENCE_INDEX_H
+#define FENCE_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief The index of an SSTable: the first key and file offset of every data block, kept
+ * flat. All keys share one contiguous buffer, and each fence is a fixed 24-byte record with
+ * the first eight key bytes as a big-endian integer, so most comparisons of a search are one
+ * integer compare on a packed array and only ties compare whole keys.
+ * The search is a branchless binary search, whose data-dependent step compiles to a
+ * conditional move.
+ */
+class FenceIndex
+{
+public:
+    /**
+     * @brief Removes every fence.
+     */
+    void clear();
+
+    /**
+     * @brief Reserves room, so loading a table of known size allocates once.
+     * @param fences The number of blocks.
+     * @param key_bytes The total size of their first keys.
+     */
+    void reserve(size_t fences, size_t key_bytes);
+
+    /**
+     * @brief Appends the fence of the next block.
+     * @param first_key The first key of the block; must sort after that of the previous block.
+     * @param offset The file offset of the block.
+     * @return False if first_key is not after the previous fence's key; nothing is added then.
+     */
+    bool add(std::string_view first_key, uint64_t offset);
+
+    /**
+     * @brief Finds the block that may hold a key: the last one whose first key is not after it.
+     * @return The position of that fence, or size() if the key sorts before every block.
+     */
+    size_t find(std::string_view key) const;
+
+    bool empty() const { return _fences.empty(); }
+    size_t size() const { return _fences.size(); }
+
+    std::string_view key(size_t i) const { return std::string_view(_keys.data() + _fences[i].key_offset, _fences[i].key_size); }
+    uint64_t offset(size_t i) const { return _fences[i].offset; }
+
+    /**
+     * @brief Returns the bytes held by the fences and their keys.
+     */
+    size_t memory_usage() const { return _fences.capacity() * sizeof(Fence) + _keys.capacity(); }
+
+    /**
+     * @brief Returns the first eight bytes of a key as a big-endian integer, zero-padded, so
+     * that a smaller prefix always means a smaller key; equal prefixes say nothing.
+     */
+    static uint64_t prefix(std::string_view key);
+
+private:
+    struct Fence
+    {
+        uint64_t prefix;
+        uint64_t offset;
+        uint32_t key_offset;
+        uint32_t key_size;
+    };
+
+    // Checks whether a fence's key sorts after the search key.
+    bool after(const Fence &fence, uint64_t key_prefix, std::string_view key) const;
+
+    std::vector<Fence> _fences;
+    std::string _keys;
+};
+
+#endif // FENCE_INDEX_H
@@ -2,13 +2,61 @@
 #include <iostream>
 #include <string>
 #include <filesystem> // Required for std::filesystem::current_path
+#include <cstdlib>    // For std::atoi
+#include <algorithm>  // For std::max
 
-int main()
+int main(int argc, char *argv[])
 {
     std::cout << "Server starting in directory: " << std::filesystem::current_path() << std::endl;
 
+    // Optional first argument: number of shards (0 = one per core). Defaults to a single shard.
+    int shards = argc > 1 ? std::atoi(argv[1]) : 1;
+
     // Create a Server instance listening on port 5991
-    Server server("127.0.0.1", 5991);
+    Server server("127.0.0.1", 5991, shards);
+
+    // Optional second argument "uring" selects the io_uring engine (falls back to epoll if unsupported)
+    if (argc > 2 && std::string(argv[2]) == "uring")
+    {
+        server.use_io_uring = true;
+    }
+
+    // Optional third argument: number of storage worker threads (0 = execute on the shard threads)
+    if (argc > 3)
+    {
+        server.worker_threads = std::max(0, std::atoi(argv[3]));
+    }
+
+    // Optional fourth argument: write-ahead log sync policy, "always", "none", or a sync interval in ms
+    if (argc > 4)
+    {
+        std::string sync = argv[4];
+        if (sync == "always")
+        {
+            server.wal_sync = WalSync::EVERY_WRITE;
+        }
+        else if (sync == "none")
+        {
+            server.wal_sync = WalSync::NONE;
+        }
+        else
+        {
+            server.wal_sync = WalSync::INTERVAL;
+            server.wal_sync_interval_ms = std::max(1, std::atoi(argv[4]));
+        }
+    }
+
+    // Optional fifth argument: MemTable memory budget per shard in MiB
+    if (argc > 5)
+    {
+        server.memtable_bytes = static_cast<size_t>(std::max(1, std::atoi(argv[5]))) << 20;
+    }
+
+    // Optional sixth argument: shared SSTable block cache size in MiB (0 disables it)
+    if (argc > 6)
+    {
+        server.block_cache_bytes = static_cast<size_t>(std::max(0, std::atoi(argv[6]))) << 20;
+    }
     std::cout << "Server instance created." << std::endl;
 
     // Start the server to listen for incoming connections
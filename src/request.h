@@ -2,29 +2,257 @@
 #define REQUEST_H
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+// Binary framing shared by requests and responses.
+// A request frame is: opcode (1 byte), key length (4 bytes), value length (4 bytes), key, value.
+// A response frame is: status (1 byte), payload length (4 bytes), payload.
+// Lengths are little-endian. Opcodes have the high bit set, so a binary frame can never be
+// mistaken for a text command, and both formats can share one connection.
+// Batch commands (MGET, MPUT) carry lists in the key and value fields: each list is a run of
+// (length (4 bytes), bytes) entries. A STATUS_VALUES payload is a run of (found (1 byte), length
+// (4 bytes), value) entries, one per requested key.
+namespace BinaryProtocol
+{
+    const uint8_t OP_GET = 0x81;
+    const uint8_t OP_PUT = 0x82;
+    const uint8_t OP_MGET = 0x83;
+    const uint8_t OP_MPUT = 0x84;
+
+    const uint8_t STATUS_OK = 0x00;
+    const uint8_t STATUS_VALUE = 0x01;
+    const uint8_t STATUS_ERROR = 0x02;
+    const uint8_t STATUS_VALUES = 0x03;
+
+    const size_t REQUEST_HEADER_SIZE = 9;
+    const size_t RESPONSE_HEADER_SIZE = 5;
+
+    // Returns true if the byte starts a binary frame rather than a text command
+    inline bool is_binary(char first_byte) { return (static_cast<uint8_t>(first_byte) & 0x80) != 0; }
+
+    inline void append_uint32(std::string &out, uint32_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            out += static_cast<char>((value >> (8 * i)) & 0xff);
+        }
+    }
+
+    inline uint32_t read_uint32(const char *data)
+    {
+        const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+        return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+               (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+
+    // Appends each item as a length-prefixed entry
+    template <typename Items>
+    inline void append_list(std::string &out, const Items &items)
+    {
+        for (const auto &item : items)
+        {
+            append_uint32(out, item.size());
+            out.append(item.data(), item.size());
+        }
+    }
+
+    // Splits a run of length-prefixed entries into views over `data`.
+    // Returns false if an entry runs past the end.
+    inline bool split_list(std::string_view data, std::vector<std::string_view> &items)
+    {
+        while (!data.empty())
+        {
+            if (data.size() < 4)
+            {
+                return false;
+            }
+            uint32_t length = read_uint32(data.data());
+            data.remove_prefix(4);
+            if (data.size() < length)
+            {
+                return false;
+            }
+            items.push_back(data.substr(0, length));
+            data.remove_prefix(length);
+        }
+        return true;
+    }
+}
 
 // Enum for request types
 enum class RequestType
 {
     GET,
     PUT,
+    MGET, // Batch of GETs answered in one response
+    MPUT, // Batch of PUTs acknowledged in one response
     UNKNOWN
 };
 
+// Non-owning view of a request, pointing into a connection's receive buffer
+struct RequestView
+{
+    RequestType type = RequestType::UNKNOWN;
+    std::string_view key;
+    std::string_view value;
+    std::vector<std::string_view> keys;   // MGET and MPUT only
+    std::vector<std::string_view> values; // MPUT only, one per key
+
+    // Returns true for commands that carry a list of keys rather than a single key
+    bool is_batch() const { return type == RequestType::MGET || type == RequestType::MPUT; }
+
+    // Parses one text command ("GET key", "PUT key value", "MGET k1 k2 ...",
+    // "MPUT k1 v1 k2 v2 ...") in place, without copying.
+    // Batch commands separate their words with spaces, so their values cannot contain spaces.
+    static RequestView parse_text(std::string_view data)
+    {
+        RequestView out;
+        if (data.rfind("MGET ", 0) == 0 || data.rfind("MPUT ", 0) == 0)
+        {
+            std::vector<std::string_view> words;
+            split_words(data.substr(5), words);
+            if (data[1] == 'G')
+            {
+                out.type = RequestType::MGET;
+                out.keys = std::move(words);
+            }
+            else if (words.size() % 2 == 0)
+            {
+                out.type = RequestType::MPUT;
+                for (size_t i = 0; i < words.size(); i += 2)
+                {
+                    out.keys.push_back(words[i]);
+                    out.values.push_back(words[i + 1]);
+                }
+            }
+        }
+        else if (data.rfind("GET ", 0) == 0)
+        { // Starts with "GET "
+            out.type = RequestType::GET;
+            out.key = data.substr(4);
+        }
+        else if (data.rfind("PUT ", 0) == 0)
+        {                                           // Starts with "PUT "
+            size_t first_space = data.find(' ', 4); // Find space after "PUT "
+            if (first_space != std::string_view::npos)
+            {
+                out.type = RequestType::PUT;
+                out.key = data.substr(4, first_space - 4);
+                out.value = data.substr(first_space + 1);
+            }
+        }
+        return out; // UNKNOWN request unless a command matched
+    }
+
+    // Parses one binary request frame in place, without copying the key or value.
+    // Returns the frame length, or 0 if `length` bytes do not yet hold a whole frame.
+    // `frame_size` receives the full frame length as soon as the header is available.
+    static size_t parse_binary(const char *data, size_t length, RequestView &out, uint64_t &frame_size)
+    {
+        if (length < BinaryProtocol::REQUEST_HEADER_SIZE)
+        {
+            frame_size = 0;
+            return 0;
+        }
+        uint32_t key_length = BinaryProtocol::read_uint32(data + 1);
+        uint32_t value_length = BinaryProtocol::read_uint32(data + 5);
+        frame_size = BinaryProtocol::REQUEST_HEADER_SIZE + static_cast<uint64_t>(key_length) + value_length;
+        if (length < frame_size)
+        {
+            return 0;
+        }
+        const char *payload = data + BinaryProtocol::REQUEST_HEADER_SIZE;
+        switch (static_cast<uint8_t>(data[0]))
+        {
+        case BinaryProtocol::OP_GET:
+            out.type = RequestType::GET;
+            break;
+        case BinaryProtocol::OP_PUT:
+            out.type = RequestType::PUT;
+            break;
+        case BinaryProtocol::OP_MGET:
+            out.type = RequestType::MGET;
+            break;
+        case BinaryProtocol::OP_MPUT:
+            out.type = RequestType::MPUT;
+            break;
+        default:
+            out.type = RequestType::UNKNOWN;
+            break;
+        }
+        out.key = std::string_view(payload, key_length);
+        out.value = std::string_view(payload + key_length, value_length);
+        if (out.is_batch())
+        {
+            bool valid = BinaryProtocol::split_list(out.key, out.keys) && BinaryProtocol::split_list(out.value, out.values);
+            if (!valid || (out.type == RequestType::MGET && !out.values.empty()) ||
+                (out.type == RequestType::MPUT && out.values.size() != out.keys.size()))
+            {
+                out.type = RequestType::UNKNOWN; // Malformed list; the frame is still consumed
+            }
+            out.key = std::string_view();
+            out.value = std::string_view();
+        }
+        return frame_size;
+    }
+
+private:
+    // Appends the space-separated words of `data`, skipping repeated spaces
+    static void split_words(std::string_view data, std::vector<std::string_view> &words)
+    {
+        size_t start = 0;
+        while (start < data.size())
+        {
+            size_t end = data.find(' ', start);
+            if (end == std::string_view::npos)
+            {
+                end = data.size();
+            }
+            if (end > start)
+            {
+                words.push_back(data.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+    }
+};
+
 // Base Request structure
 struct Request
 {
     RequestType type;
     std::string key;
     std::string value;
+    std::vector<std::string> keys;   // MGET and MPUT only
+    std::vector<std::string> values; // MPUT only, one per key
 
     Request() : type(RequestType::UNKNOWN) {}
     Request(RequestType t, const std::string &k = "", const std::string &v = "")
         : type(t), key(k), value(v) {}
+    Request(RequestType t, const std::vector<std::string> &ks, const std::vector<std::string> &vs = {})
+        : type(t), keys(ks), values(vs) {}
+    explicit Request(const RequestView &view)
+        : type(view.type), key(view.key), value(view.value),
+          keys(view.keys.begin(), view.keys.end()), values(view.values.begin(), view.values.end()) {}
 
-    // Serialize request to string (e.g., "GET key", "PUT key value")
+    // View over this request's own strings
+    RequestView view() const
+    {
+        RequestView v;
+        v.type = type;
+        v.key = key;
+        v.value = value;
+        v.keys.assign(keys.begin(), keys.end());
+        v.values.assign(values.begin(), values.end());
+        return v;
+    }
+
+    // Serialize request to string (e.g., "GET key", "PUT key value", "MGET k1 k2")
     std::string serialize() const
     {
         if (type == RequestType::GET)
@@ -35,27 +263,57 @@ struct Request
         {
             return "PUT " + key + " " + value;
         }
+        else if (type == RequestType::MGET || type == RequestType::MPUT)
+        {
+            std::string out = type == RequestType::MGET ? "MGET" : "MPUT";
+            for (size_t i = 0; i < keys.size(); ++i)
+            {
+                out += " " + keys[i];
+                if (type == RequestType::MPUT)
+                {
+                    out += " " + (i < values.size() ? values[i] : std::string());
+                }
+            }
+            return out;
+        }
         return "UNKNOWN";
     }
 
-    // Deserialize request from string
-    static Request deserialize(const std::string &data)
+    // Serialize request to a binary frame; keys and values may hold any bytes
+    std::string serialize_binary() const
     {
-        if (data.rfind("GET ", 0) == 0)
-        { // Starts with "GET "
-            return Request(RequestType::GET, data.substr(4));
-        }
-        else if (data.rfind("PUT ", 0) == 0)
-        {                                           // Starts with "PUT "
-            size_t first_space = data.find(' ', 4); // Find space after "PUT "
-            if (first_space != std::string::npos)
+        if (type == RequestType::MGET || type == RequestType::MPUT)
+        {
+            std::string key_list;
+            std::string value_list;
+            BinaryProtocol::append_list(key_list, keys);
+            if (type == RequestType::MPUT)
             {
-                std::string key_str = data.substr(4, first_space - 4);
-                std::string value_str = data.substr(first_space + 1);
-                return Request(RequestType::PUT, key_str, value_str);
+                BinaryProtocol::append_list(value_list, values);
             }
+            std::string out;
+            out.reserve(BinaryProtocol::REQUEST_HEADER_SIZE + key_list.size() + value_list.size());
+            out += static_cast<char>(type == RequestType::MPUT ? BinaryProtocol::OP_MPUT : BinaryProtocol::OP_MGET);
+            BinaryProtocol::append_uint32(out, key_list.size());
+            BinaryProtocol::append_uint32(out, value_list.size());
+            out += key_list;
+            out += value_list;
+            return out;
         }
-        return Request(); // UNKNOWN request
+        std::string out;
+        out.reserve(BinaryProtocol::REQUEST_HEADER_SIZE + key.size() + value.size());
+        out += static_cast<char>(type == RequestType::PUT ? BinaryProtocol::OP_PUT : BinaryProtocol::OP_GET);
+        BinaryProtocol::append_uint32(out, key.size());
+        BinaryProtocol::append_uint32(out, value.size());
+        out += key;
+        out += value;
+        return out;
+    }
+
+    // Deserialize request from string
+    static Request deserialize(const std::string &data)
+    {
+        return Request(RequestView::parse_text(data));
     }
 };
 
@@ -65,11 +323,13 @@ struct Response
     bool success;
     std::string message;
     std::string value;
+    std::vector<std::string> values; // One per key of an MGET ("VALUES"); empty if not found
 
     Response(bool s = false, const std::string &msg = "", const std::string &val = "")
         : success(s), message(msg), value(val) {}
 
-    // Serialize response to string (e.g., "OK", "VALUE value", "ERROR message")
+    // Serialize response to string (e.g., "OK", "VALUE value", "ERROR message").
+    // An MGET answer spans several lines: "VALUES <n>", then "VALUE value" or "NOT_FOUND" per key.
     std::string serialize() const
     {
         if (success)
@@ -78,6 +338,15 @@ struct Response
             {
                 return "VALUE " + value;
             }
+            else if (message == "VALUES")
+            {
+                std::string out = "VALUES " + std::to_string(values.size());
+                for (const std::string &v : values)
+                {
+                    out += v.empty() ? "\nNOT_FOUND" : "\nVALUE " + v;
+                }
+                return out;
+            }
             else
             {
                 return "OK";
@@ -92,6 +361,19 @@ struct Response
     // Deserialize response from string
     static Response deserialize(const std::string &data)
     {
+        if (data.rfind("VALUES ", 0) == 0)
+        {
+            Response out(true, "VALUES");
+            size_t line_start = data.find('\n');
+            while (line_start != std::string::npos)
+            {
+                size_t line_end = data.find('\n', line_start + 1);
+                std::string line = data.substr(line_start + 1, line_end == std::string::npos ? std::string::npos : line_end - line_start - 1);
+                out.values.push_back(line.rfind("VALUE ", 0) == 0 ? line.substr(6) : std::string());
+                line_start = line_end;
+            }
+            return out;
+        }
         if (data.rfind("OK", 0) == 0)
         {
             return Response(true, "OK");
@@ -106,6 +388,85 @@ struct Response
         }
         return Response(false, "UNKNOWN_RESPONSE");
     }
+
+    // Serialize response to a binary frame carrying the value (or the error message)
+    std::string serialize_binary() const
+    {
+        uint8_t status = BinaryProtocol::STATUS_ERROR;
+        const std::string *payload = &message;
+        std::string list;
+        if (success && message == "VALUES")
+        {
+            status = BinaryProtocol::STATUS_VALUES;
+            for (const std::string &v : values)
+            {
+                list += static_cast<char>(v.empty() ? 0 : 1);
+                BinaryProtocol::append_uint32(list, v.size());
+                list += v;
+            }
+            payload = &list;
+        }
+        else if (success && message == "VALUE")
+        {
+            status = BinaryProtocol::STATUS_VALUE;
+            payload = &value;
+        }
+        else if (success)
+        {
+            status = BinaryProtocol::STATUS_OK;
+            payload = &value;
+        }
+        std::string out;
+        out.reserve(BinaryProtocol::RESPONSE_HEADER_SIZE + payload->size());
+        out += static_cast<char>(status);
+        BinaryProtocol::append_uint32(out, payload->size());
+        out += *payload;
+        return out;
+    }
+
+    // Deserialize one binary response frame.
+    // Returns the frame length, or 0 if `length` bytes do not yet hold a whole frame.
+    static size_t deserialize_binary(const char *data, size_t length, Response &out)
+    {
+        if (length < BinaryProtocol::RESPONSE_HEADER_SIZE)
+        {
+            return 0;
+        }
+        uint32_t payload_length = BinaryProtocol::read_uint32(data + 1);
+        size_t frame_size = BinaryProtocol::RESPONSE_HEADER_SIZE + payload_length;
+        if (length < frame_size)
+        {
+            return 0;
+        }
+        std::string payload(data + BinaryProtocol::RESPONSE_HEADER_SIZE, payload_length);
+        switch (static_cast<uint8_t>(data[0]))
+        {
+        case BinaryProtocol::STATUS_VALUE:
+            out = Response(true, "VALUE", payload);
+            break;
+        case BinaryProtocol::STATUS_OK:
+            out = Response(true, "OK");
+            break;
+        case BinaryProtocol::STATUS_VALUES:
+        {
+            out = Response(true, "VALUES");
+            std::string_view rest(payload);
+            while (rest.size() >= 5)
+            {
+                uint32_t value_length = BinaryProtocol::read_uint32(rest.data() + 1);
+                rest.remove_prefix(5);
+                value_length = std::min<uint32_t>(value_length, rest.size());
+                out.values.emplace_back(rest.substr(0, value_length));
+                rest.remove_prefix(value_length);
+            }
+            break;
+        }
+        default:
+            out = Response(false, payload);
+            break;
+        }
+        return frame_size;
+    }
 };
 
 #endif // REQUEST_H
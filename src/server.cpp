@@ -4,8 +4,13 @@
 #include <iostream>  // For std::cerr and std::cout
 #include <algorithm> // For std::sort
 #include <cstring>   // For memset
+#include <tuple>     // For std::make_tuple
 #include <csignal>   // For signal handling
 #include <cerrno>    // For errno
+#include <fcntl.h>       // For fcntl
+#include <sys/epoll.h>   // For epoll_create1, epoll_ctl, epoll_wait
+#include <sys/eventfd.h> // For eventfd
+#include <poll.h>        // For POLLIN
 
 const std::string DATADIR = "data/"; // Define DATADIR for use in this file
 
@@ -16,22 +21,73 @@ namespace fs = std::filesystem; // For filesystem operations
 volatile sig_atomic_t Server::_running = 1;
 Server *Server::_instance = nullptr;
 
+// Size of the stack buffer used to drain a readable socket.
+const size_t READ_CHUNK_SIZE = 64 * 1024;
+// Maximum number of events fetched by a single epoll_wait call.
+const int MAX_EVENTS = 1024;
+
+static bool set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
 /**
  * @brief Constructs a new Server object with a specified address and port.
  * @param address The network address the server will listen on.
  * @param port The port number the server will listen on.
+ * @param shards The number of shard event loops; 0 means one per available core.
  */
-Server::Server(const string &address, int port) : _server_fd(-1),
-                                                  _new_socket(-1),
-                                                  _addrlen(sizeof(_address)),
-                                                  _server_address(address),
-                                                  _port(port),
-                                                  storage(nullptr)
+Server::Server(const string &address, int port, int shards) : _server_address(address),
+                                                              _addrlen(sizeof(_address)),
+                                                              _port(port),
+                                                              storage(nullptr)
 {
     memset(&_address, 0, _addrlen);
+    _address.sin_family = AF_INET;
+    _address.sin_addr.s_addr = inet_addr(address.c_str());
+    _address.sin_port = htons(port);
+
+    if (shards <= 0)
+    {
+        shards = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (int i = 0; i < shards; ++i)
+    {
+        auto shard = std::make_unique<Shard>();
+        shard->index = i;
+        shard->listen_fd = open_listen_socket();
+        shard->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (shard->epoll_fd < 0 || shard->wake_fd < 0)
+        {
+            perror("epoll/eventfd");
+            exit(EXIT_FAILURE);
+        }
+        // A single shard keeps the flat data/ layout; sharded servers give each shard its own directory
+        string shard_dir = shards == 1 ? DATADIR : DATADIR + "shard-" + to_string(i) + "/";
+        shard->storage = new Storage(this, shard_dir);
+        _shards.push_back(std::move(shard));
+    }
+    this->storage = _shards[0]->storage;
+    // RequestHandler is no longer used, removed initialization
 
+    _instance = this;                       // Set the static instance pointer
+    signal(SIGINT, Server::handle_signal);  // Register signal handler for Ctrl+C
+    signal(SIGTERM, Server::handle_signal); // Register signal handler for termination
+}
+
+/**
+ * @brief Creates a listening socket bound to the server address.
+ * SO_REUSEPORT lets every shard bind its own socket to the same port.
+ * @return The bound, non-blocking socket.
+ */
+int Server::open_listen_socket()
+{
+    int fd;
     // Create socket file descriptor
-    if ((_server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0)
+    if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
     {
         perror("socket failed");
         exit(EXIT_FAILURE);
@@ -39,28 +95,25 @@ Server::Server(const string &address, int port) : _server_fd(-1),
 
     // Set socket options to reuse address and port
     int opt = 1;
-    if (setsockopt(_server_fd, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)))
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) ||
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)))
     {
         perror("setsockopt");
         exit(EXIT_FAILURE);
     }
-    _address.sin_family = AF_INET;
-    _address.sin_addr.s_addr = inet_addr(address.c_str());
-    _address.sin_port = htons(port);
 
     // Bind the socket to the specified IP and port
-    if (::bind(_server_fd, (struct sockaddr *)&_address, _addrlen) < 0)
+    if (::bind(fd, (struct sockaddr *)&_address, _addrlen) < 0)
     {
         perror("bind failed");
         exit(EXIT_FAILURE);
     }
-
-    this->storage = new Storage(this); // Initialize Storage with a pointer to this Server instance
-    // RequestHandler is no longer used, removed initialization
-
-    _instance = this;                       // Set the static instance pointer
-    signal(SIGINT, Server::handle_signal);  // Register signal handler for Ctrl+C
-    signal(SIGTERM, Server::handle_signal); // Register signal handler for termination
+    if (!set_nonblocking(fd))
+    {
+        perror("fcntl");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
 }
 
 /**
@@ -68,424 +121,1863 @@ Server::Server(const string &address, int port) : _server_fd(-1),
  */
 Server::~Server()
 {
-    delete this->storage;
     // RequestHandler is no longer used, removed deletion
     std::cout << "Server destructor called, calling shutdown()..." << std::endl;
-    shutdown(); // Ensure socket is closed on destruction
+    shutdown(); // Flush memtables and close sockets while storage is still alive
+    for (auto &shard : _shards)
+    {
+        delete shard->storage;
+        shard->storage = nullptr;
+    }
+    this->storage = nullptr;
+    if (_instance == this)
+    {
+        _instance = nullptr;
+    }
 }
 
 /**
  * @brief Starts the server, making it ready to accept client connections.
+ * All sockets are non-blocking and registered edge-triggered, so every readiness
+ * notification is drained until the kernel reports EAGAIN.
  */
 void Server::start()
 {
     // Listen for incoming connections
-    if (listen(_server_fd, 3) < 0) // Max 3 pending connections
+    for (auto &shard : _shards)
     {
-        perror("listen");
-        exit(EXIT_FAILURE);
+        if (listen(shard->listen_fd, listen_backlog) < 0)
+        {
+            perror("listen");
+            exit(EXIT_FAILURE);
+        }
     }
-    cout << "Server listening on " << _server_address << ":" << _port << endl;
+    cout << "Server listening on " << _server_address << ":" << _port << " with " << _shards.size() << " shard(s)" << endl;
 
-    // Perform initial merge of existing SSTables if any
-    if (!storage->tables_to_merge.empty())
+    for (auto &shard : _shards)
     {
-        std::cout << "Triggering initial merge of existing SSTables..." << std::endl;
-        storage->merge();
-        // After merge, sst should be the new merged table, and tables_to_merge should be cleared then re-populated with the new merged sst name.
+        shard->storage->wal.set_sync(wal_sync, wal_sync_interval_ms);
+        shard->storage->set_memtable_budget(memtable_bytes);
+        shard->storage->table_cache.set_capacity(max_open_tables);
     }
+    SSTable::blockCache.set_capacity(block_cache_bytes);
 
-    while (_running)
+    if (worker_threads > 0)
+    {
+        _pool = std::make_unique<WorkerPool>(worker_threads);
+        cout << "Executing storage requests on " << _pool->size() << " worker thread(s)" << endl;
+    }
+
+    _running = 1;
+    for (size_t i = 1; i < _shards.size(); ++i)
+    {
+        Shard *shard = _shards[i].get();
+        shard->thread = std::thread([this, shard]()
+                                    { run_shard(*shard); });
+    }
+    run_shard(*_shards[0]);
+    for (size_t i = 1; i < _shards.size(); ++i)
+    {
+        _shards[i]->thread.join();
+    }
+    _pool.reset(); // Finishes the jobs still queued; their responses are no longer delivered
+    std::cout << "Server::start() loop finished." << std::endl;
+}
+
+// Submission queue size of each shard's io_uring.
+const unsigned URING_ENTRIES = 4096;
+// Size of each connection's receive buffer under io_uring (owned by the kernel while a recv is armed).
+const size_t URING_RECV_SIZE = 16 * 1024;
+
+// Low bits of io_uring user_data tell what a completion is for; connection pointers
+// are at least 8-byte aligned, so the remaining bits carry the Connection*.
+const uint64_t URING_TAG_MASK = 7;
+const uint64_t URING_TAG_ACCEPT = 1;
+const uint64_t URING_TAG_WAKE = 2;
+const uint64_t URING_TAG_RECV = 3;
+const uint64_t URING_TAG_SEND = 4;
+
+/**
+ * @brief Runs one shard's event loop on the current thread until the server stops.
+ */
+void Server::run_shard(Shard &shard)
+{
+    if (_shards.size() > 1 && pin_threads)
     {
-        cout << "\nWaiting for a connection..." << endl;
-        _new_socket = accept(_server_fd, (struct sockaddr *)&_address, (socklen_t *)&_addrlen);
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(shard.index % cores, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
 
-        if (_new_socket < 0)
+    if (use_io_uring)
+    {
+        auto ring = std::make_unique<IoRing>();
+        if (ring->init(URING_ENTRIES))
         {
-            if (errno == EINTR)
+            run_shard_uring(shard, *ring);
+            ring.reset(); // Tear down the ring first so the kernel stops using connection buffers
+            for (auto &entry : shard.connections)
             {
-                if (_running == 0)
-                {
-                    std::cout << "Server interrupted by signal (EINTR), shutting down gracefully." << std::endl;
-                    break; // Exit the loop gracefully
-                }
+                close(entry.first);
             }
-            else
+            shard.connections.clear();
+            return;
+        }
+        if (shard.index == 0)
+        {
+            std::cerr << "io_uring is not available, falling back to epoll" << std::endl;
+        }
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = shard.listen_fd;
+    epoll_ctl(shard.epoll_fd, EPOLL_CTL_ADD, shard.listen_fd, &ev);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = shard.wake_fd;
+    epoll_ctl(shard.epoll_fd, EPOLL_CTL_ADD, shard.wake_fd, &ev);
+
+    vector<struct epoll_event> events(MAX_EVENTS);
+    while (_running)
+    {
+        int n = epoll_wait(shard.epoll_fd, events.data(), MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
             {
-                perror("accept");
-                exit(EXIT_FAILURE);
+                continue; // _running is re-checked by the loop condition
             }
+            perror("epoll_wait");
+            break;
         }
-        else
+
+        for (int i = 0; i < n; ++i)
         {
-            // Original logic for handling successful accept and subsequent operations
-            char buffer[1024] = {0};
-            long valread = read(_new_socket, buffer, 1024);
-            if (valread < 0)
+            int fd = events[i].data.fd;
+            uint32_t flags = events[i].events;
+
+            if (fd == shard.listen_fd)
             {
-                perror("read");
-                close(_new_socket);
+                accept_connections(shard);
                 continue;
             }
-            string request_str(buffer, valread);
-            cout << "Received request: " << request_str << endl;
-
-            Request req = Request::deserialize(request_str);
-            Response res;
-
-            switch (req.type)
+            if (fd == shard.wake_fd)
             {
-            case RequestType::GET:
+                drain_inbox(shard);
+                continue;
+            }
+
+            auto it = shard.connections.find(fd);
+            if (it == shard.connections.end())
             {
-                string value = get(req.key);
-                if (!value.empty())
-                {
-                    res = Response(true, "VALUE", value);
-                }
-                else
-                {
-                    res = Response(false, "Key not found: " + req.key);
-                }
-                break;
+                continue;
             }
-            case RequestType::PUT:
+            Connection &conn = it->second;
+
+            if (flags & (EPOLLERR | EPOLLHUP))
             {
-                bool success = put(req.key, req.value);
-                if (success)
-                {
-                    res = Response(true, "OK");
-                }
-                else
-                {
-                    res = Response(false, "Failed to put key: " + req.key);
-                }
-                break;
+                close_connection(shard, fd);
+                continue;
             }
-            default:
-                res = Response(false, "Unknown request type");
-                break;
+            if (!service(shard, conn))
+            {
+                close_connection(shard, fd);
             }
-
-            string response_str = res.serialize();
-            send(_new_socket, response_str.c_str(), response_str.length(), 0);
-            cout << "Sent response: " << response_str << endl;
-            close(_new_socket);
         }
     }
-    std::cout << "Server::start() loop finished." << std::endl;
-}
-
-/**
- * @brief Shuts down the server, gracefully closing connections and releasing resources.
- */
-void Server::shutdown()
-{
-    cout << "Server shutting down..." << endl;
-    // Flush all in-memory data to disk before shutting down
-    if (storage)
-    {
-        storage->flush_all_memtables_to_disk();
-    }
 
-    if (_server_fd != -1)
+    for (auto &entry : shard.connections)
     {
-        close(_server_fd);
-        _server_fd = -1;
+        epoll_ctl(shard.epoll_fd, EPOLL_CTL_DEL, entry.first, nullptr);
+        close(entry.first);
     }
-    fflush(stdout);
-    fflush(stderr);
+    shard.connections.clear();
+    epoll_ctl(shard.epoll_fd, EPOLL_CTL_DEL, shard.listen_fd, nullptr);
+    epoll_ctl(shard.epoll_fd, EPOLL_CTL_DEL, shard.wake_fd, nullptr);
 }
 
 /**
- * @brief Stores a key-value pair in the database.
- * @param key The key to store.
- * @param payload The value associated with the key.
- * @return True if the put operation was successful.
+ * @brief Runs one shard's event loop on io_uring until the server stops.
+ * One accept stays armed on the listening socket and one poll on the wake eventfd.
+ * Each connection has at most one recv and one send in flight; every loop iteration
+ * submits everything queued and waits for completions with a single io_uring_enter.
  */
-bool Server::put(const string &key, const string &payload)
+void Server::run_shard_uring(Shard &shard, IoRing &ring)
 {
-    cout << "putting key " << key << " to database with payload " << payload << endl;
-    this->storage->main_mdb->put(key, payload);
-    this->storage->check_for_compaction(); // Trigger compaction check after each put
-    return true;
-}
+    // Readiness comes from the ring, and io_uring reports EAGAIN for non-blocking files instead of waiting
+    int flags = fcntl(shard.listen_fd, F_GETFL, 0);
+    fcntl(shard.listen_fd, F_SETFL, flags & ~O_NONBLOCK);
 
-/**
- * @brief Retrieves the value associated with a given key from the database.
- * @param key The key to retrieve.
- * @return The value associated with the key, or an empty string if the key is not found.
- */
-string Server::get(const string &key)
-{
-    cout << "getting key " << key << " from database" << endl;
-    // First, check main_mdb, then second_mdb, then SSTables on disk
-    string value = this->storage->main_mdb->get(key);
-    if (!value.empty())
-    {
-        return value;
-    }
-    value = this->storage->second_mdb->get(key);
-    if (!value.empty())
-    {
-        return value;
-    }
-    // If not found in MemTables, check the most recent SSTable (this->sst)
-    if (this->storage->sst)
+    shard.ring = &ring;
+    IoRing::set_current(&ring);
+    ring.prep_accept(shard.listen_fd, URING_TAG_ACCEPT);
+    ring.prep_poll(shard.wake_fd, POLLIN, URING_TAG_WAKE);
+
+    while (_running)
     {
-        auto result = this->storage->sst->find(key);
-        if (result.has_value())
+        int ret = ring.submit(1);
+        if (ret < 0 && ret != -EINTR && ret != -EBUSY)
         {
-            return result.value();
+            errno = -ret;
+            perror("io_uring_enter");
+            break;
         }
-    }
-    // Iterate through tables_to_merge (older SSTables) if not found in current sst
-    for (const string &filename : this->storage->tables_to_merge)
-    {
-        SSTable temp_sst(DATADIR + filename, true);
-        auto result = temp_sst.find(key);
-        if (result.has_value())
+        IoCompletion completion;
+        while (_running && ring.pop(completion))
         {
-            return result.value();
+            handle_completion(shard, completion);
         }
     }
-    return ""; // Key not found
-}
 
-/**
- * @brief Generates a unique Unix timestamp string.
- * @return A string representation of the current Unix timestamp.
- */
-string getCurrentUnixTimeString()
-{
-    auto now = chrono::system_clock::now();
-    auto time_since_epoch = now.time_since_epoch();
-    auto seconds = chrono::duration_cast<std::chrono::seconds>(time_since_epoch).count();
-    return to_string(seconds);
+    IoRing::set_current(nullptr);
+    shard.ring = nullptr;
+    fcntl(shard.listen_fd, F_SETFL, flags);
 }
 
 /**
- * @brief Constructs a new Storage object.
- * @param server A pointer to the Server instance associated with this storage.
+ * @brief Handles one io_uring completion on the shard's thread.
  */
-Storage::Storage(Server *server) : main_mdb(new MemTable()), second_mdb(new MemTable()), sst(nullptr), merging(false)
+void Server::handle_completion(Shard &shard, const IoCompletion &completion)
 {
-    // Load existing SSTables from the data directory
-    if (fs::exists(DATADIR) && fs::is_directory(DATADIR))
+    IoRing &ring = *shard.ring;
+    uint64_t tag = completion.user_data & URING_TAG_MASK;
+    Connection *conn = reinterpret_cast<Connection *>(completion.user_data & ~URING_TAG_MASK);
+
+    switch (tag)
     {
-        for (const auto &entry : fs::directory_iterator(DATADIR))
+    case URING_TAG_ACCEPT:
+    {
+        if (completion.res >= 0)
         {
-            if (entry.is_regular_file() && entry.path().extension() == ".sst")
-            {
-                tables_to_merge.push_back(entry.path().filename().string());
-                std::cout << "Loaded existing SSTable: " << entry.path().filename().string() << std::endl;
-            }
+            Connection &accepted = shard.connections[completion.res];
+            accepted.fd = completion.res;
+            accepted.id = shard.next_connection_id++;
+            accepted.recv_buf.resize(URING_RECV_SIZE);
+            uring_service(shard, accepted);
+        }
+        else if (completion.res != -EINTR && completion.res != -ECONNABORTED && completion.res != -EAGAIN)
+        {
+            errno = -completion.res;
+            perror("accept");
         }
+        ring.prep_accept(shard.listen_fd, URING_TAG_ACCEPT);
+        break;
     }
-}
-
-/**
- * @brief Checks if compaction (flushing MemTable to SSTable or merging SSTables) is needed.
- * If the main MemTable is oversized and no merge is in progress, it triggers a flush.
- * @return True if a compaction was initiated, false otherwise.
- */
-bool Storage::check_for_compaction()
-{
-    if (this->main_mdb->oversize() && !this->merging)
-    {
-        auto start_time = chrono::high_resolution_clock::now();
-        long long bytes_flushed = this->main_mdb->get_size_bytes();
-
-        // swap the two in memory tables
-        this->main_mdb->readonly = true;
-        this->second_mdb->readonly = false;
-        this->second_mdb->clear();
-        auto tmp = this->main_mdb;
-        this->main_mdb = this->second_mdb;
-        this->second_mdb = tmp;
-        // persist the main table to disk
-        string flushed_filename = getCurrentUnixTimeString() + ".sst";
-        SSTable *flushed_sst = this->second_mdb->flush(flushed_filename);
-        if (flushed_sst)
+    case URING_TAG_WAKE:
+        drain_inbox(shard);
+        ring.prep_poll(shard.wake_fd, POLLIN, URING_TAG_WAKE);
+        break;
+    case URING_TAG_RECV:
+        conn->inflight--;
+        conn->receiving = false;
+        if (completion.res > 0)
         {
-            this->tables_to_merge.push_back(flushed_filename);
-            delete flushed_sst; // Flush returns a new SSTable, which is not owned by Storage
+            conn->in_buf.append(conn->recv_buf.data(), completion.res);
         }
-        else
+        else if (completion.res != -EINTR && completion.res != -EAGAIN)
         {
-            std::cerr << "Error: Failed to flush MemTable to disk." << std::endl;
-            // Consider reverting swap or other error handling
+            conn->closing = true; // Orderly shutdown (0) or a receive error
         }
-
-        auto end_time = chrono::high_resolution_clock::now();
-        this->flush_time_ns += chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
-        this->flush_bytes_operated += bytes_flushed;
-
-        return true;
+        uring_service(shard, *conn);
+        break;
+    case URING_TAG_SEND:
+        conn->inflight--;
+        conn->sending = false;
+        if (completion.res > 0)
+        {
+            conn->send_pos += completion.res;
+        }
+        else if (completion.res != -EINTR && completion.res != -EAGAIN)
+        {
+            conn->failed = true;
+        }
+        uring_service(shard, *conn);
+        break;
+    default:
+        break;
     }
-    return false;
 }
 
 /**
- * @brief Merges the SSTables listed in tables_to_merge into a new, consolidated SSTable.
- * This process reads data from multiple SSTables, merges them, and writes to a new file.
- * Old SSTables are then deleted, and the new merged SSTable is added to the merge list for future consideration.
+ * @brief The io_uring counterpart of service(): executes buffered requests, keeps one send
+ * and one recv armed, and closes the connection once nothing references it any more.
  */
-void Storage::merge()
+void Server::uring_service(Shard &shard, Connection &conn)
 {
-    if (this->tables_to_merge.empty())
+    IoRing &ring = *shard.ring;
+    if (!conn.failed)
     {
-        return;
+        process_input(shard, conn);
     }
-    this->merging = true;
-
-    auto start_time = chrono::high_resolution_clock::now();
-    long long bytes_merged = 0;
-
-    vector<SSTable *> to_merge;
-    vector<string> to_merge_names;
 
-    for (const string &filename : this->tables_to_merge)
+    if (!conn.sending && !conn.failed)
     {
-        // Load SSTable data into memory for merging
-        SSTable *sst_to_load = new SSTable(DATADIR + filename, true); // Use DATADIR
-        to_merge.push_back(sst_to_load);
-        to_merge_names.push_back(DATADIR + filename);
-
-        // Calculate bytes operated from input SSTables
-        for (const auto &pair : sst_to_load->getAllKeyValues())
+        if (conn.send_pos >= conn.send_buf.size())
+        {
+            conn.send_buf.clear();
+            conn.send_pos = 0;
+            conn.send_buf.swap(conn.out_buf);
+        }
+        if (conn.send_pos < conn.send_buf.size())
         {
-            bytes_merged += pair.key.length();
-            bytes_merged += pair.value.length();
+            ring.prep_send(conn.fd, conn.send_buf.data() + conn.send_pos, conn.send_buf.size() - conn.send_pos,
+                           reinterpret_cast<uint64_t>(&conn) | URING_TAG_SEND);
+            conn.sending = true;
+            conn.inflight++;
         }
     }
-    this->tables_to_merge.clear();
-
-    // The new_main_sst_name will be the name of the new SSTable after merging and renaming
-    string new_main_sst_name = getCurrentUnixTimeString() + ".sst";
-    auto target_table = new SSTable(DATADIR + new_main_sst_name, false); // Use DATADIR
-
-    // merge the files into a new sst file
-    SSTable *candidate;
-    string min_key;
-
-    std::vector<KeyValuePair> merged_data;
 
-    while (true)
+    bool output_backlog = conn.out_buf.size() >= max_pending_output;
+    if (!conn.receiving && !conn.closing && !conn.failed && !output_backlog && conn.in_buf.size() < max_request_size)
     {
-        candidate = nullptr;
-        min_key = ""; // Reset min_key for each iteration
+        ring.prep_recv(conn.fd, conn.recv_buf.data(), conn.recv_buf.size(), reinterpret_cast<uint64_t>(&conn) | URING_TAG_RECV);
+        conn.receiving = true;
+        conn.inflight++;
+    }
 
-        for (SSTable *sst_ptr : to_merge)
+    bool drained = !conn.sending && conn.out_buf.empty() && conn.send_pos >= conn.send_buf.size();
+    if (conn.failed || (conn.closing && conn.pending.empty() && drained))
+    {
+        if (conn.inflight == 0)
         {
-            // Only consider SSTables that still have data
-            if (!sst_ptr->get_first_key().empty())
-            {
-                if (candidate == nullptr || sst_ptr->get_first_key() < min_key)
-                {
-                    candidate = sst_ptr;
-                    min_key = sst_ptr->get_first_key();
-                }
-            }
+            int fd = conn.fd;
+            close(fd);
+            shard.connections.erase(fd);
         }
-        if (candidate == nullptr || min_key.empty())
+        else
         {
-            break; // All SSTables are empty
+            // Completes the armed recv, whose completion then finishes the close
+            ::shutdown(conn.fd, SHUT_RDWR);
+            conn.closing = true;
         }
-        auto record = candidate->pop_first_item();
-        merged_data.push_back({record.first, record.second});
     }
+}
 
-    // Calculate bytes operated for output SSTable
-    for (const auto &pair : merged_data)
+/**
+ * @brief Asks a running start() loop to return.
+ * Only touches a flag and eventfds, both of which are async-signal-safe.
+ */
+void Server::stop()
+{
+    _running = 0;
+    for (auto &shard : _shards)
     {
-        bytes_merged += pair.key.length();
-        bytes_merged += pair.value.length();
+        if (shard->wake_fd != -1)
+        {
+            uint64_t one = 1;
+            ssize_t ignored = write(shard->wake_fd, &one, sizeof(one));
+            (void)ignored;
+        }
     }
+}
 
-    // Write the merged data to the target SSTable
-    std::sort(merged_data.begin(), merged_data.end()); // Ensure data is sorted before writing
-    if (!target_table->writeFromMemory(merged_data))
+/**
+ * @brief Queues a task to run on another shard's thread and wakes that shard.
+ */
+void Server::post(Shard &shard, function<void()> task)
+{
     {
-        std::cerr << "Error: Failed to write merged SSTable to disk." << std::endl;
+        std::lock_guard<std::mutex> lock(shard.inbox_mutex);
+        shard.inbox.push_back(std::move(task));
     }
+    uint64_t one = 1;
+    ssize_t ignored = write(shard.wake_fd, &one, sizeof(one));
+    (void)ignored;
+}
 
-    this->merging = false;
-
-    // Delete all to_merge files and SSTable objects
-    for (string filename : to_merge_names)
+/**
+ * @brief Runs every task other shards have posted to this shard.
+ */
+void Server::drain_inbox(Shard &shard)
+{
+    uint64_t counter;
+    while (read(shard.wake_fd, &counter, sizeof(counter)) > 0)
     {
-        fs::remove(filename);
     }
-    for (SSTable *sst_ptr : to_merge)
+    vector<function<void()>> tasks;
     {
-        delete sst_ptr;
+        std::lock_guard<std::mutex> lock(shard.inbox_mutex);
+        tasks.swap(shard.inbox);
     }
-
-    // Assign the new merged SSTable to the 'sst' member of Storage
-    if (this->sst)
+    for (auto &task : tasks)
     {
-        delete this->sst;
+        task();
     }
-    this->sst = target_table; // Storage now owns this SSTable
-
-    // Add the newly created main.sst to the next merge list
-    this->tables_to_merge.push_back(new_main_sst_name);
-
-    auto end_time = chrono::high_resolution_clock::now();
-    this->merge_time_ns += chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
-    this->merge_bytes_operated += bytes_merged;
 }
 
 /**
- * @brief Flushes all in-memory MemTables (main and second) to disk as SSTables.
- * This method is typically called during server shutdown to ensure data persistence.
+ * @brief Accepts every pending connection on the shard's listening socket.
  */
-void Storage::flush_all_memtables_to_disk()
+void Server::accept_connections(Shard &shard)
 {
-    std::cout << "Storage::flush_all_memtables_to_disk called." << std::endl;
-
-    // Flush main_mdb if not empty
-    if (!main_mdb->is_empty())
+    while (true)
     {
-        std::cout << "Flushing main_mdb to disk during shutdown..." << std::endl;
-        string flushed_filename = getCurrentUnixTimeString() + ".sst";
-        SSTable *flushed_sst = main_mdb->flush(flushed_filename);
-        if (flushed_sst)
+        int fd = accept4(shard.listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
         {
-            this->tables_to_merge.push_back(flushed_filename);
-            delete flushed_sst;
-            std::cout << "Successfully flushed main_mdb to " << flushed_filename << std::endl;
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                perror("accept");
+            }
+            return;
         }
-        else
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(shard.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
         {
-            std::cerr << "Error: Failed to flush main_mdb to disk during shutdown." << std::endl;
+            perror("epoll_ctl");
+            close(fd);
+            continue;
         }
+        Connection &conn = shard.connections[fd];
+        conn.fd = fd;
+        conn.id = shard.next_connection_id++;
     }
+}
 
-    // Flush second_mdb if not empty and not read-only
-    // (second_mdb might be the main_mdb just before a swap/flush)
-    if (!second_mdb->is_empty() && !second_mdb->readonly)
+/**
+ * @brief Reads, executes and answers everything currently possible on a connection.
+ * Pipelined requests from one read are executed back to back and their responses
+ * leave in a single write. Stops early when the client is not reading its responses.
+ * @return False if the connection should be closed.
+ */
+bool Server::service(Shard &shard, Connection &conn)
+{
+    while (true)
     {
-        std::cout << "Flushing second_mdb to disk during shutdown..." << std::endl;
-        string flushed_filename = getCurrentUnixTimeString() + ".sst";
-        SSTable *flushed_sst = second_mdb->flush(flushed_filename);
-        if (flushed_sst)
+        bool more_to_read = read_from(conn);
+        size_t buffered = conn.in_buf.size();
+        bool held_back = process_input(shard, conn);
+        if (!write_to(conn))
         {
-            this->tables_to_merge.push_back(flushed_filename);
-            delete flushed_sst;
-            std::cout << "Successfully flushed second_mdb to " << flushed_filename << std::endl;
+            return false;
         }
-        else
+        bool output_blocked = conn.out_pos < conn.out_buf.size();
+        bool made_progress = conn.in_buf.size() < buffered;
+        // Go around again only while the socket takes more output and input was either held
+        // back for backpressure or left in the socket; otherwise the next epoll edge brings us back.
+        if (output_blocked || !(held_back || (more_to_read && made_progress)))
         {
-            std::cerr << "Error: Failed to flush second_mdb to disk during shutdown." << std::endl;
+            break;
         }
     }
-    // Ensure that any existing sst is also moved to tables_to_merge if not already there
-    // This ensures consistency for the next startup and potential merging
-    if (this->sst && std::find(this->tables_to_merge.begin(), this->tables_to_merge.end(), this->sst->get_filename()) == this->tables_to_merge.end())
+    return !(conn.closing && conn.pending.empty() && conn.out_pos == conn.out_buf.size());
+}
+
+/**
+ * @brief Drains the socket into the connection's input buffer.
+ * Marks the connection as closing when the peer has shut down its side.
+ * @return True if reading stopped because the buffer is full, so more data may be waiting.
+ */
+bool Server::read_from(Connection &conn)
+{
+    char buffer[READ_CHUNK_SIZE];
+    while (conn.in_buf.size() < max_request_size)
     {
-        this->tables_to_merge.push_back(this->sst->get_filename());
+        ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+        if (n > 0)
+        {
+            conn.in_buf.append(buffer, n);
+            continue;
+        }
+        if (n == 0)
+        {
+            conn.closing = true;
+            return false;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            conn.closing = true;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Serializes a response in the same format as the request it answers.
+static string encode_response(const Response &res, bool binary)
+{
+    return binary ? res.serialize_binary() : res.serialize() + "\n";
+}
+
+/**
+ * @brief Parses and executes every complete request in the connection's input buffer.
+ * Text requests are terminated by a newline. Binary frames are parsed in place, so keys
+ * and values are handed to the storage as views into the receive buffer. Requests owned
+ * by other shards are collected and forwarded as one batch per owner.
+ * @return True if parsing stopped early because too much output is waiting to be sent.
+ */
+bool Server::process_input(Shard &shard, Connection &conn)
+{
+    if (conn.executing)
+    {
+        return false; // Parsing resumes when the connection's job comes back from the pool
+    }
+    ForwardBatches batches(_shards.size());
+    bool held_back = false;
+    size_t consumed = 0;
+    while (consumed < conn.in_buf.size())
+    {
+        if (conn.out_buf.size() - conn.out_pos >= max_pending_output)
+        {
+            held_back = true;
+            break;
+        }
+        const char *data = conn.in_buf.data() + consumed;
+        size_t available = conn.in_buf.size() - consumed;
+
+        if (BinaryProtocol::is_binary(data[0]))
+        {
+            RequestView req;
+            uint64_t frame_size = 0;
+            size_t used = RequestView::parse_binary(data, available, req, frame_size);
+            if (frame_size > max_request_size)
+            {
+                std::cerr << "Dropping connection " << conn.fd << ": frame of " << frame_size << " bytes exceeds " << max_request_size << std::endl;
+                consumed = conn.in_buf.size();
+                conn.closing = true;
+                break;
+            }
+            if (used == 0)
+            {
+                break; // Wait for the rest of the frame
+            }
+            dispatch(shard, conn, req, true, batches);
+            consumed += used;
+            continue;
+        }
+
+        const char *newline = static_cast<const char *>(memchr(data, '\n', available));
+        if (newline == nullptr)
+        {
+            break;
+        }
+        size_t line_length = newline - data;
+        string_view line(data, line_length);
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.remove_suffix(1);
+        }
+        dispatch(shard, conn, RequestView::parse_text(line), false, batches);
+        consumed += line_length + 1;
+    }
+    conn.in_buf.erase(0, consumed);
+
+    if (_pool && !batches[shard.index].empty())
+    {
+        execute_on_pool(shard, conn, std::move(batches[shard.index]));
+    }
+    for (size_t owner = 0; !_pool && owner < batches.size(); ++owner)
+    {
+        if (!batches[owner].empty())
+        {
+            forward(shard, conn, owner, std::move(batches[owner]));
+        }
+    }
+
+    if (consumed == 0 && !held_back && conn.in_buf.size() >= max_request_size)
+    {
+        std::cerr << "Dropping connection " << conn.fd << ": request exceeds " << max_request_size << " bytes" << std::endl;
+        conn.in_buf.clear();
+        conn.closing = true;
+    }
+    return held_back;
+}
+
+/**
+ * @brief Runs a request on the shard that owns its key and reserves its response slot.
+ * Requests owned by this shard run inline; the others are copied into the owner's batch.
+ * While no earlier response is outstanding, inline responses go straight to the output buffer.
+ * With a worker pool, every request is copied into this shard's batch for the pool instead.
+ */
+void Server::dispatch(Shard &shard, Connection &conn, const RequestView &req, bool binary, ForwardBatches &batches)
+{
+    if (_pool)
+    {
+        uint64_t seq = conn.first_pending_seq + conn.pending.size();
+        conn.pending.emplace_back(false, string());
+        batches[shard.index].push_back({seq, Request(req), binary});
+        return;
+    }
+    if (req.is_batch())
+    {
+        dispatch_batch(shard, conn, req, binary, batches);
+        return;
+    }
+    size_t owner = req.type == RequestType::UNKNOWN ? shard.index : shard_for(req.key);
+    if (owner == static_cast<size_t>(shard.index))
+    {
+        string response = encode_response(handle_request(req), binary);
+        if (conn.pending.empty())
+        {
+            conn.out_buf += response;
+        }
+        else
+        {
+            conn.pending.emplace_back(true, std::move(response));
+        }
+        return;
+    }
+    uint64_t seq = conn.first_pending_seq + conn.pending.size();
+    conn.pending.emplace_back(false, string());
+    batches[owner].push_back({seq, Request(req), binary});
+}
+
+// Copies one shard's part of a batch command's answer into the merged response.
+// The first failing part decides the response.
+static void merge_part(Response &merged, const vector<size_t> &positions, const Response &part)
+{
+    if (!merged.success)
+    {
+        return;
+    }
+    if (!part.success)
+    {
+        merged = part;
+        return;
+    }
+    for (size_t i = 0; i < positions.size() && i < part.values.size(); ++i)
+    {
+        merged.values[positions[i]] = part.values[i];
+    }
+}
+
+/**
+ * @brief Splits an MGET or MPUT by owning shard. The part owned by this shard runs inline;
+ * the other parts join the owners' batches, so they stay ordered with the other pipelined
+ * requests of the connection, and their answers are merged when they come back.
+ */
+void Server::dispatch_batch(Shard &shard, Connection &conn, const RequestView &req, bool binary, ForwardBatches &batches)
+{
+    vector<vector<size_t>> positions(_shards.size());
+    for (size_t i = 0; i < req.keys.size(); ++i)
+    {
+        positions[shard_for(req.keys[i])].push_back(i);
+    }
+    size_t parts = 0;
+    for (size_t owner = 0; owner < positions.size(); ++owner)
+    {
+        parts += !positions[owner].empty();
+    }
+    if (parts <= 1 && (parts == 0 || !positions[shard.index].empty()))
+    {
+        // Entirely local: run it like any single-key request
+        string response = encode_response(handle_request(req), binary);
+        if (conn.pending.empty())
+        {
+            conn.out_buf += response;
+        }
+        else
+        {
+            conn.pending.emplace_back(true, std::move(response));
+        }
+        return;
+    }
+
+    uint64_t seq = conn.first_pending_seq + conn.pending.size();
+    conn.pending.emplace_back(false, string());
+    auto gather = std::make_shared<MultiGather>();
+    gather->seq = seq;
+    gather->binary = binary;
+    gather->response = Response(true, req.type == RequestType::MGET ? "VALUES" : "OK");
+    gather->response.values.resize(req.type == RequestType::MGET ? req.keys.size() : 0);
+    gather->remaining = parts;
+
+    for (size_t owner = 0; owner < positions.size(); ++owner)
+    {
+        if (positions[owner].empty())
+        {
+            continue;
+        }
+        Request part(req.type, vector<string>());
+        for (size_t position : positions[owner])
+        {
+            part.keys.emplace_back(req.keys[position]);
+            if (req.type == RequestType::MPUT)
+            {
+                part.values.emplace_back(req.values[position]);
+            }
+        }
+        if (owner == static_cast<size_t>(shard.index))
+        {
+            // Other parts are still outstanding, so this never completes the response
+            merge_part(gather->response, positions[owner], handle_request(part));
+            --gather->remaining;
+            continue;
+        }
+        batches[owner].push_back({seq, std::move(part), binary, gather, std::move(positions[owner])});
+    }
+}
+
+/**
+ * @brief Posts a batch of pipelined requests to the shard that owns their keys.
+ * The owner executes them in order and posts all responses back in one task.
+ */
+void Server::forward(Shard &shard, Connection &conn, size_t owner, vector<ForwardedRequest> batch)
+{
+    Shard *origin = &shard;
+    int fd = conn.fd;
+    uint64_t conn_id = conn.id;
+    auto requests = std::make_shared<vector<ForwardedRequest>>(std::move(batch));
+    post(*_shards[owner], [this, origin, fd, conn_id, requests]()
+         {
+             auto responses = std::make_shared<vector<pair<uint64_t, string>>>();
+             auto parts = std::make_shared<vector<pair<size_t, Response>>>(); // Parts of split batch commands
+             responses->reserve(requests->size());
+             for (size_t i = 0; i < requests->size(); ++i)
+             {
+                 const ForwardedRequest &fwd = (*requests)[i];
+                 if (fwd.gather)
+                 {
+                     parts->emplace_back(i, handle_request(fwd.request));
+                     continue;
+                 }
+                 responses->emplace_back(fwd.seq, encode_response(handle_request(fwd.request), fwd.binary));
+             }
+             post(*origin, [this, origin, fd, conn_id, requests, responses, parts]()
+                  {
+                      // Merging happens here, on the shard that owns the gather state
+                      for (const auto &part : *parts)
+                      {
+                          const ForwardedRequest &fwd = (*requests)[part.first];
+                          merge_part(fwd.gather->response, fwd.positions, part.second);
+                          if (--fwd.gather->remaining == 0)
+                          {
+                              responses->emplace_back(fwd.gather->seq, encode_response(fwd.gather->response, fwd.gather->binary));
+                          }
+                      }
+                      complete(*origin, fd, conn_id, std::move(*responses)); }); });
+}
+
+/**
+ * @brief Hands a connection's parsed requests to the worker pool as one job.
+ * The job runs them in order and posts the responses back to this shard. Until then the
+ * connection parses nothing further, so its requests never overtake one another.
+ */
+void Server::execute_on_pool(Shard &shard, Connection &conn, vector<ForwardedRequest> batch)
+{
+    Shard *origin = &shard;
+    int fd = conn.fd;
+    uint64_t conn_id = conn.id;
+    conn.executing = true;
+    auto requests = std::make_shared<vector<ForwardedRequest>>(std::move(batch));
+    _pool->submit([this, origin, fd, conn_id, requests]()
+                  {
+                      auto responses = std::make_shared<vector<pair<uint64_t, string>>>();
+                      responses->reserve(requests->size());
+                      for (const ForwardedRequest &fwd : *requests)
+                      {
+                          responses->emplace_back(fwd.seq, encode_response(handle_request(fwd.request), fwd.binary));
+                      }
+                      post(*origin, [this, origin, fd, conn_id, responses]()
+                           {
+                               auto it = origin->connections.find(fd);
+                               if (it != origin->connections.end() && it->second.id == conn_id)
+                               {
+                                   it->second.executing = false;
+                               }
+                               complete(*origin, fd, conn_id, std::move(*responses)); }); });
+}
+
+/**
+ * @brief Moves the ready prefix of the pending responses into the output buffer,
+ * so responses always leave in request order.
+ */
+void Server::flush_ready(Connection &conn)
+{
+    while (!conn.pending.empty() && conn.pending.front().first)
+    {
+        conn.out_buf += conn.pending.front().second;
+        conn.pending.pop_front();
+        ++conn.first_pending_seq;
+    }
+}
+
+/**
+ * @brief Delivers responses computed on another shard to their connection.
+ * Dropped if the connection has closed in the meantime.
+ */
+void Server::complete(Shard &shard, int fd, uint64_t conn_id, vector<pair<uint64_t, string>> responses)
+{
+    auto it = shard.connections.find(fd);
+    if (it == shard.connections.end() || it->second.id != conn_id)
+    {
+        return;
+    }
+    Connection &conn = it->second;
+    for (auto &response : responses)
+    {
+        auto &slot = conn.pending[response.first - conn.first_pending_seq];
+        slot.first = true;
+        slot.second = std::move(response.second);
+    }
+    flush_ready(conn);
+    // Requests held back for backpressure may be runnable again now
+    if (shard.ring)
+    {
+        uring_service(shard, conn);
+    }
+    else if (!service(shard, conn))
+    {
+        close_connection(shard, fd);
+    }
+}
+
+/**
+ * @brief Writes as much of the pending output as the socket accepts.
+ * @return False if the connection failed and must be closed.
+ */
+bool Server::write_to(Connection &conn)
+{
+    while (conn.out_pos < conn.out_buf.size())
+    {
+        ssize_t n = send(conn.fd, conn.out_buf.data() + conn.out_pos, conn.out_buf.size() - conn.out_pos, MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            conn.out_pos += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return true; // EPOLLOUT fires once the socket drains
+        }
+        return false;
+    }
+    conn.out_buf.clear();
+    conn.out_pos = 0;
+    return true;
+}
+
+/**
+ * @brief Deregisters and closes a client connection.
+ */
+void Server::close_connection(Shard &shard, int fd)
+{
+    epoll_ctl(shard.epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    shard.connections.erase(fd);
+}
+
+/**
+ * @brief Executes a single parsed request against the storage and builds its response.
+ */
+Response Server::handle_request(const RequestView &req)
+{
+    // Keys and values stay views into the connection buffer all the way into the storage
+    switch (req.type)
+    {
+    case RequestType::GET:
+    {
+        Response res(true, "VALUE");
+        res.value = get(req.key);
+        if (!res.value.empty())
+        {
+            return res;
+        }
+        return Response(false, "Key not found: " + string(req.key));
+    }
+    case RequestType::PUT:
+    {
+        if (put(req.key, req.value))
+        {
+            return Response(true, "OK");
+        }
+        return Response(false, "Failed to put key: " + string(req.key));
+    }
+    case RequestType::MGET:
+    {
+        Response res(true, "VALUES");
+        res.values = multi_get(req.keys);
+        return res;
+    }
+    case RequestType::MPUT:
+    {
+        if (multi_put(req.keys, req.values))
+        {
+            return Response(true, "OK");
+        }
+        return Response(false, "Failed to put " + to_string(req.keys.size()) + " keys");
+    }
+    default:
+        return Response(false, "Unknown request type");
+    }
+}
+
+/**
+ * @brief Shuts down the server, gracefully closing connections and releasing resources.
+ */
+void Server::shutdown()
+{
+    cout << "Server shutting down..." << endl;
+    for (auto &shard : _shards)
+    {
+        // Flush all in-memory data to disk before shutting down
+        if (shard->storage)
+        {
+            shard->storage->flush_all_memtables_to_disk();
+        }
+        for (int *fd : {&shard->listen_fd, &shard->epoll_fd, &shard->wake_fd})
+        {
+            if (*fd != -1)
+            {
+                close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+    fflush(stdout);
+    fflush(stderr);
+}
+
+/**
+ * @brief Returns the index of the shard that owns a key.
+ * Uses 64-bit FNV-1a so routing stays stable across builds and restarts.
+ */
+size_t Server::shard_for(string_view key) const
+{
+    if (_shards.size() <= 1)
+    {
+        return 0;
+    }
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : key)
+    {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash % _shards.size();
+}
+
+/**
+ * @brief Returns the storage of the shard that owns a key.
+ */
+Storage *Server::storage_for(string_view key) const
+{
+    return _shards.empty() ? this->storage : _shards[shard_for(key)]->storage;
+}
+
+/**
+ * @brief Stores a key-value pair in the database.
+ * @param key The key to store.
+ * @param payload The value associated with the key.
+ * @return True if the put operation was successful.
+ */
+bool Server::put(string_view key, string_view payload)
+{
+    cout << "putting key " << key << " to database with payload " << payload << endl;
+    return storage_for(key)->put(key, payload);
+}
+
+/**
+ * @brief Retrieves the value associated with a given key from the database.
+ * @param key The key to retrieve.
+ * @return The value associated with the key, or an empty string if the key is not found.
+ */
+string Server::get(string_view key)
+{
+    cout << "getting key " << key << " from database" << endl;
+    return storage_for(key)->get(key);
+}
+
+/**
+ * @brief Stores a batch of key-value pairs, checking for compaction once per storage.
+ * @param keys The keys to store.
+ * @param values The values, one per key.
+ * @return True if every put succeeded.
+ */
+bool Server::multi_put(const vector<string_view> &keys, const vector<string_view> &values)
+{
+    if (keys.size() != values.size())
+    {
+        return false;
+    }
+    if (_shards.size() <= 1)
+    {
+        return storage_for(string_view())->put_many(keys, values);
+    }
+    vector<vector<string_view>> shard_keys(_shards.size());
+    vector<vector<string_view>> shard_values(_shards.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        size_t owner = shard_for(keys[i]);
+        shard_keys[owner].push_back(keys[i]);
+        shard_values[owner].push_back(values[i]);
+    }
+    bool ok = true;
+    for (size_t owner = 0; owner < _shards.size(); ++owner)
+    {
+        if (!shard_keys[owner].empty())
+        {
+            ok = _shards[owner]->storage->put_many(shard_keys[owner], shard_values[owner]) && ok;
+        }
+    }
+    return ok;
+}
+
+/**
+ * @brief Retrieves a batch of keys, one sorted pass per owning storage.
+ * @param keys The keys to retrieve.
+ * @return The values in the order of keys; an empty string marks a key that was not found.
+ */
+vector<string> Server::multi_get(const vector<string_view> &keys)
+{
+    if (_shards.size() <= 1)
+    {
+        return storage_for(string_view())->get_many(keys);
+    }
+    vector<vector<size_t>> positions(_shards.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        positions[shard_for(keys[i])].push_back(i);
+    }
+    vector<string> values(keys.size());
+    for (size_t owner = 0; owner < positions.size(); ++owner)
+    {
+        if (positions[owner].empty())
+        {
+            continue;
+        }
+        vector<string_view> part;
+        part.reserve(positions[owner].size());
+        for (size_t position : positions[owner])
+        {
+            part.push_back(keys[position]);
+        }
+        vector<string> found = _shards[owner]->storage->get_many(part);
+        for (size_t i = 0; i < found.size(); ++i)
+        {
+            values[positions[owner][i]] = std::move(found[i]);
+        }
+    }
+    return values;
+}
+
+/**
+ * @brief Generates a unique Unix timestamp string.
+ * @return A string representation of the current Unix timestamp.
+ */
+string getCurrentUnixTimeString()
+{
+    auto now = chrono::system_clock::now();
+    auto time_since_epoch = now.time_since_epoch();
+    auto seconds = chrono::duration_cast<std::chrono::seconds>(time_since_epoch).count();
+    return to_string(seconds);
+}
+
+/**
+ * @brief Orders SSTable file names by age. Names are "<unix seconds>_<sequence>.sst";
+ * names of any other form sort first, as the oldest.
+ */
+static std::tuple<bool, unsigned long long, unsigned long long> table_age(const string &name)
+{
+    unsigned long long seconds = 0;
+    unsigned long long seq = 0;
+    if (sscanf(name.c_str(), "%llu_%llu.sst", &seconds, &seq) != 2)
+    {
+        return std::make_tuple(false, 0ULL, 0ULL);
+    }
+    return std::make_tuple(true, seconds, seq);
+}
+
+static bool older_table_name(const string &a, const string &b)
+{
+    auto age_a = table_age(a);
+    auto age_b = table_age(b);
+    return age_a != age_b ? age_a < age_b : a < b;
+}
+
+/**
+ * @brief Constructs a new Storage object.
+ * @param server A pointer to the Server instance associated with this storage.
+ */
+Storage::Storage(Server *server, const string &data_dir) : data_dir(data_dir), wal(data_dir), main_mdb(new MemTable()), second_mdb(new MemTable()), versions(data_dir)
+{
+    // Find the existing SSTables in the data directory
+    vector<string> files;
+    if (fs::exists(data_dir) && fs::is_directory(data_dir))
+    {
+        for (const auto &entry : fs::directory_iterator(data_dir))
+        {
+            if (entry.is_regular_file() && entry.path().extension() == ".sst")
+            {
+                files.push_back(entry.path().filename().string());
+            }
+        }
+        // Oldest first, so a directory without a MANIFEST keeps newer tables shadowing older ones
+        std::sort(files.begin(), files.end(), older_table_name);
+        // New names continue the sequence, so they sort after these even within the same second
+        for (const string &name : files)
+        {
+            table_seq = std::max(table_seq.load(), static_cast<long long>(std::get<2>(table_age(name))) + 1);
+        }
+    }
+    // The MANIFEST says which of them are live and in which level
+    if (!this->versions.open(files))
+    {
+        std::cerr << "Error: Could not open the MANIFEST in " << data_dir << "; new tables will not be recorded." << std::endl;
+    }
+    std::cout << "Loaded " << this->versions.table_count() << " SSTable(s) from " << data_dir << std::endl;
+    // Recover puts that had not reached an SSTable before the last shutdown or crash
+    size_t replayed = this->wal.replay([this](const string &key, const string &value)
+                                       { this->main_mdb->put(key, value); });
+    if (replayed > 0)
+    {
+        std::cout << "Replayed " << replayed << " write-ahead log record(s) in " << data_dir << std::endl;
+    }
+    this->wal.open();
+    this->wal.set_sync(WalSync::INTERVAL);
+    this->flusher = std::thread([this]()
+                                { run_flusher(); });
+}
+
+/**
+ * @brief Releases the MemTables and the current SSTable.
+ */
+Storage::~Storage()
+{
+    {
+        std::unique_lock<std::shared_mutex> lock(this->mutex);
+        this->stop_flusher = true;
+    }
+    this->flush_cv.notify_all();
+    this->flusher.join();
+    delete this->main_mdb;
+    delete this->second_mdb;
+}
+
+/**
+ * @brief Stores a key-value pair in the main MemTable, then checks for compaction.
+ * @param key The key to store.
+ * @param value The value associated with the key.
+ * @return True if the put operation was successful.
+ */
+bool Storage::put(string_view key, string_view value)
+{
+    PendingWrite write{&key, &value, 1};
+    return commit(write);
+}
+
+/**
+ * @brief Stores a batch of key-value pairs under one lock, checking for compaction once.
+ * @param keys The keys to store.
+ * @param values The values, one per key.
+ * @return True if every put succeeded.
+ */
+bool Storage::put_many(const vector<string_view> &keys, const vector<string_view> &values)
+{
+    if (keys.size() != values.size())
+    {
+        return false;
+    }
+    PendingWrite write{keys.data(), values.data(), keys.size()};
+    return commit(write);
+}
+
+// Upper bound on the payload one leader gathers, so a large group does not delay its leader for long.
+const size_t MAX_GROUP_BYTES = 1 << 20;
+
+/**
+ * @brief Queues a write and returns once it is logged and applied.
+ * Leaders take turns, so log order and MemTable order always agree.
+ */
+bool Storage::commit(PendingWrite &write)
+{
+    std::unique_lock<std::mutex> queue_lock(this->write_mutex);
+    this->writers.push_back(&write);
+    this->write_cv.wait(queue_lock, [this, &write]()
+                        { return write.done || this->writers.front() == &write; });
+    if (write.done)
+    {
+        return write.ok;
+    }
+
+    // This writer leads: take everyone queued behind it, up to the size limit
+    vector<PendingWrite *> group;
+    size_t group_bytes = 0;
+    for (PendingWrite *pending : this->writers)
+    {
+        size_t bytes = 0;
+        for (size_t i = 0; i < pending->count; ++i)
+        {
+            bytes += pending->keys[i].size() + pending->values[i].size();
+        }
+        if (!group.empty() && group_bytes + bytes > MAX_GROUP_BYTES)
+        {
+            break;
+        }
+        group.push_back(pending);
+        group_bytes += bytes;
+    }
+    queue_lock.unlock();
+
+    std::unique_lock<std::mutex> commit_lock(this->commit_mutex);
+    string records;
+    records.reserve(group_bytes + 16 * group.size());
+    for (PendingWrite *pending : group)
+    {
+        for (size_t i = 0; i < pending->count; ++i)
+        {
+            WriteAheadLog::encode(records, pending->keys[i], pending->values[i]);
+        }
+    }
+    bool ok = this->wal.write(records);
+    if (ok)
+    {
+        bool full;
+        {
+            // The skip list takes inserts alongside lookups; only leaders change main_mdb,
+            // and a swap needs the exclusive lock, so main_mdb stays put meanwhile
+            std::shared_lock<std::shared_mutex> lock(this->mutex);
+            wait_for_room(lock);
+            for (PendingWrite *pending : group)
+            {
+                for (size_t i = 0; i < pending->count; ++i)
+                {
+                    this->main_mdb->put(pending->keys[i], pending->values[i]);
+                }
+            }
+            full = this->main_mdb->oversize();
+        }
+        if (full)
+        {
+            std::unique_lock<std::shared_mutex> lock(this->mutex);
+            this->check_for_compaction(); // Trigger compaction check after each group
+        }
+    }
+    commit_lock.unlock();
+
+    queue_lock.lock();
+    for (PendingWrite *pending : group)
+    {
+        pending->ok = ok;
+        pending->done = true;
+        this->writers.pop_front();
+    }
+    this->write_cv.notify_all(); // Wakes the followers and the next leader
+    return ok;
+}
+
+/**
+ * @brief Looks a key up in the MemTables, then in the SSTables from the newest to the oldest.
+ * @param key The key to look up.
+ * @return The value associated with the key, or an empty string if the key is not found.
+ */
+string Storage::get(string_view key)
+{
+    std::shared_lock<std::shared_mutex> lock(this->mutex);
+    // First, check main_mdb, then second_mdb, then SSTables on disk
+    string value = this->main_mdb->get(key);
+    if (!value.empty())
+    {
+        return value;
+    }
+    value = this->second_mdb->get(key);
+    if (!value.empty())
+    {
+        return value;
+    }
+    // If not found in MemTables, check the SSTables from the newest to the oldest. The cached
+    // reader keeps its index and filter loaded, so each table costs at most one block read,
+    // and the value is copied once, straight out of the mapping or the cached block
+    ValueRef found;
+    const vector<TableFile> &level0 = this->versions.level(0);
+    for (auto it = level0.rbegin(); it != level0.rend(); ++it)
+    {
+        if (key < it->smallest || it->largest < key)
+        {
+            continue; // Level 0 tables overlap, but most still miss the key by range
+        }
+        if (this->table_cache.get(this->data_dir + it->name)->findRef(key, found) && !found.view().empty())
+        {
+            return string(found.view());
+        }
+    }
+    // Below level 0 the tables of a level do not overlap, so at most one can hold the key
+    for (int level = 1; level < VersionSet::NUM_LEVELS; ++level)
+    {
+        const vector<TableFile> &files = this->versions.level(level);
+        size_t i = this->versions.find(level, key);
+        if (i == files.size())
+        {
+            continue;
+        }
+        if (this->table_cache.get(this->data_dir + files[i].name)->findRef(key, found) && !found.view().empty())
+        {
+            return string(found.view());
+        }
+    }
+    return ""; // Key not found
+}
+
+/**
+ * @brief Looks up a batch of keys in one pass over each table, in the same table order as get().
+ * @param keys The keys to look up, in any order.
+ * @return The values in the order of keys; an empty string marks a key that was not found.
+ */
+vector<string> Storage::get_many(const vector<string_view> &keys)
+{
+    // Sort once, so each table sees the keys in order and neighbouring keys share block reads
+    vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b)
+              { return keys[a] < keys[b]; });
+    vector<string_view> sorted_keys;
+    sorted_keys.reserve(keys.size());
+    for (size_t i : order)
+    {
+        sorted_keys.push_back(keys[i]);
+    }
+
+    std::shared_lock<std::shared_mutex> lock(this->mutex);
+    vector<optional<string>> found(keys.size());
+    auto all_found = [&found]()
+    {
+        return std::all_of(found.begin(), found.end(), [](const optional<string> &v)
+                           { return v.has_value(); });
+    };
+    this->main_mdb->get_many(sorted_keys, found);
+    this->second_mdb->get_many(sorted_keys, found);
+    // Only the keys inside a table's range are looked up in it, and only the blocks holding
+    // them are read, not the whole table
+    auto search = [&](const TableFile &file)
+    {
+        auto first = std::lower_bound(sorted_keys.begin(), sorted_keys.end(), file.smallest);
+        auto last = std::upper_bound(first, sorted_keys.end(), file.largest);
+        if (first != last)
+        {
+            size_t from = first - sorted_keys.begin();
+            size_t to = last - sorted_keys.begin();
+            this->table_cache.get(this->data_dir + file.name)->findMany(sorted_keys, found, from, to);
+            for (size_t i = from; i < to; ++i)
+            {
+                if (found[i].has_value() && found[i]->empty())
+                {
+                    found[i].reset(); // Empty values count as absent, as in get()
+                }
+            }
+        }
+    };
+    const vector<TableFile> &level0 = this->versions.level(0);
+    for (auto it = level0.rbegin(); it != level0.rend() && !all_found(); ++it)
+    {
+        search(*it);
+    }
+    for (int level = 1; level < VersionSet::NUM_LEVELS && !all_found(); ++level)
+    {
+        for (const TableFile &file : this->versions.level(level))
+        {
+            search(file);
+        }
+    }
+
+    vector<string> values(keys.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        if (found[i].has_value())
+        {
+            values[order[i]] = std::move(*found[i]);
+        }
+    }
+    return values;
+}
+
+/**
+ * @brief Picks a file name for a new SSTable that does not clash with any existing file.
+ * @return The new file name, relative to the data directory.
+ */
+string Storage::new_table_filename()
+{
+    string name;
+    do
+    {
+        name = getCurrentUnixTimeString() + "_" + to_string(this->table_seq++) + ".sst";
+    } while (fs::exists(this->data_dir + name));
+    return name;
+}
+
+/**
+ * @brief Checks if a flush is needed.
+ * If the main MemTable is oversized and no other flush is in progress, it swaps the
+ * MemTables and hands the full one to the flush thread. A compaction in progress does not
+ * hold it up; the flush thread writes the table once the compaction is done.
+ * @return True if a flush was initiated, false otherwise.
+ */
+bool Storage::check_for_compaction()
+{
+    // Only one flush runs at a time; until it finishes, second_mdb still holds its data
+    if (this->main_mdb->oversize() && !this->flushing)
+    {
+        // swap the two in memory tables
+        this->main_mdb->readonly = true;
+        this->second_mdb->readonly = false;
+        this->second_mdb->clear();
+        auto tmp = this->main_mdb;
+        this->main_mdb = this->second_mdb;
+        this->second_mdb = tmp;
+        // hand the full table to the flush thread; new puts go to a new log file
+        this->flushing_logs = this->wal.rotate();
+        this->flushing = true;
+        this->flush_cv.notify_all();
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Blocks until the flush thread has nothing left to flush or compact.
+ */
+void Storage::wait_for_compaction()
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    this->flush_cv.wait(lock, [this]()
+                        { return !this->flushing && !this->compacting &&
+                                 (this->compaction_stalled || !this->versions.needs_compaction()); });
+}
+
+/**
+ * @brief Blocks until the flush thread has written out any MemTable handed to it.
+ */
+void Storage::wait_for_flush()
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    this->flush_cv.wait(lock, [this]()
+                        { return !this->flushing; });
+}
+
+void Storage::set_memtable_budget(size_t bytes)
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    this->main_mdb->max_bytes = bytes;
+    this->second_mdb->max_bytes = bytes;
+}
+
+size_t Storage::memory_usage()
+{
+    std::shared_lock<std::shared_mutex> lock(this->mutex);
+    return this->main_mdb->memory_usage() + this->second_mdb->memory_usage();
+}
+
+/**
+ * @brief Waits, with mutex held shared, until main_mdb may take another write.
+ */
+void Storage::wait_for_room(std::shared_lock<std::shared_mutex> &lock)
+{
+    this->flush_cv.wait(lock, [this]()
+                        { return !this->flushing || !this->main_mdb->oversize(); });
+}
+
+/**
+ * @brief Describes the table a MemTable is about to be flushed to; its size is filled in
+ * once the file is written.
+ * @return False if the MemTable is empty.
+ */
+static bool describe_flush(const MemTable &table, const string &filename, TableFile &file)
+{
+    SkipList::Iterator it(&table.entries());
+    it.seek_to_first();
+    if (!it.valid())
+    {
+        return false;
+    }
+    file.name = filename;
+    file.smallest = it.key();
+    it.seek_to_last();
+    file.largest = it.key();
+    return true;
+}
+
+/**
+ * @brief Writes a MemTable to a new SSTable in data_dir and forces it to stable storage.
+ * @return False if the table could not be written or synced; no file is left behind then.
+ */
+static bool write_flush(const MemTable &table, const string &data_dir, const string &filename)
+{
+    SSTable *flushed_sst = table.write_to_disk(filename, data_dir);
+    if (!flushed_sst)
+    {
+        return false; // The builder removes the partial file
+    }
+    delete flushed_sst; // Readers open the table through the table cache
+    // The table must be on stable storage before the logs that cover it go away
+    if (!WriteAheadLog::sync_file(data_dir + filename) || !WriteAheadLog::sync_file(data_dir))
+    {
+        std::error_code ec;
+        fs::remove(data_dir + filename, ec);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Records a flushed table as the newest of level 0.
+ * @return False if it could not be recorded; the file is deleted then.
+ */
+static bool publish_flush(VersionSet &versions, const string &data_dir, TableFile file)
+{
+    std::error_code ec;
+    file.size = fs::file_size(data_dir + file.name, ec);
+    VersionEdit edit;
+    edit.added.emplace_back(0, file);
+    if (ec || !versions.apply(edit))
+    {
+        fs::remove(data_dir + file.name, ec);
+        return false;
+    }
+    return true;
+}
+
+// Time between attempts at a flush that failed.
+const auto FLUSH_RETRY_INTERVAL = chrono::milliseconds(100);
+
+/**
+ * @brief Body of the flush thread. The SSTable is written without holding the lock, so reads
+ * and writes to main_mdb carry on; only publishing the file takes the lock exclusively.
+ * Compactions run between flushes, also writing with the lock released; a flush handed over
+ * meanwhile waits for at most the compaction in progress.
+ * A flush that fails is tried again every FLUSH_RETRY_INTERVAL. Until one succeeds, second_mdb
+ * keeps its rows and flushing stays set, so no swap clears it, writers stall once main_mdb
+ * fills up, and the logs covering second_mdb stay on disk to be replayed after a restart.
+ */
+void Storage::run_flusher()
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    while (true)
+    {
+        Compaction compaction;
+        while (!this->flushing && !this->stop_flusher && !this->compacting && !this->compaction_stalled &&
+               this->versions.pick_compaction(compaction))
+        {
+            if (!compact(lock, compaction))
+            {
+                this->compaction_stalled = true; // Tried again after the next flush
+                this->flush_cv.notify_all();
+            }
+        }
+        this->flush_cv.wait(lock, [this]()
+                            { return this->flushing || this->stop_flusher ||
+                                     (!this->compacting && !this->compaction_stalled && this->versions.needs_compaction()); });
+        if (!this->flushing)
+        {
+            return;
+        }
+        MemTable *table = this->second_mdb; // Immutable until flushing is cleared
+        string flushed_filename = new_table_filename();
+        TableFile flushed_file;
+        bool described = describe_flush(*table, flushed_filename, flushed_file);
+        this->flush_failed = false;
+        lock.unlock();
+
+        auto start_time = chrono::high_resolution_clock::now();
+        long long bytes_flushed = table->get_size_bytes();
+        bool written = write_flush(*table, this->data_dir, flushed_filename);
+        auto end_time = chrono::high_resolution_clock::now();
+
+        lock.lock();
+        // The table only counts once the MANIFEST lists it, so the logs stay until then too
+        if (!written || !described || !publish_flush(this->versions, this->data_dir, flushed_file))
+        {
+            std::cerr << "Error: Failed to flush MemTable to disk; keeping it in memory to try again." << std::endl;
+            this->flush_failures++;
+            this->flush_failed = true;
+            this->flush_cv.notify_all();
+            if (!this->stop_flusher)
+            {
+                this->flush_cv.wait_for(lock, FLUSH_RETRY_INTERVAL, [this]()
+                                        { return this->stop_flusher || !this->flushing; });
+            }
+            if (this->flushing && this->stop_flusher)
+            {
+                return; // Replayed from the retained logs when the storage is opened again
+            }
+            continue;
+        }
+        // The new file and the emptied table become visible to readers together
+        table->clear();
+        this->compaction_stalled = false;
+        this->wal.remove(this->flushing_logs);
+        this->flushing_logs.clear();
+        this->flush_time_ns += chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
+        this->flush_bytes_operated += bytes_flushed;
+        this->flushing = false;
+        this->flush_cv.notify_all();
+    }
+}
+
+/**
+ * @brief Runs a compaction. Every input is read one block at a time through an
+ * SSTable::Iterator, and a min-heap over their current keys yields the pairs in key order.
+ * Of several versions of a key, the one from the newest table, the latest among the inputs,
+ * is kept and the others are dropped. The result streams into SSTableBuilders, a new table
+ * whenever one reaches the target size, so the merge holds about a block per table.
+ * A single input with nothing to merge it with moves down a level without being rewritten.
+ */
+bool Storage::compact(std::unique_lock<std::shared_mutex> &lock, const Compaction &compaction)
+{
+    if (compaction.inputs.empty())
+    {
+        return true;
+    }
+    VersionEdit edit;
+    for (const auto &input : compaction.inputs)
+    {
+        edit.removed.emplace_back(input.first, input.second.name);
+    }
+    edit.compact_pointers = compaction.compact_pointers; // Moves on only once the output is in
+    if (compaction.inputs.size() == 1)
+    {
+        if (compaction.inputs[0].first == compaction.level)
+        {
+            return true; // Already where it would go
+        }
+        edit.added.emplace_back(compaction.level, compaction.inputs[0].second);
+        bool ok = this->versions.apply(edit);
+        this->flush_cv.notify_all();
+        return ok;
+    }
+
+    this->compacting = true;
+    auto start_time = chrono::high_resolution_clock::now();
+    long long bytes_merged = 0;
+    const uint64_t table_file_bytes = this->versions.table_file_bytes;
+    // Flushes and lookups carry on while the tables are written; the inputs stay live meanwhile
+    lock.unlock();
+
+    // One cursor per input, oldest first, so a higher index is a newer table
+    vector<shared_ptr<SSTable>> inputs;
+    vector<unique_ptr<SSTable::Iterator>> cursors;
+    for (const auto &input : compaction.inputs)
+    {
+        inputs.push_back(this->table_cache.get(this->data_dir + input.second.name));
+        cursors.push_back(std::make_unique<SSTable::Iterator>(*inputs.back()));
+    }
+
+    // Ordered so that the heap's top is the smallest key, and among equal keys the newest table
+    auto after = [&cursors](size_t a, size_t b)
+    {
+        int order = cursors[a]->key().compare(cursors[b]->key());
+        return order != 0 ? order > 0 : a < b;
+    };
+    vector<size_t> heap;
+    for (size_t i = 0; i < cursors.size(); ++i)
+    {
+        if (cursors[i]->valid())
+        {
+            heap.push_back(i);
+        }
+    }
+    std::make_heap(heap.begin(), heap.end(), after);
+
+    // The merge comes out sorted, so it streams straight into the new tables
+    vector<TableFile> outputs;
+    unique_ptr<SSTableBuilder> builder;
+    string last_key;
+    bool ok = true;
+    auto finish_output = [&]()
+    {
+        TableFile &output = outputs.back();
+        output.largest = last_key;
+        bool done = builder->finish() && WriteAheadLog::sync_file(this->data_dir + output.name);
+        output.size = builder->fileSize();
+        builder.reset();
+        return done;
+    };
+    while (!heap.empty() && ok)
+    {
+        std::pop_heap(heap.begin(), heap.end(), after);
+        SSTable::Iterator &cursor = *cursors[heap.back()];
+        bytes_merged += cursor.key().length() + cursor.value().length();
+        // The newest version of a key comes out first; older ones follow it and are dropped
+        if (outputs.empty() || last_key != cursor.key())
+        {
+            if (!builder)
+            {
+                outputs.emplace_back();
+                outputs.back().name = new_table_filename();
+                outputs.back().smallest = cursor.key();
+                builder = std::make_unique<SSTableBuilder>(this->data_dir + outputs.back().name);
+            }
+            ok = builder->add(cursor.key(), cursor.value());
+            last_key = cursor.key();
+            if (ok && builder->fileSize() >= table_file_bytes)
+            {
+                ok = finish_output();
+            }
+        }
+        cursor.next();
+        if (cursor.valid())
+        {
+            std::push_heap(heap.begin(), heap.end(), after);
+        }
+        else
+        {
+            heap.pop_back();
+        }
+    }
+    if (ok && builder)
+    {
+        ok = finish_output();
+    }
+    builder.reset(); // Deletes a table left unfinished by a failure
+    ok = ok && std::all_of(cursors.begin(), cursors.end(), [](const unique_ptr<SSTable::Iterator> &cursor)
+                           { return cursor->ok(); });
+    ok = ok && WriteAheadLog::sync_file(this->data_dir);
+    cursors.clear();
+    inputs.clear();
+
+    lock.lock();
+    for (const TableFile &output : outputs)
+    {
+        edit.added.emplace_back(compaction.level, output);
+    }
+    // The outputs replace the inputs in one MANIFEST edit, so a crash leaves either set live
+    if (!ok || !this->versions.apply(edit))
+    {
+        // Keep every input, so nothing is lost; a later compaction tries again
+        std::cerr << "Error: Failed to compact SSTables; keeping the input files." << std::endl;
+        for (const TableFile &output : outputs)
+        {
+            std::error_code ec;
+            fs::remove(this->data_dir + output.name, ec);
+        }
+        this->compacting = false;
+        this->flush_cv.notify_all();
+        return false;
+    }
+
+    // Delete the inputs, closing their cached readers first
+    for (const auto &input : compaction.inputs)
+    {
+        this->table_cache.evict(this->data_dir + input.second.name);
+        fs::remove(this->data_dir + input.second.name);
+    }
+
+    auto end_time = chrono::high_resolution_clock::now();
+    this->merge_time_ns += chrono::duration_cast<chrono::nanoseconds>(end_time - start_time).count();
+    this->merge_bytes_operated += bytes_merged;
+    this->compacting = false;
+    this->flush_cv.notify_all();
+    return true;
+}
+
+/**
+ * @brief Compacts every SSTable into one sorted run, in the deepest level holding tables.
+ */
+void Storage::merge()
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    this->flush_cv.wait(lock, [this]()
+                        { return !this->compacting; });
+    compact(lock, this->versions.full_compaction());
+}
+
+vector<string> Storage::tables()
+{
+    std::shared_lock<std::shared_mutex> lock(this->mutex);
+    return this->versions.tables();
+}
+
+bool Storage::add_table(const string &filename)
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    VersionEdit edit;
+    edit.added.emplace_back(0, TableFile());
+    if (!this->versions.describe(filename, edit.added.back().second) || !this->versions.apply(edit))
+    {
+        return false;
+    }
+    this->flush_cv.notify_all(); // Level 0 may have outgrown its budget
+    return true;
+}
+
+void Storage::set_compaction_options(size_t l0_tables, uint64_t level1_bytes, uint64_t table_file_bytes)
+{
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    this->versions.l0_compaction_trigger = l0_tables;
+    this->versions.level1_bytes = level1_bytes;
+    this->versions.table_file_bytes = table_file_bytes;
+    this->flush_cv.notify_all(); // A level may now be over its budget
+}
+
+/**
+ * @brief Flushes all in-memory MemTables (main and second) to disk as SSTables.
+ * This method is typically called during server shutdown to ensure data persistence.
+ * Each MemTable's logs are removed once its own table is published; a MemTable that cannot
+ * be flushed keeps its rows and its logs.
+ */
+void Storage::flush_all_memtables_to_disk()
+{
+    // Rotate between groups: a group already in the log is also in main_mdb
+    std::lock_guard<std::mutex> commit_lock(this->commit_mutex);
+    std::unique_lock<std::shared_mutex> lock(this->mutex);
+    // Let a background flush land first, so its table is not written twice; one that keeps
+    // failing is tried once more below instead
+    this->flush_cv.wait(lock, [this]()
+                        { return !this->flushing || this->flush_failed; });
+    std::cout << "Storage::flush_all_memtables_to_disk called." << std::endl;
+
+    // Writes the table to disk and publishes it, then drops it and the logs that cover it
+    auto flush_table = [this](MemTable *table, vector<string> &logs, const char *name)
+    {
+        std::cout << "Flushing " << name << " to disk during shutdown..." << std::endl;
+        string flushed_filename = new_table_filename();
+        TableFile flushed_file;
+        describe_flush(*table, flushed_filename, flushed_file);
+        if (!write_flush(*table, this->data_dir, flushed_filename) ||
+            !publish_flush(this->versions, this->data_dir, flushed_file))
+        {
+            std::cerr << "Error: Failed to flush " << name << " to disk during shutdown." << std::endl;
+            return false;
+        }
+        table->clear();
+        this->wal.remove(logs);
+        logs.clear();
+        std::cout << "Successfully flushed " << name << " to " << flushed_filename << std::endl;
+        return true;
+    };
+
+    // second_mdb holds older rows than main_mdb, so its table has to come first in level 0
+    bool flushed = true;
+    if (this->flushing)
+    {
+        flushed = flush_table(this->second_mdb, this->flushing_logs, "second_mdb");
+        if (flushed)
+        {
+            this->flushing = false;
+            this->flush_failed = false;
+            this->compaction_stalled = false;
+        }
+    }
+    if (flushed && !this->main_mdb->is_empty())
+    {
+        // Everything logged so far is in main_mdb; later puts go to a new log file
+        vector<string> logs = this->wal.rotate();
+        if (!flush_table(this->main_mdb, logs, "main_mdb"))
+        {
+            this->wal.retain(logs); // They still cover main_mdb
+        }
     }
+    this->flush_cv.notify_all(); // Level 0 may have outgrown its budget
     std::cout << "Storage::flush_all_memtables_to_disk finished." << std::endl;
 }
 
@@ -495,14 +1987,11 @@ void Storage::flush_all_memtables_to_disk()
  */
 void Server::handle_signal(int signal)
 {
-    std::cout << "Caught signal " << signal << ", initiating graceful shutdown..." << std::endl;
     _running = 0; // Set the flag to stop the main loop
     if (_instance)
     {
-        // Call the shutdown method directly
-        _instance->shutdown();
-        // No need to close socket here, as shutdown() will handle it
+        // Only wake the event loop here; start() returns and the destructor runs shutdown(),
+        // so memtables are never flushed from inside a signal handler.
+        _instance->stop();
     }
-    // fflush(stdout);
-    // fflush(stderr);
 }
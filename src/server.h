@@ -3,11 +3,25 @@
 
 #include "request.h"
 #include "database.h"
+#include "uring.h"
+#include "worker_pool.h"
+#include "wal.h"
+#include "table_cache.h"
+#include "version_set.h"
 #include <stdio.h>
 #include <string>
 #include <vector>
+#include <atomic>
 #include <chrono>
 #include <filesystem>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
 #include <sys/socket.h> // For socket, bind, listen, accept
 #include <netinet/in.h> // For sockaddr_in
 #include <unistd.h>     // For close
@@ -18,6 +32,39 @@ using namespace std;
 
 class Server; // Forward declaration for Storage class
 
+/**
+ * @brief Per-client state kept by the event loop while a connection stays open.
+ * Bytes are accumulated in in_buf until a complete request is available, and
+ * responses are queued in out_buf until the socket accepts them.
+ */
+struct Connection
+{
+    int fd = -1;
+    uint64_t id = 0;      // Unique per shard, so late completions never reach a reused fd
+    string in_buf;        // Received bytes not yet parsed into requests
+    string out_buf;       // Serialized responses not yet written to the socket
+    size_t out_pos = 0;   // Number of bytes of out_buf already written
+    bool closing = false; // Peer closed its side; close once out_buf drains
+    bool executing = false; // A batch of its requests is running on the worker pool
+
+    /**
+     * @brief Responses in request order. A slot stays unready while its request
+     * executes on another shard; only the ready prefix is moved to out_buf.
+     */
+    deque<pair<bool, string>> pending;
+    uint64_t first_pending_seq = 0; // Sequence number of pending.front()
+
+    // io_uring engine only: the kernel owns recv_buf and send_buf while operations are in flight,
+    // so new responses collect in out_buf and are swapped into send_buf between sends.
+    vector<char> recv_buf;
+    string send_buf;
+    size_t send_pos = 0;
+    int inflight = 0; // Ring operations still referencing this connection
+    bool receiving = false;
+    bool sending = false;
+    bool failed = false; // A send failed; close as soon as nothing is in flight
+};
+
 /**
  * @brief The Storage class manages in-memory tables (MemTables) and on-disk tables (SSTables),
  * handling compaction and merging processes.
@@ -34,14 +81,83 @@ public:
      * @brief Constructs a new Storage object.
      * @param server A pointer to the Server instance associated with this storage.
      */
-    Storage(Server *server);
+    Storage(Server *server, const string &data_dir = "data/");
+
+    /**
+     * @brief Finishes any flush or compaction in progress, stops the flush thread, and
+     * releases the MemTables.
+     */
+    ~Storage();
+
+    /**
+     * @brief Directory holding this storage's SSTable files, with a trailing slash.
+     */
+    string data_dir;
+
+    /**
+     * @brief Guards the tables. Lookups and MemTable inserts hold it shared, so reads from
+     * several worker threads run side by side with the write group being applied; swapping
+     * MemTables, publishing flushes and merges hold it exclusively.
+     */
+    std::shared_mutex mutex;
+
+    /**
+     * @brief Write-ahead log of the puts held in the MemTables, replayed into main_mdb when
+     * the storage is opened again after a crash.
+     */
+    WriteAheadLog wal;
+
+    /**
+     * @brief Logs a put, stores it in the main MemTable, then checks for compaction.
+     * Concurrent puts are group-committed: one writer appends the whole queued group to the
+     * log with a single write (and at most one sync), then applies it in log order.
+     * @param key The key to store.
+     * @param value The value associated with the key.
+     * @return True if the put operation was successful.
+     */
+    bool put(string_view key, string_view value);
 
     /**
-     * @brief Checks if compaction (flushing MemTable to SSTable or merging SSTables) is needed.
-     * @return True if a compaction was initiated, false otherwise.
+     * @brief Logs and stores a batch of key-value pairs as one group, checking for compaction once.
+     * @param keys The keys to store.
+     * @param values The values, one per key.
+     * @return True if every put succeeded.
+     */
+    bool put_many(const vector<string_view> &keys, const vector<string_view> &values);
+
+    /**
+     * @brief Checks if a flush is needed.
+     * A full main MemTable is swapped with the empty second one, and the flush thread writes
+     * it out in the background; reads keep finding its keys in second_mdb meanwhile.
+     * The caller must hold commit_mutex, then mutex exclusively, when other threads may use
+     * this storage.
+     * @return True if a flush was started, false otherwise.
      */
     bool check_for_compaction();
 
+    /**
+     * @brief Blocks until the flush thread has written out any MemTable handed to it.
+     */
+    void wait_for_flush();
+
+    /**
+     * @brief Blocks until no flush or compaction is running and every level is within its
+     * budget, or the last compaction failed.
+     */
+    void wait_for_compaction();
+
+    /**
+     * @brief Sets the memory budget at which a MemTable is swapped out and flushed, on both
+     * MemTables so it survives the swaps.
+     * @param bytes The budget, compared against MemTable::memory_usage().
+     */
+    void set_memtable_budget(size_t bytes);
+
+    /**
+     * @brief Returns the memory held by both MemTables, without walking them.
+     */
+    size_t memory_usage();
+
     /**
      * @brief The interval (in some unit, e.g., seconds) at which the storage maintainer checks for compaction.
      */
@@ -49,15 +165,67 @@ public:
 
     MemTable *main_mdb;
     MemTable *second_mdb;
-    SSTable *sst;
+
+    /**
+     * @brief Looks a key up in the MemTables, then in the SSTables from the newest to the
+     * oldest: every level 0 table whose range holds the key, then one table per deeper level.
+     * An empty value counts as absent, so the search goes on to older data; get_many() follows
+     * the same rule.
+     * @param key The key to look up.
+     * @return The value associated with the key, or an empty string if the key is not found.
+     */
+    string get(string_view key);
+
+    /**
+     * @brief Looks up a batch of keys in one pass over each table.
+     * The keys are sorted once, so every SSTable data block is read at most once for the
+     * whole batch, and tables are skipped once every key has been found.
+     * @param keys The keys to look up, in any order.
+     * @return The values in the order of keys; an empty string marks a key that was not found.
+     */
+    vector<string> get_many(const vector<string_view> &keys);
 
 public: // Changed for testing purposes
-    vector<string> tables_to_merge;
     /**
-     * @brief Merges the SSTables listed in tables_to_merge into a new, consolidated SSTable.
+     * @brief The live SSTables, in levels, as recorded in the MANIFEST. Flushes add tables
+     * to level 0, and the flush thread compacts levels that outgrow their budget between
+     * flushes. Guarded by mutex.
+     */
+    VersionSet versions;
+
+    /**
+     * @brief Open readers of the live tables, so lookups do not reload a table's index and
+     * filter every time. Compactions evict the files they delete.
+     */
+    TableCache table_cache;
+
+    /**
+     * @brief Compacts every SSTable into one sorted run, in the deepest level holding tables.
+     * Waits for a background compaction to finish first.
      */
     void merge();
 
+    /**
+     * @brief Returns the names of the live SSTables, newest first.
+     */
+    vector<string> tables();
+
+    /**
+     * @brief Adds a table file written into data_dir by other means as the newest table of
+     * level 0.
+     * @param filename The file name, relative to data_dir.
+     * @return False if the table is empty or unreadable, or the MANIFEST cannot be written.
+     */
+    bool add_table(const string &filename);
+
+    /**
+     * @brief Sets when levels are compacted and how large compaction outputs grow.
+     * @param l0_tables Level 0 is compacted once it holds this many tables.
+     * @param level1_bytes Bytes level 1 may hold; every deeper level may hold ten times more.
+     * @param table_file_bytes Compactions start a new table once the current one reaches this size.
+     */
+    void set_compaction_options(size_t l0_tables, uint64_t level1_bytes, uint64_t table_file_bytes);
+
     // Performance metrics
     long long flush_time_ns = 0;
     long long merge_time_ns = 0;
@@ -70,18 +238,121 @@ public: // Changed for testing purposes
     long long get_flush_bytes_operated() const { return flush_bytes_operated; }
     long long get_merge_bytes_operated() const { return merge_bytes_operated; }
 
+    /**
+     * @brief Number of flush attempts that failed; each one is retried until it succeeds.
+     */
+    uint64_t get_flush_failures() const { return flush_failures.load(); }
+
     /**
      * @brief Flushes all in-memory MemTables (main and second) to disk as SSTables.
      * This method is typically called during server shutdown to ensure data persistence.
+     * A flush that the flush thread keeps failing is tried here too, before main_mdb.
+     * The logs covering each MemTable are removed only once that MemTable's table is published.
      */
     void flush_all_memtables_to_disk();
 
+    /**
+     * @brief Picks a file name for a new SSTable that does not clash with any existing file.
+     * Names start with the Unix timestamp and carry a sequence number, so several tables
+     * created within the same second never overwrite one another.
+     * @return The new file name, relative to the data directory.
+     */
+    string new_table_filename();
+
 private:
     /**
-     * @brief Flag indicating if a merge operation is currently in progress.
-     * Prevents multiple concurrent merge operations.
+     * @brief Sequence number appended to new SSTable file names; starts past that of every
+     * table found on disk, so file names order tables by age. Compactions name their
+     * outputs without holding mutex.
      */
-    bool merging;
+    std::atomic<long long> table_seq{0};
+
+    /**
+     * @brief Flag indicating if a compaction is currently in progress.
+     * Prevents multiple concurrent compactions.
+     */
+    bool compacting = false;
+
+    /**
+     * @brief Set when a background compaction failed; none is tried again until the next flush.
+     */
+    bool compaction_stalled = false;
+
+    /**
+     * @brief Runs a compaction picked from versions. The inputs are merged into new tables
+     * of the output level with mutex released; the new tables then replace the inputs in one
+     * MANIFEST edit, and the inputs are deleted.
+     * @param lock Holds mutex exclusively on entry and on return.
+     * @return False if the compaction failed; the inputs stay live then.
+     */
+    bool compact(std::unique_lock<std::shared_mutex> &lock, const Compaction &compaction);
+
+    /**
+     * @brief Writes second_mdb to disk whenever a swap hands it over, then publishes the
+     * new SSTable and empties second_mdb under the exclusive lock. A failed flush is retried,
+     * and second_mdb is never emptied before its table is published. Between flushes, runs
+     * compactions until every level is within its budget.
+     */
+    void run_flusher();
+
+    /**
+     * @brief Waits, with mutex held shared, until main_mdb may take another write.
+     * Writers only stall when main_mdb filled up again before the previous flush finished.
+     */
+    void wait_for_room(std::shared_lock<std::shared_mutex> &lock);
+
+    std::thread flusher;
+    std::condition_variable_any flush_cv; // Signalled when a flush is handed over or finishes
+    bool flushing = false;                // second_mdb is being written out
+    bool flush_failed = false;            // The last attempt at the pending flush failed
+    bool stop_flusher = false;
+    vector<string> flushing_logs;         // Log files covering second_mdb, removed once it is on disk
+    std::atomic<uint64_t> flush_failures{0};
+
+    // A caller of put() or put_many() waiting in the group commit queue
+    struct PendingWrite
+    {
+        const string_view *keys;
+        const string_view *values;
+        size_t count;
+        bool done = false;
+        bool ok = false;
+    };
+
+    /**
+     * @brief Queues a write and returns once it is logged and applied, either by this
+     * caller as the group's leader or by an earlier leader that took it along.
+     */
+    bool commit(PendingWrite &write);
+
+    std::mutex write_mutex; // Guards writers; never held while writing the log
+    // Held by a leader from writing its group to the log until the group is in main_mdb.
+    // Rotating the log takes it first, so a group is never logged to a file that a flush
+    // retires while its puts are still missing from the MemTable being flushed.
+    std::mutex commit_mutex;
+    std::condition_variable write_cv;
+    deque<PendingWrite *> writers; // The front writer is the leader of the next group
+};
+
+/**
+ * @brief One event loop of the server, normally pinned to its own core.
+ * A shard owns its listening socket, epoll instance, connections and Storage.
+ * Other shards never touch that state directly; they post tasks to its inbox.
+ */
+struct Shard
+{
+    int index = 0;
+    int listen_fd = -1; // Bound with SO_REUSEPORT so the kernel spreads connections across shards
+    int epoll_fd = -1;
+    int wake_fd = -1;   // eventfd signalled when the inbox fills or the server stops
+    Storage *storage = nullptr;
+    unordered_map<int, Connection> connections; // Open client connections keyed by fd
+    uint64_t next_connection_id = 1;
+
+    std::mutex inbox_mutex;
+    vector<function<void()>> inbox; // Tasks posted by other shards
+    std::thread thread;
+    IoRing *ring = nullptr; // Set while the shard runs the io_uring engine
 };
 
 /**
@@ -98,30 +369,160 @@ public:
 
     /**
      * @brief Constructs a new Server object with a specified address and port.
+     * With more than one shard, every shard gets its own listening socket on the same port
+     * and its own Storage under data/shard-<n>/. Keys are routed to shards by hash, so the
+     * shard count must stay the same across restarts of a data directory.
      * @param address The network address the server will listen on.
      * @param port The port number the server will listen on.
+     * @param shards The number of shard event loops; 0 means one per available core.
      */
-    Server(const string &, int);
+    Server(const string &, int, int shards = 1);
 
     /**
      * @brief Starts the server, making it ready to accept client connections.
+     * Runs one non-blocking, edge-triggered epoll loop per shard until stop() is called
+     * or a termination signal arrives. Shard 0 runs on the calling thread and the others
+     * on their own threads. Connections stay open across requests.
      */
     void start();
 
+    /**
+     * @brief Asks a running start() loop to return. Safe to call from another thread or a signal handler.
+     */
+    void stop();
+
+    /**
+     * @brief Executes a single parsed request against the storage and builds its response.
+     * @param req The request to execute; its key and value may point into a receive buffer.
+     * @return The response to send back to the client.
+     */
+    Response handle_request(const RequestView &req);
+
+    /**
+     * @brief Executes a single owned request against the storage and builds its response.
+     * @param req The request to execute.
+     * @return The response to send back to the client.
+     */
+    Response handle_request(const Request &req) { return handle_request(req.view()); }
+
+    /**
+     * @brief The backlog passed to listen(). Defaults to the system maximum.
+     */
+    int listen_backlog = SOMAXCONN;
+
+    /**
+     * @brief The largest request (in bytes) a connection may buffer before it is dropped.
+     * Applies to both text lines and binary frames.
+     */
+    size_t max_request_size = 64 * 1024 * 1024;
+
+    /**
+     * @brief Unsent response bytes a connection may accumulate before the server stops
+     * executing further pipelined requests from it. Parsing resumes once the client reads.
+     */
+    size_t max_pending_output = 4 * 1024 * 1024;
+
+    /**
+     * @brief Run each shard on io_uring instead of epoll: accept, recv and send are ring
+     * operations, and SSTable block reads on the shard thread go through the same ring.
+     * Falls back to epoll when the build or the kernel lacks io_uring support.
+     */
+    bool use_io_uring = false;
+
+    /**
+     * @brief Whether start() pins each shard thread to its own core when running several shards.
+     */
+    bool pin_threads = true;
+
+    /**
+     * @brief When the write-ahead logs force appended puts to disk. Applied by start();
+     * storages use WalSync::INTERVAL until then.
+     */
+    WalSync wal_sync = WalSync::INTERVAL;
+
+    /**
+     * @brief Milliseconds between log syncs under WalSync::INTERVAL, which bounds how much
+     * acknowledged data a power failure can lose.
+     */
+    unsigned wal_sync_interval_ms = 10;
+
+    /**
+     * @brief Memory budget of each storage's MemTable, in bytes; a full MemTable is flushed to
+     * an SSTable. Applied by start(). Every storage holds up to two MemTables, one of them
+     * being flushed, so this bounds MemTable memory at twice the budget per shard.
+     */
+    size_t memtable_bytes = 64 << 20;
+
+    /**
+     * @brief Capacity in bytes of the block cache all SSTables share (SSTable::blockCache).
+     * Applied by start(); 0 disables the cache.
+     */
+    size_t block_cache_bytes = 64 << 20;
+
+    /**
+     * @brief Number of SSTable readers each storage keeps open in its table cache. Applied by start().
+     */
+    size_t max_open_tables = TableCache::DEFAULT_CAPACITY;
+
+    /**
+     * @brief Number of storage worker threads. When non-zero, shard threads only do network
+     * I/O and parsing: each read's worth of requests from a connection is handed to a shared
+     * work-stealing pool, and the responses are posted back to the connection's shard.
+     * A slow disk read or flush then stalls one connection instead of a whole shard.
+     * 0 executes requests inline on the shard threads.
+     */
+    size_t worker_threads = 0;
+
+    /**
+     * @brief Returns the number of shards this server runs.
+     */
+    size_t shard_count() const { return _shards.size(); }
+
+    /**
+     * @brief Returns the index of the shard that owns a key.
+     * @param key The key to route.
+     * @return A shard index in [0, shard_count()).
+     */
+    size_t shard_for(string_view key) const;
+
+    /**
+     * @brief Returns the storage of the shard that owns a key.
+     * @param key The key to route.
+     * @return The owning shard's Storage.
+     */
+    Storage *storage_for(string_view key) const;
+
     /**
      * @brief Stores a key-value pair in the database.
      * @param key The key to store.
      * @param payload The value associated with the key.
      * @return True if the put operation was successful.
      */
-    bool put(const string &, const string &);
+    bool put(string_view key, string_view payload);
 
     /**
      * @brief Retrieves the value associated with a given key from the database.
      * @param key The key to retrieve.
      * @return The value associated with the key, or an empty string if the key is not found.
      */
-    string get(const string &);
+    string get(string_view key);
+
+    /**
+     * @brief Stores a batch of key-value pairs, checking for compaction once per storage
+     * rather than once per key.
+     * @param keys The keys to store.
+     * @param values The values, one per key.
+     * @return True if every put succeeded.
+     */
+    bool multi_put(const vector<string_view> &keys, const vector<string_view> &values);
+
+    /**
+     * @brief Retrieves a batch of keys, grouping them by owning storage so that each
+     * storage serves its share in one sorted pass.
+     * @param keys The keys to retrieve.
+     * @return The values in the order of keys; an empty string marks a key that was not found.
+     */
+    vector<string> multi_get(const vector<string_view> &keys);
 
     /**
      * @brief Shuts down the server, gracefully closing connections and releasing resources.
@@ -141,15 +542,58 @@ private:
     // Static signal handler to allow C-style signal function to access Server members
     static void handle_signal(int signal);
 
-    int _server_fd;              // Server socket file descriptor
-    int _new_socket;             // New socket for accepted client connections
     struct sockaddr_in _address; // Server address structure
     string _server_address;      // Server address structure
     int _addrlen;
     int _port;
 
+    vector<unique_ptr<Shard>> _shards;
+    unique_ptr<WorkerPool> _pool; // Exists while start() runs with worker_threads > 0
+
+    // A batch command whose keys span several shards. Each owning shard answers its part,
+    // and the parts are merged into one response on the shard that received the command.
+    struct MultiGather
+    {
+        uint64_t seq;
+        bool binary;
+        Response response;
+        size_t remaining; // Parts not yet merged
+    };
+
+    // A pipelined request executed on another shard, and the slot its response fills
+    struct ForwardedRequest
+    {
+        uint64_t seq;
+        Request request;
+        bool binary;
+        shared_ptr<MultiGather> gather; // Set when this is one shard's part of a batch command
+        vector<size_t> positions;       // Positions of this part's keys within the whole batch
+    };
+    using ForwardBatches = vector<vector<ForwardedRequest>>; // Indexed by owning shard
+
+    // Event loop helpers, each running on the thread of the shard passed in
+    void run_shard(Shard &shard);
+    void run_shard_uring(Shard &shard, IoRing &ring);
+    void handle_completion(Shard &shard, const IoCompletion &completion);
+    void uring_service(Shard &shard, Connection &conn);
+    void accept_connections(Shard &shard);
+    bool service(Shard &shard, Connection &conn);
+    bool read_from(Connection &conn);
+    bool process_input(Shard &shard, Connection &conn);
+    void dispatch(Shard &shard, Connection &conn, const RequestView &req, bool binary, ForwardBatches &batches);
+    void dispatch_batch(Shard &shard, Connection &conn, const RequestView &req, bool binary, ForwardBatches &batches);
+    void forward(Shard &shard, Connection &conn, size_t owner, vector<ForwardedRequest> batch);
+    void execute_on_pool(Shard &shard, Connection &conn, vector<ForwardedRequest> batch);
+    void flush_ready(Connection &conn);
+    bool write_to(Connection &conn);
+    void close_connection(Shard &shard, int fd);
+    void complete(Shard &shard, int fd, uint64_t conn_id, vector<pair<uint64_t, string>> responses);
+    void post(Shard &shard, function<void()> task);
+    void drain_inbox(Shard &shard);
+    int open_listen_socket();
+
 public: // Changed for testing purposes
-    Storage *storage;
+    Storage *storage; // Storage of shard 0, the only one in single-shard mode
 
     // RequestHandler *rh; // Removed RequestHandler as it's no longer used
 };
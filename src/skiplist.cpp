@@ -0,0 +1,176 @@
+#include "skiplist.h"
+#include <cstring>
+#include <new>
+#include <random>
+
+// Each level holds about a quarter of the nodes of the level below.
+const unsigned BRANCHING = 4;
+
+SkipList::SkipList() : _head(new_node("", MAX_HEIGHT))
+{
+}
+
+SkipList::Node *SkipList::new_node(std::string_view key, int height)
+{
+    // The next array runs past the end of the struct, sized for the tower, and the key follows it
+    size_t bytes = sizeof(Node) + sizeof(std::atomic<Node *>) * (height - 1) + key.size();
+    Node *node = reinterpret_cast<Node *>(_arena.allocate(bytes));
+    new (&node->value) std::atomic<Version *>(nullptr);
+    node->key_size = static_cast<uint32_t>(key.size());
+    node->height = height;
+    for (int level = 0; level < height; ++level)
+    {
+        new (&node->next[level]) std::atomic<Node *>(nullptr);
+    }
+    memcpy(const_cast<char *>(node->key().data()), key.data(), key.size());
+    return node;
+}
+
+SkipList::Version *SkipList::new_version(std::string_view value)
+{
+    Version *version = reinterpret_cast<Version *>(_arena.allocate(sizeof(Version) + value.size()));
+    version->older = nullptr;
+    version->size = static_cast<uint32_t>(value.size());
+    memcpy(version + 1, value.data(), value.size());
+    return version;
+}
+
+int SkipList::random_height()
+{
+    static thread_local std::minstd_rand rng(std::random_device{}());
+    int height = 1;
+    while (height < MAX_HEIGHT && rng() % BRANCHING == 0)
+    {
+        ++height;
+    }
+    return height;
+}
+
+/**
+ * @brief Finds the first node whose key is not less than key.
+ * @param prev If not null, receives the last node before that position on every level below
+ * the list's current height.
+ */
+SkipList::Node *SkipList::find_greater_or_equal(std::string_view key, Node **prev) const
+{
+    Node *node = _head;
+    int level = _max_height.load(std::memory_order_acquire) - 1;
+    while (true)
+    {
+        Node *next = node->load_next(level);
+        if (next && next->key() < key)
+        {
+            node = next; // Keep moving right on this level
+            continue;
+        }
+        if (prev)
+        {
+            prev[level] = node;
+        }
+        if (level == 0)
+        {
+            return next;
+        }
+        --level;
+    }
+}
+
+// Returns the last node, or nullptr if the list is empty.
+SkipList::Node *SkipList::find_last() const
+{
+    Node *node = _head;
+    for (int level = _max_height.load(std::memory_order_acquire) - 1; level >= 0; --level)
+    {
+        while (Node *next = node->load_next(level))
+        {
+            node = next;
+        }
+    }
+    return node == _head ? nullptr : node;
+}
+
+// Publishes a new version of a node's value; the replaced one stays readable.
+void SkipList::set_value(Node *node, std::string_view value)
+{
+    Version *version = new_version(value);
+    Version *current = node->value.load(std::memory_order_acquire);
+    do
+    {
+        version->older = current;
+    } while (!node->value.compare_exchange_weak(current, version, std::memory_order_acq_rel,
+                                                std::memory_order_acquire));
+    // Unsigned wrap-around turns this into a subtraction when the value shrinks
+    _data_bytes.fetch_add(value.size() - current->size, std::memory_order_relaxed);
+}
+
+bool SkipList::put(std::string_view key, std::string_view value)
+{
+    int height = random_height();
+    int max_height = _max_height.load(std::memory_order_relaxed);
+    while (height > max_height &&
+           !_max_height.compare_exchange_weak(max_height, height, std::memory_order_acq_rel))
+    {
+    }
+
+    // The search starts at least as high as the new tower, so prev covers all of its levels
+    Node *prev[MAX_HEIGHT];
+    Node *next = find_greater_or_equal(key, prev);
+    if (next && next->key() == key)
+    {
+        set_value(next, value);
+        return false;
+    }
+
+    Node *node = new_node(key, height);
+    node->value.store(new_version(value), std::memory_order_relaxed);
+    for (int level = 0; level < height; ++level)
+    {
+        while (true)
+        {
+            // Another writer may have linked a node in here since the search; step past it
+            Node *after = prev[level]->load_next(level);
+            while (after && after->key() < key)
+            {
+                prev[level] = after;
+                after = after->load_next(level);
+            }
+            if (level == 0 && after && after->key() == key)
+            {
+                // Lost a race to insert the same key; the level-0 link decides which node wins.
+                // The unlinked node stays in the arena until clear()
+                set_value(after, value);
+                return false;
+            }
+            node->next[level].store(after, std::memory_order_relaxed);
+            if (prev[level]->next[level].compare_exchange_strong(after, node, std::memory_order_release,
+                                                                 std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+    }
+    _size.fetch_add(1, std::memory_order_relaxed);
+    _data_bytes.fetch_add(key.size() + value.size(), std::memory_order_relaxed);
+    return true;
+}
+
+bool SkipList::get(std::string_view key, std::string &value) const
+{
+    Node *node = find_greater_or_equal(key, nullptr);
+    if (node && node->key() == key)
+    {
+        std::string_view current = node->value.load(std::memory_order_acquire)->view();
+        value.assign(current.data(), current.size());
+        return true;
+    }
+    return false;
+}
+
+void SkipList::clear()
+{
+    _arena.reset();
+    _head = new_node("", MAX_HEIGHT);
+    _max_height.store(1, std::memory_order_relaxed);
+    _size.store(0, std::memory_order_relaxed);
+    _data_bytes.store(0, std::memory_order_relaxed);
+}
@@ -0,0 +1,163 @@
+#ifndef SKIPLIST_H
+#define SKIPLIST_H
+
+#include "arena.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief An ordered map from string keys to string values that many threads can insert into
+ * and read from at once without taking a lock, as in the LevelDB/RocksDB memtable.
+ * A node is linked in bottom-up with one compare-and-swap per level, so readers always see a
+ * consistent list. Putting an existing key swaps in a new value version; older versions and
+ * nodes stay allocated until clear(), so a reader never touches freed memory.
+ * Nodes, keys and value versions are all carved out of one Arena, so a put costs no malloc
+ * in the common case and clear() frees whole blocks instead of every entry.
+ */
+class SkipList
+{
+public:
+    /**
+     * @brief Tallest tower a node can have; with a branching factor of 4 this covers
+     * millions of keys.
+     */
+    static const int MAX_HEIGHT = 12;
+
+    SkipList();
+
+    SkipList(const SkipList &) = delete;
+    SkipList &operator=(const SkipList &) = delete;
+
+    /**
+     * @brief Inserts a key or replaces its value. Safe to call from several threads at once.
+     * @return True if the key was new.
+     */
+    bool put(std::string_view key, std::string_view value);
+
+    /**
+     * @brief Looks a key up. Safe to call while other threads put.
+     * @param key The key to look up.
+     * @param value Receives the newest value of the key, if found.
+     * @return True if the key is present.
+     */
+    bool get(std::string_view key, std::string &value) const;
+
+    /**
+     * @brief Returns the number of distinct keys.
+     */
+    size_t size() const { return _size.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Checks whether the list holds no keys.
+     */
+    bool empty() const { return size() == 0; }
+
+    /**
+     * @brief Returns the total length of every key and its newest value, kept up to date by
+     * put() rather than computed by a walk. Replaced versions are left out; memory_usage()
+     * counts them.
+     */
+    size_t data_bytes() const { return _data_bytes.load(std::memory_order_relaxed); }
+
+    /**
+     * @brief Returns the memory held by the list: the arena blocks behind its nodes, keys and
+     * every value version, including allocator and tower overhead.
+     */
+    size_t memory_usage() const { return _arena.memory_usage(); }
+
+    /**
+     * @brief Removes every key and releases the arena's blocks.
+     * Not safe while other threads use the list.
+     */
+    void clear();
+
+private:
+    // A value, with its bytes stored right after the struct
+    struct Version
+    {
+        Version *older; // Replaced versions are kept until clear()
+        uint32_t size;
+        std::string_view view() const { return {reinterpret_cast<const char *>(this + 1), size}; }
+    };
+
+    // A key and its tower; the key bytes follow the last next pointer
+    struct Node
+    {
+        std::atomic<Version *> value;
+        uint32_t key_size;
+        int height;
+        std::atomic<Node *> next[1]; // Really `height` entries long
+
+        std::string_view key() const { return {reinterpret_cast<const char *>(&next[height]), key_size}; }
+        Node *load_next(int level) const { return next[level].load(std::memory_order_acquire); }
+    };
+
+public:
+    /**
+     * @brief Walks the keys in order. Safe to use while other threads put; keys inserted
+     * after the iterator passed their position are not seen.
+     */
+    class Iterator
+    {
+    public:
+        explicit Iterator(const SkipList *list) : _list(list), _node(nullptr) {}
+
+        /**
+         * @brief Checks whether the iterator is positioned at a key.
+         */
+        bool valid() const { return _node != nullptr; }
+
+        /**
+         * @brief Returns the current key; the iterator must be valid.
+         */
+        std::string_view key() const { return _node->key(); }
+
+        /**
+         * @brief Returns the newest value of the current key; the iterator must be valid.
+         */
+        std::string_view value() const { return _node->value.load(std::memory_order_acquire)->view(); }
+
+        /**
+         * @brief Moves to the next key.
+         */
+        void next() { _node = _node->load_next(0); }
+
+        /**
+         * @brief Moves to the first key.
+         */
+        void seek_to_first() { _node = _list->_head->load_next(0); }
+
+        /**
+         * @brief Moves to the last key.
+         */
+        void seek_to_last() { _node = _list->find_last(); }
+
+        /**
+         * @brief Moves to the first key at or after target.
+         */
+        void seek(std::string_view target) { _node = _list->find_greater_or_equal(target, nullptr); }
+
+    private:
+        const SkipList *_list;
+        const Node *_node;
+    };
+
+private:
+    Node *new_node(std::string_view key, int height);
+    Version *new_version(std::string_view value);
+    static int random_height();
+    Node *find_greater_or_equal(std::string_view key, Node **prev) const;
+    Node *find_last() const;
+    void set_value(Node *node, std::string_view value);
+
+    Arena _arena;
+    Node *_head;
+    std::atomic<int> _max_height{1}; // Levels above this only hold nullptr
+    std::atomic<size_t> _size{0};
+    std::atomic<size_t> _data_bytes{0};
+};
+
+#endif // SKIPLIST_H
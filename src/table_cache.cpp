@@ -0,0 +1,56 @@
+#include "table_cache.h"
+
+std::shared_ptr<SSTable> TableCache::get(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(path);
+    if (it != _index.end())
+    {
+        _lru.splice(_lru.begin(), _lru, it->second);
+        _hits.fetch_add(1, std::memory_order_relaxed);
+        return it->second->second;
+    }
+    _misses.fetch_add(1, std::memory_order_relaxed);
+    // Opening is cheap: the index and filter are read by the first lookup, outside this lock
+    auto table = std::make_shared<SSTable>(path);
+    if (_capacity > 0)
+    {
+        _lru.emplace_front(path, table);
+        _index.emplace(path, _lru.begin());
+        trim();
+    }
+    return table;
+}
+
+void TableCache::evict(const std::string &path)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _index.find(path);
+    if (it != _index.end())
+    {
+        _lru.erase(it->second);
+        _index.erase(it);
+    }
+}
+
+void TableCache::set_capacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _capacity = capacity;
+    trim();
+}
+
+size_t TableCache::size()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _lru.size();
+}
+
+void TableCache::trim()
+{
+    while (_lru.size() > _capacity)
+    {
+        _index.erase(_lru.back().first);
+        _lru.pop_back();
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef TABLE_CACHE_H
+#define TABLE_CACHE_H
+
+#include "database.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * @brief Keeps a bounded set of SSTable readers open, so their index and Bloom filter are
+ * loaded once and stay resident instead of being read again by every lookup. Readers are
+ * evicted least recently used first. They are handed out as shared pointers, so a reader
+ * evicted or dropped while a lookup still uses it is only closed when that lookup is done.
+ */
+class TableCache
+{
+public:
+    /**
+     * @brief Default number of readers kept open.
+     */
+    static const size_t DEFAULT_CAPACITY = 1000;
+
+    explicit TableCache(size_t capacity = DEFAULT_CAPACITY) : _capacity(capacity) {}
+
+    TableCache(const TableCache &) = delete;
+    TableCache &operator=(const TableCache &) = delete;
+
+    /**
+     * @brief Returns the reader of a table, opening it if it is not cached. Its index is
+     * loaded by its first lookup.
+     * @param path The path of the table file.
+     */
+    std::shared_ptr<SSTable> get(const std::string &path);
+
+    /**
+     * @brief Drops the reader of a table; must be called before its file is deleted or
+     * replaced, since a cached reader would keep serving the old file.
+     */
+    void evict(const std::string &path);
+
+    /**
+     * @brief Changes how many readers are kept open, closing the least recently used ones
+     * if it shrinks. 0 opens a new reader for every call to get().
+     */
+    void set_capacity(size_t capacity);
+
+    /**
+     * @brief Returns the number of open readers in the cache.
+     */
+    size_t size();
+
+    uint64_t hits() const { return _hits.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return _misses.load(std::memory_order_relaxed); }
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<SSTable>>;
+
+    // Closes least recently used readers until the cache fits; _mutex must be held.
+    void trim();
+
+    std::mutex _mutex;
+    // Most recently used first
+    std::list<Entry> _lru;
+    std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+    size_t _capacity;
+    std::atomic<uint64_t> _hits{0};
+    std::atomic<uint64_t> _misses{0};
+};
+
+#endif // TABLE_CACHE_H
@@ -0,0 +1,293 @@
+#include "uring.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#ifdef VRDB_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#endif
+
+// The ring installed for the current thread, used by storage reads.
+static thread_local IoRing *current_ring = nullptr;
+
+IoRing *IoRing::current()
+{
+    return current_ring;
+}
+
+void IoRing::set_current(IoRing *ring)
+{
+    current_ring = ring;
+}
+
+#ifdef VRDB_HAVE_IO_URING
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+bool IoRing::init(unsigned entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    _ring_fd = io_uring_setup(entries, &params);
+    if (_ring_fd < 0)
+    {
+        _ring_fd = -1;
+        return false;
+    }
+
+    _sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        _sq_map_size = _cq_map_size = std::max(_sq_map_size, _cq_map_size);
+    }
+
+    _sq_ptr = mmap(nullptr, _sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+    if (_sq_ptr == MAP_FAILED)
+    {
+        _sq_ptr = nullptr;
+        release();
+        return false;
+    }
+    _cq_ptr = single_mmap ? _sq_ptr : mmap(nullptr, _cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+    _sqes_map_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, _sqes_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+    if (_cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        if (_cq_ptr == MAP_FAILED)
+        {
+            _cq_ptr = nullptr;
+        }
+        if (sqes != MAP_FAILED)
+        {
+            munmap(sqes, _sqes_map_size);
+        }
+        release();
+        return false;
+    }
+    _sqes = static_cast<struct io_uring_sqe *>(sqes);
+
+    char *sq = static_cast<char *>(_sq_ptr);
+    _sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    _sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    _sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    _sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    _sq_entries = params.sq_entries;
+    _sq_local_tail = *_sq_tail;
+
+    char *cq = static_cast<char *>(_cq_ptr);
+    _cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    _cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    _cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+    return true;
+}
+
+IoRing::~IoRing()
+{
+    release();
+    if (current_ring == this)
+    {
+        current_ring = nullptr;
+    }
+}
+
+// Unmaps the queues and closes the ring; the kernel cancels anything still in flight.
+void IoRing::release()
+{
+    if (_sqes)
+    {
+        munmap(_sqes, _sqes_map_size);
+        _sqes = nullptr;
+    }
+    if (_cq_ptr && _cq_ptr != _sq_ptr)
+    {
+        munmap(_cq_ptr, _cq_map_size);
+    }
+    _cq_ptr = nullptr;
+    if (_sq_ptr)
+    {
+        munmap(_sq_ptr, _sq_map_size);
+        _sq_ptr = nullptr;
+    }
+    if (_ring_fd != -1)
+    {
+        close(_ring_fd);
+        _ring_fd = -1;
+    }
+}
+
+bool IoRing::supported()
+{
+    static const bool probed = []()
+    {
+        IoRing probe;
+        return probe.init(2);
+    }();
+    return probed;
+}
+
+// Returns a zeroed submission slot, flushing queued operations first if the queue is full.
+struct io_uring_sqe *IoRing::get_sqe()
+{
+    // Without SQPOLL the kernel consumes every submitted entry inside io_uring_enter,
+    // so one submit always frees the queue.
+    while (_sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries)
+    {
+        submit();
+    }
+    unsigned index = _sq_local_tail & *_sq_mask;
+    struct io_uring_sqe *sqe = &_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    _sq_array[index] = index;
+    ++_sq_local_tail;
+    ++_to_submit;
+    return sqe;
+}
+
+void IoRing::prep_accept(int fd, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data;
+}
+
+void IoRing::prep_recv(int fd, void *buf, size_t len, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->user_data = user_data;
+}
+
+void IoRing::prep_send(int fd, const void *buf, size_t len, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = user_data;
+}
+
+void IoRing::prep_poll(int fd, unsigned poll_mask, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll_events = static_cast<uint16_t>(poll_mask);
+    sqe->user_data = user_data;
+}
+
+void IoRing::prep_read(int fd, void *buf, size_t len, uint64_t offset, uint64_t user_data)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = static_cast<uint32_t>(len);
+    sqe->off = offset;
+    sqe->user_data = user_data;
+}
+
+int IoRing::submit(unsigned wait_nr)
+{
+    __atomic_store_n(_sq_tail, _sq_local_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = _to_submit;
+    int ret = io_uring_enter(_ring_fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+    if (ret < 0)
+    {
+        return -errno;
+    }
+    _to_submit -= std::min(_to_submit, static_cast<unsigned>(ret));
+    return ret;
+}
+
+bool IoRing::pop_ring(IoCompletion &out)
+{
+    unsigned head = *_cq_head;
+    if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+    {
+        return false;
+    }
+    const struct io_uring_cqe &cqe = _cqes[head & *_cq_mask];
+    out.user_data = cqe.user_data;
+    out.res = cqe.res;
+    __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool IoRing::pop(IoCompletion &out)
+{
+    if (!_deferred.empty())
+    {
+        out = _deferred.front();
+        _deferred.erase(_deferred.begin());
+        return true;
+    }
+    return pop_ring(out);
+}
+
+ssize_t IoRing::read_sync(int fd, void *buf, size_t len, uint64_t offset)
+{
+    prep_read(fd, buf, len, offset, SYNC_READ_TAG);
+    while (true)
+    {
+        int ret = submit(1);
+        if (ret < 0 && ret != -EINTR)
+        {
+            return ret;
+        }
+        IoCompletion completion;
+        while (pop_ring(completion))
+        {
+            if (completion.user_data == SYNC_READ_TAG)
+            {
+                return completion.res;
+            }
+            _deferred.push_back(completion);
+        }
+    }
+}
+
+#else // !VRDB_HAVE_IO_URING
+
+bool IoRing::init(unsigned) { return false; }
+void IoRing::release() {}
+IoRing::~IoRing()
+{
+    if (current_ring == this)
+    {
+        current_ring = nullptr;
+    }
+}
+bool IoRing::supported() { return false; }
+void IoRing::prep_accept(int, uint64_t) {}
+void IoRing::prep_recv(int, void *, size_t, uint64_t) {}
+void IoRing::prep_send(int, const void *, size_t, uint64_t) {}
+void IoRing::prep_poll(int, unsigned, uint64_t) {}
+void IoRing::prep_read(int, void *, size_t, uint64_t, uint64_t) {}
+int IoRing::submit(unsigned) { return -ENOSYS; }
+bool IoRing::pop(IoCompletion &) { return false; }
+ssize_t IoRing::read_sync(int, void *, size_t, uint64_t) { return -ENOSYS; }
+
+#endif // VRDB_HAVE_IO_URING
@@ -0,0 +1,131 @@
+#ifndef URING_H
+#define URING_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <sys/types.h>
+
+// io_uring is used through raw syscalls, so no liburing is needed. Builds without the
+// kernel header (or with -DVRDB_NO_IO_URING) get a stub whose init() always fails,
+// and callers fall back to epoll and blocking reads.
+#if !defined(VRDB_NO_IO_URING) && defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define VRDB_HAVE_IO_URING 1
+#endif
+
+// Kernel ABI structs, defined in <linux/io_uring.h>; only uring.cpp includes it because
+// the kernel headers define macros such as BLOCK_SIZE that clash with ordinary names.
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/**
+ * @brief A completion taken off the ring: the user_data of its submission and its result.
+ */
+struct IoCompletion
+{
+    uint64_t user_data;
+    int32_t res;
+};
+
+/**
+ * @brief A minimal io_uring submission/completion ring owned by one thread.
+ * Submissions are batched until submit() is called, and completions are reaped
+ * from shared memory without a syscall. A ring can be installed as the current
+ * thread's ring so that storage code deeper in the call stack (SSTable block reads)
+ * goes through the same ring as the network.
+ */
+class IoRing
+{
+public:
+    /**
+     * @brief user_data reserved for reads issued through read_sync().
+     */
+    static const uint64_t SYNC_READ_TAG = ~0ULL;
+
+    IoRing() = default;
+    ~IoRing();
+    IoRing(const IoRing &) = delete;
+    IoRing &operator=(const IoRing &) = delete;
+
+    /**
+     * @brief Creates the ring and maps its queues.
+     * @param entries The submission queue size, rounded up to a power of two by the kernel.
+     * @return False if io_uring is not compiled in or the kernel refuses to create a ring.
+     */
+    bool init(unsigned entries);
+
+    /**
+     * @brief Returns whether io_uring is usable in this build and on this kernel.
+     * The result of the first probe is cached.
+     */
+    static bool supported();
+
+    // Queue operations; they reach the kernel on the next submit()
+    void prep_accept(int fd, uint64_t user_data);
+    void prep_recv(int fd, void *buf, size_t len, uint64_t user_data);
+    void prep_send(int fd, const void *buf, size_t len, uint64_t user_data);
+    void prep_poll(int fd, unsigned poll_mask, uint64_t user_data);
+    void prep_read(int fd, void *buf, size_t len, uint64_t offset, uint64_t user_data);
+
+    /**
+     * @brief Hands all queued operations to the kernel in one io_uring_enter call.
+     * @param wait_nr Number of completions to wait for before returning.
+     * @return The number of submitted operations, or -errno (-EINTR when a signal arrives).
+     */
+    int submit(unsigned wait_nr = 0);
+
+    /**
+     * @brief Takes the next completion, if any, without blocking.
+     * Completions set aside by read_sync() are returned first.
+     */
+    bool pop(IoCompletion &out);
+
+    /**
+     * @brief Reads through the ring and waits for that read only.
+     * Other completions that arrive meanwhile are kept for pop().
+     * @return Bytes read, or -errno.
+     */
+    ssize_t read_sync(int fd, void *buf, size_t len, uint64_t offset);
+
+    /**
+     * @brief Returns the ring installed for the calling thread, or nullptr.
+     */
+    static IoRing *current();
+
+    /**
+     * @brief Installs (or with nullptr, removes) the calling thread's ring.
+     */
+    static void set_current(IoRing *ring);
+
+private:
+    void release();
+
+    int _ring_fd = -1;
+#ifdef VRDB_HAVE_IO_URING
+    void *_sq_ptr = nullptr;
+    void *_cq_ptr = nullptr;
+    size_t _sq_map_size = 0;
+    size_t _cq_map_size = 0;
+    struct io_uring_sqe *_sqes = nullptr;
+    size_t _sqes_map_size = 0;
+
+    unsigned *_sq_head = nullptr;
+    unsigned *_sq_tail = nullptr;
+    unsigned *_sq_mask = nullptr;
+    unsigned *_sq_array = nullptr;
+    unsigned _sq_entries = 0;
+    unsigned _sq_local_tail = 0; // Tail including operations not yet published to the kernel
+    unsigned _to_submit = 0;
+
+    unsigned *_cq_head = nullptr;
+    unsigned *_cq_tail = nullptr;
+    unsigned *_cq_mask = nullptr;
+    struct io_uring_cqe *_cqes = nullptr;
+
+    struct io_uring_sqe *get_sqe();
+    bool pop_ring(IoCompletion &out);
+#endif
+    std::vector<IoCompletion> _deferred; // Completions reaped by read_sync() for someone else
+};
+
+#endif // URING_H
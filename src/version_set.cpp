@@ -0,0 +1,588 @@
+#include "version_set.h"
+#include "database.h"
+#include "wal.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <unordered_set>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+const char *const VersionSet::MANIFEST = "MANIFEST";
+
+// Encoding helpers for the MANIFEST; integers are little-endian.
+static void put_uint32(std::string &out, uint32_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void put_uint64(std::string &out, uint64_t value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void put_string(std::string &out, std::string_view value)
+{
+    put_uint32(out, static_cast<uint32_t>(value.size()));
+    out.append(value);
+}
+
+// Each getter advances pos and returns false if the field runs past the end of data.
+static bool get_uint32(std::string_view data, size_t &pos, uint32_t &value)
+{
+    if (data.size() - pos < sizeof(value))
+    {
+        return false;
+    }
+    memcpy(&value, data.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+static bool get_uint64(std::string_view data, size_t &pos, uint64_t &value)
+{
+    if (data.size() - pos < sizeof(value))
+    {
+        return false;
+    }
+    memcpy(&value, data.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+}
+
+static bool get_string(std::string_view data, size_t &pos, std::string &value)
+{
+    uint32_t size;
+    if (!get_uint32(data, pos, size) || data.size() - pos < size)
+    {
+        return false;
+    }
+    value.assign(data.data() + pos, size);
+    pos += size;
+    return true;
+}
+
+static bool get_level(std::string_view data, size_t &pos, int &level)
+{
+    if (pos >= data.size() || static_cast<unsigned char>(data[pos]) >= VersionSet::NUM_LEVELS)
+    {
+        return false;
+    }
+    level = static_cast<unsigned char>(data[pos++]);
+    return true;
+}
+
+// Checks whether two key ranges share a key.
+static bool overlaps(const TableFile &file, const std::string &smallest, const std::string &largest)
+{
+    return file.largest >= smallest && file.smallest <= largest;
+}
+
+// Writes a whole buffer, retrying short writes.
+static bool write_all(int fd, const std::string &data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+VersionSet::VersionSet(const std::string &directory) : _directory(directory)
+{
+}
+
+VersionSet::~VersionSet()
+{
+    if (_manifest_fd >= 0)
+    {
+        ::close(_manifest_fd);
+    }
+}
+
+void VersionSet::encode(std::string &out, const VersionEdit &edit)
+{
+    std::string removed;
+    for (const auto &entry : edit.removed)
+    {
+        removed.push_back(static_cast<char>(entry.first));
+        put_string(removed, entry.second);
+    }
+    std::string added;
+    for (const auto &entry : edit.added)
+    {
+        added.push_back(static_cast<char>(entry.first));
+        put_string(added, entry.second.name);
+        put_uint64(added, entry.second.size);
+        put_string(added, entry.second.smallest);
+        put_string(added, entry.second.largest);
+    }
+    std::string pointers;
+    for (const auto &entry : edit.compact_pointers)
+    {
+        pointers.push_back(static_cast<char>(entry.first));
+        put_string(pointers, entry.second);
+    }
+    std::string value;
+    put_string(value, added);
+    put_string(value, pointers);
+    WriteAheadLog::encode(out, removed, value);
+}
+
+bool VersionSet::decode(std::string_view removed, std::string_view value, VersionEdit &edit)
+{
+    size_t pos = 0;
+    while (pos < removed.size())
+    {
+        std::pair<int, std::string> entry;
+        if (!get_level(removed, pos, entry.first) || !get_string(removed, pos, entry.second))
+        {
+            return false;
+        }
+        edit.removed.push_back(std::move(entry));
+    }
+    std::string added;
+    std::string pointers;
+    pos = 0;
+    if (!get_string(value, pos, added) || !get_string(value, pos, pointers) || pos != value.size())
+    {
+        return false;
+    }
+    pos = 0;
+    while (pos < added.size())
+    {
+        std::pair<int, TableFile> entry;
+        if (!get_level(added, pos, entry.first) || !get_string(added, pos, entry.second.name) ||
+            !get_uint64(added, pos, entry.second.size) || !get_string(added, pos, entry.second.smallest) ||
+            !get_string(added, pos, entry.second.largest))
+        {
+            return false;
+        }
+        edit.added.push_back(std::move(entry));
+    }
+    pos = 0;
+    while (pos < pointers.size())
+    {
+        std::pair<int, std::string> entry;
+        if (!get_level(pointers, pos, entry.first) || !get_string(pointers, pos, entry.second))
+        {
+            return false;
+        }
+        edit.compact_pointers.push_back(std::move(entry));
+    }
+    return true;
+}
+
+bool VersionSet::load_manifest()
+{
+    std::ifstream in(_directory + MANIFEST, std::ios::binary);
+    if (!in.is_open())
+    {
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+    std::string_view removed;
+    std::string_view value;
+    while (pos < data.size())
+    {
+        VersionEdit edit;
+        size_t start = pos;
+        if (!WriteAheadLog::decode(data, pos, removed, value) || !decode(removed, value, edit))
+        {
+            // Only the edit being appended when the process stopped can be incomplete
+            std::cerr << "MANIFEST " << _directory << MANIFEST << ": ignoring torn or corrupt tail at offset " << start << std::endl;
+            break;
+        }
+        apply_in_memory(edit);
+    }
+    return true;
+}
+
+bool VersionSet::describe(const std::string &name, TableFile &file) const
+{
+    SSTable table(_directory + name);
+    SSTable::Iterator it(table);
+    if (!it.valid())
+    {
+        return false;
+    }
+    file.name = name;
+    file.smallest = it.key();
+    for (; it.valid(); it.next())
+    {
+        file.largest = it.key();
+    }
+    std::error_code ec;
+    file.size = fs::file_size(_directory + name, ec);
+    return it.ok() && !ec;
+}
+
+void VersionSet::adopt(const std::vector<std::string> &files)
+{
+    for (const std::string &name : files)
+    {
+        TableFile file;
+        if (describe(name, file))
+        {
+            _levels[0].push_back(std::move(file));
+        }
+        else
+        {
+            std::cerr << "Leaving out SSTable " << name << ", which is empty or unreadable." << std::endl;
+        }
+    }
+}
+
+bool VersionSet::open(const std::vector<std::string> &files)
+{
+    if (load_manifest())
+    {
+        std::unordered_set<std::string> listed;
+        for (const auto &level : _levels)
+        {
+            for (const TableFile &file : level)
+            {
+                listed.insert(file.name);
+            }
+        }
+        std::unordered_set<std::string> present(files.begin(), files.end());
+        for (const std::string &name : files)
+        {
+            if (!listed.count(name))
+            {
+                std::cerr << "Removing SSTable " << name << ", which the MANIFEST does not list." << std::endl;
+                std::error_code ec;
+                fs::remove(_directory + name, ec);
+            }
+        }
+        VersionEdit missing;
+        for (int level = 0; level < NUM_LEVELS; ++level)
+        {
+            for (const TableFile &file : _levels[level])
+            {
+                if (!present.count(file.name))
+                {
+                    std::cerr << "Error: SSTable " << file.name << " listed in the MANIFEST is missing." << std::endl;
+                    missing.removed.emplace_back(level, file.name);
+                }
+            }
+        }
+        apply_in_memory(missing);
+    }
+    else
+    {
+        adopt(files);
+    }
+    return rewrite_manifest();
+}
+
+bool VersionSet::rewrite_manifest()
+{
+    VersionEdit snapshot;
+    for (int level = 0; level < NUM_LEVELS; ++level)
+    {
+        for (const TableFile &file : _levels[level])
+        {
+            snapshot.added.emplace_back(level, file);
+        }
+    }
+    for (int level = 0; level < NUM_LEVELS; ++level)
+    {
+        if (!_compact_pointer[level].empty())
+        {
+            snapshot.compact_pointers.emplace_back(level, _compact_pointer[level]);
+        }
+    }
+    std::string record;
+    encode(record, snapshot);
+
+    std::error_code ec;
+    if (!_directory.empty())
+    {
+        fs::create_directories(_directory, ec);
+    }
+    // Written aside and renamed over the old one, so a crash leaves either MANIFEST whole
+    std::string path = _directory + MANIFEST;
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Error: Could not create " << temporary << " (errno: " << errno << ")" << std::endl;
+        return false;
+    }
+    if (!write_all(fd, record) || fdatasync(fd) != 0 || ::rename(temporary.c_str(), path.c_str()) != 0 ||
+        !WriteAheadLog::sync_file(_directory.empty() ? "." : _directory))
+    {
+        std::cerr << "Error: Could not write " << path << " (errno: " << errno << ")" << std::endl;
+        ::close(fd);
+        ::unlink(temporary.c_str());
+        return false;
+    }
+    if (_manifest_fd >= 0)
+    {
+        ::close(_manifest_fd);
+    }
+    _manifest_fd = fd; // Still positioned at the end, where later edits go
+    return true;
+}
+
+bool VersionSet::apply(const VersionEdit &edit)
+{
+    if (_manifest_fd < 0)
+    {
+        return false;
+    }
+    std::string record;
+    encode(record, edit);
+    off_t end = lseek(_manifest_fd, 0, SEEK_CUR);
+    if (!write_all(_manifest_fd, record) || fdatasync(_manifest_fd) != 0)
+    {
+        std::cerr << "Error: Could not log an edit to " << _directory << MANIFEST << " (errno: " << errno << ")" << std::endl;
+        // Drop the partial record, so later edits are not appended behind it
+        if (end < 0 || ftruncate(_manifest_fd, end) != 0 || lseek(_manifest_fd, end, SEEK_SET) < 0)
+        {
+            ::close(_manifest_fd);
+            _manifest_fd = -1;
+        }
+        return false;
+    }
+    apply_in_memory(edit);
+    return true;
+}
+
+void VersionSet::apply_in_memory(const VersionEdit &edit)
+{
+    for (const auto &entry : edit.removed)
+    {
+        std::vector<TableFile> &files = _levels[entry.first];
+        files.erase(std::remove_if(files.begin(), files.end(), [&entry](const TableFile &file)
+                                   { return file.name == entry.second; }),
+                    files.end());
+    }
+    for (const auto &entry : edit.added)
+    {
+        insert(entry.first, entry.second);
+    }
+    for (const auto &entry : edit.compact_pointers)
+    {
+        _compact_pointer[entry.first] = entry.second;
+    }
+}
+
+void VersionSet::insert(int level, const TableFile &file)
+{
+    std::vector<TableFile> &files = _levels[level];
+    if (level == 0)
+    {
+        files.push_back(file); // Level 0 is ordered by age, and every new table is the newest
+        return;
+    }
+    auto at = std::upper_bound(files.begin(), files.end(), file, [](const TableFile &a, const TableFile &b)
+                               { return a.smallest < b.smallest; });
+    files.insert(at, file);
+}
+
+std::vector<std::string> VersionSet::tables() const
+{
+    std::vector<std::string> names;
+    names.reserve(table_count());
+    for (auto it = _levels[0].rbegin(); it != _levels[0].rend(); ++it)
+    {
+        names.push_back(it->name);
+    }
+    for (int level = 1; level < NUM_LEVELS; ++level)
+    {
+        for (const TableFile &file : _levels[level])
+        {
+            names.push_back(file.name);
+        }
+    }
+    return names;
+}
+
+size_t VersionSet::table_count() const
+{
+    size_t count = 0;
+    for (const auto &level : _levels)
+    {
+        count += level.size();
+    }
+    return count;
+}
+
+uint64_t VersionSet::level_bytes(int level) const
+{
+    uint64_t bytes = 0;
+    for (const TableFile &file : _levels[level])
+    {
+        bytes += file.size;
+    }
+    return bytes;
+}
+
+uint64_t VersionSet::max_bytes(int level) const
+{
+    uint64_t bytes = level1_bytes;
+    for (int i = 1; i < level; ++i)
+    {
+        bytes *= level_multiplier;
+    }
+    return bytes;
+}
+
+size_t VersionSet::find(int level, std::string_view key) const
+{
+    const std::vector<TableFile> &files = _levels[level];
+    // The first table whose last key is not before the key; only it can hold the key
+    auto it = std::lower_bound(files.begin(), files.end(), key, [](const TableFile &file, std::string_view key)
+                               { return file.largest < key; });
+    if (it == files.end() || key < it->smallest)
+    {
+        return files.size();
+    }
+    return it - files.begin();
+}
+
+double VersionSet::score(int level) const
+{
+    if (level == NUM_LEVELS - 1)
+    {
+        return 0;
+    }
+    if (level == 0)
+    {
+        // Counted in tables rather than bytes, since every lookup checks every level 0 table
+        return static_cast<double>(_levels[0].size()) / std::max<size_t>(l0_compaction_trigger, 1);
+    }
+    return static_cast<double>(level_bytes(level)) / max_bytes(level);
+}
+
+void VersionSet::overlapping(int level, const std::string &smallest, const std::string &largest,
+                             std::vector<std::pair<int, TableFile>> &inputs) const
+{
+    for (const TableFile &file : _levels[level])
+    {
+        if (overlaps(file, smallest, largest))
+        {
+            inputs.emplace_back(level, file);
+        }
+    }
+}
+
+int VersionSet::neediest_level() const
+{
+    int level = 0;
+    for (int i = 1; i < NUM_LEVELS; ++i)
+    {
+        if (score(i) > score(level))
+        {
+            level = i;
+        }
+    }
+    return score(level) >= 1 && !_levels[level].empty() ? level : -1;
+}
+
+bool VersionSet::needs_compaction() const
+{
+    return neediest_level() >= 0;
+}
+
+bool VersionSet::pick_compaction(Compaction &compaction)
+{
+    int level = neediest_level();
+    if (level < 0)
+    {
+        return false;
+    }
+
+    std::vector<std::pair<int, TableFile>> inputs;
+    std::vector<std::pair<int, std::string>> pointers;
+    std::string smallest;
+    std::string largest;
+    if (level == 0)
+    {
+        // Start from the oldest table and take every table that overlaps the growing range.
+        // A newer version of a key never sinks below an older one left behind in level 0
+        std::vector<bool> taken(_levels[0].size(), false);
+        taken[0] = true;
+        smallest = _levels[0][0].smallest;
+        largest = _levels[0][0].largest;
+        for (bool grew = true; grew;)
+        {
+            grew = false;
+            for (size_t i = 0; i < _levels[0].size(); ++i)
+            {
+                if (!taken[i] && overlaps(_levels[0][i], smallest, largest))
+                {
+                    taken[i] = true;
+                    grew = true;
+                    smallest = std::min(smallest, _levels[0][i].smallest);
+                    largest = std::max(largest, _levels[0][i].largest);
+                }
+            }
+        }
+        for (size_t i = 0; i < _levels[0].size(); ++i)
+        {
+            if (taken[i])
+            {
+                inputs.emplace_back(0, _levels[0][i]);
+            }
+        }
+    }
+    else
+    {
+        // Take the table after the one compacted last, so every key range gets its turn
+        const std::vector<TableFile> &files = _levels[level];
+        auto it = std::find_if(files.begin(), files.end(), [this, level](const TableFile &file)
+                               { return _compact_pointer[level] < file.largest; });
+        const TableFile &file = it == files.end() ? files.front() : *it;
+        pointers.emplace_back(level, file.largest);
+        smallest = file.smallest;
+        largest = file.largest;
+        inputs.emplace_back(level, file);
+    }
+
+    // The tables of the next level are older than the inputs above them
+    compaction.level = level + 1;
+    compaction.inputs.clear();
+    overlapping(level + 1, smallest, largest, compaction.inputs);
+    compaction.inputs.insert(compaction.inputs.end(), inputs.begin(), inputs.end());
+    compaction.compact_pointers = std::move(pointers);
+    return true;
+}
+
+Compaction VersionSet::full_compaction() const
+{
+    Compaction compaction;
+    compaction.level = 1;
+    // Deeper levels hold older data, so the inputs go from the deepest level up
+    for (int level = NUM_LEVELS - 1; level >= 0; --level)
+    {
+        if (level > 0 && !_levels[level].empty() && compaction.inputs.empty())
+        {
+            compaction.level = level;
+        }
+        for (const TableFile &file : _levels[level])
+        {
+            compaction.inputs.emplace_back(level, file);
+        }
+    }
+    return compaction;
+}
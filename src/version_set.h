@@ -0,0 +1,202 @@
+#ifndef VERSION_SET_H
+#define VERSION_SET_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief An SSTable file as the version set knows it: its name and the range of its keys.
+ */
+struct TableFile
+{
+    std::string name;     // Relative to the storage's directory
+    uint64_t size = 0;    // Bytes on disk
+    std::string smallest; // First key
+    std::string largest;  // Last key
+};
+
+/**
+ * @brief A change to the set of live tables, applied and logged as a whole.
+ */
+struct VersionEdit
+{
+    std::vector<std::pair<int, std::string>> removed;          // Level and name of each dropped table
+    std::vector<std::pair<int, TableFile>> added;              // Level and description of each new table
+    std::vector<std::pair<int, std::string>> compact_pointers; // Level and key where compactions resume
+};
+
+/**
+ * @brief Which tables a compaction merges and where its output goes.
+ */
+struct Compaction
+{
+    int level = 0;                                // The level the output is written to
+    std::vector<std::pair<int, TableFile>> inputs; // Level and table of each input, oldest first
+    std::vector<std::pair<int, std::string>> compact_pointers; // For the edit that installs the output
+};
+
+/**
+ * @brief The live SSTables of a storage, arranged in levels, and the MANIFEST that records
+ * them. Level 0 holds flushed MemTables, oldest first, whose key ranges may overlap. Every
+ * deeper level is one sorted run: its tables are ordered by key and never overlap, so a
+ * lookup reads at most one table per level. Each level may hold level_multiplier times the
+ * bytes of the one above it; a level over its budget, or a level 0 with
+ * l0_compaction_trigger tables, is compacted by merging one of its tables with the tables
+ * it overlaps one level down, so a compaction rewrites a small part of the data rather
+ * than all of it.
+ * The MANIFEST is an append-only log of edits in the write-ahead log's record format: the
+ * key of a record lists the tables an edit removes, and the value holds two length-prefixed
+ * sections, the tables it adds and the compaction pointers it sets. An edit is synced before apply() returns, so a table only counts
+ * as live once the MANIFEST says so, and a crash in the middle of an append loses the whole
+ * edit. The edit that installs a compaction's output also moves the compaction pointer of the
+ * level it compacted, so round-robin picking resumes where it left off after a restart, and a
+ * compaction that fails is picked again. open() replays the log and starts a new one holding
+ * a single edit with the current tables and pointers.
+ * Not synchronized; the owner guards it.
+ */
+class VersionSet
+{
+public:
+    /**
+     * @brief Number of levels; the last one is never compacted further.
+     */
+    static const int NUM_LEVELS = 7;
+
+    /**
+     * @brief Name of the MANIFEST file inside the directory.
+     */
+    static const char *const MANIFEST;
+
+    /**
+     * @brief Level 0 is compacted once it holds this many tables.
+     */
+    size_t l0_compaction_trigger = 4;
+
+    /**
+     * @brief Bytes level 1 may hold; each deeper level may hold level_multiplier times more.
+     */
+    uint64_t level1_bytes = 10 << 20;
+    unsigned level_multiplier = 10;
+
+    /**
+     * @brief Compactions start a new output table once the current one reaches this size.
+     */
+    uint64_t table_file_bytes = 2 << 20;
+
+    /**
+     * @brief Creates an empty version set; nothing is read until open() is called.
+     * @param directory The directory of the tables and the MANIFEST, with a trailing slash.
+     */
+    explicit VersionSet(const std::string &directory);
+    ~VersionSet();
+
+    VersionSet(const VersionSet &) = delete;
+    VersionSet &operator=(const VersionSet &) = delete;
+
+    /**
+     * @brief Loads the tables from the MANIFEST and starts a fresh one. Tables on disk that
+     * it does not list are the leftovers of a flush or compaction that never completed, and
+     * are deleted. A directory without a MANIFEST is adopted as it is: its tables go to level
+     * 0 in the given order, and empty ones are left out.
+     * @param files The names of the table files in the directory, oldest first.
+     * @return False if the MANIFEST cannot be written.
+     */
+    bool open(const std::vector<std::string> &files);
+
+    /**
+     * @brief Describes a table file of the directory by reading it whole.
+     * @return False if the table is empty or cannot be read.
+     */
+    bool describe(const std::string &name, TableFile &file) const;
+
+    /**
+     * @brief Logs an edit to the MANIFEST, syncs it, then applies it.
+     * @return False if the edit could not be logged; nothing changes then.
+     */
+    bool apply(const VersionEdit &edit);
+
+    /**
+     * @brief Returns the tables of a level: oldest first in level 0, by key in the others.
+     */
+    const std::vector<TableFile> &level(int level) const { return _levels[level]; }
+
+    /**
+     * @brief Returns the names of all live tables, newest first: level 0 from its newest
+     * table, then every deeper level by key.
+     */
+    std::vector<std::string> tables() const;
+
+    /**
+     * @brief Returns the number of live tables.
+     */
+    size_t table_count() const;
+
+    /**
+     * @brief Returns the total size of a level's tables.
+     */
+    uint64_t level_bytes(int level) const;
+
+    /**
+     * @brief Returns the number of bytes a level may hold before it is compacted.
+     */
+    uint64_t max_bytes(int level) const;
+
+    /**
+     * @brief Finds the table of a level, other than level 0, whose range holds a key.
+     * @return Its position in level(), or level(level).size() if no table holds the key.
+     */
+    size_t find(int level, std::string_view key) const;
+
+    /**
+     * @brief Checks whether any level is over its budget.
+     */
+    bool needs_compaction() const;
+
+    /**
+     * @brief Picks the compaction of the level that is furthest over its budget. The level's
+     * compaction pointer does not move until an edit carrying compaction.compact_pointers is
+     * applied.
+     * @return False if every level is within its budget.
+     */
+    bool pick_compaction(Compaction &compaction);
+
+    /**
+     * @brief Describes a compaction of every live table into one sorted run, in the deepest
+     * level that holds tables, or level 1 if only level 0 does.
+     */
+    Compaction full_compaction() const;
+
+private:
+    // Returns how far a level is over its budget; 1 or more means it needs a compaction.
+    double score(int level) const;
+    // Returns the level furthest over its budget, or -1 if every level is within it.
+    int neediest_level() const;
+    // Adds a table to a level, keeping the level's order.
+    void insert(int level, const TableFile &file);
+    // Appends the tables of a level that overlap a key range, oldest first, to inputs.
+    void overlapping(int level, const std::string &smallest, const std::string &largest,
+                     std::vector<std::pair<int, TableFile>> &inputs) const;
+    // Applies an edit that was read from or written to the MANIFEST.
+    void apply_in_memory(const VersionEdit &edit);
+    // Writes a new MANIFEST with the current tables and compaction pointers and swaps it in.
+    bool rewrite_manifest();
+    // Reads the MANIFEST; false if there is none.
+    bool load_manifest();
+    // Puts the tables of a directory that has no MANIFEST yet into level 0.
+    void adopt(const std::vector<std::string> &files);
+
+    static void encode(std::string &out, const VersionEdit &edit);
+    static bool decode(std::string_view removed, std::string_view value, VersionEdit &edit);
+
+    std::string _directory;
+    std::vector<TableFile> _levels[NUM_LEVELS];
+    // Largest key of the last table compacted out of each level, so compactions go round it
+    std::string _compact_pointer[NUM_LEVELS];
+    int _manifest_fd = -1;
+};
+
+#endif // VERSION_SET_H
@@ -0,0 +1,379 @@
+#include "wal.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+const char *const WriteAheadLog::EXTENSION = ".wal";
+
+// Size of the checksum and the two length fields in front of every record.
+const size_t RECORD_HEADER_SIZE = 12;
+
+static void put_uint32(char *out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        out[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+static uint32_t get_uint32(const char *data)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(data);
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8) |
+           (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+// CRC-32 (IEEE 802.3, reflected), as used by zlib.
+static uint32_t crc32(const char *data, size_t length)
+{
+    static const auto table = []()
+    {
+        std::vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+            {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; ++i)
+    {
+        crc = table[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+WriteAheadLog::WriteAheadLog(const std::string &directory) : _directory(directory)
+{
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    stop_syncer();
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_fd != -1)
+    {
+        if (_dirty && _policy != WalSync::NONE)
+        {
+            fdatasync(_fd);
+        }
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+std::string WriteAheadLog::file_path(uint64_t number) const
+{
+    std::string digits = std::to_string(number);
+    if (digits.size() < 6)
+    {
+        digits.insert(0, 6 - digits.size(), '0');
+    }
+    return _directory + digits + EXTENSION;
+}
+
+// Lists the log files in the directory as (number, path), oldest first.
+std::vector<std::pair<uint64_t, std::string>> WriteAheadLog::existing_files() const
+{
+    std::vector<std::pair<uint64_t, std::string>> files;
+    std::error_code ec;
+    if (!fs::is_directory(_directory, ec))
+    {
+        return files;
+    }
+    for (const auto &entry : fs::directory_iterator(_directory, ec))
+    {
+        const fs::path &path = entry.path();
+        std::string stem = path.stem().string();
+        if (!entry.is_regular_file() || path.extension() != EXTENSION || stem.empty() ||
+            !std::all_of(stem.begin(), stem.end(), [](char c)
+                         { return c >= '0' && c <= '9'; }))
+        {
+            continue;
+        }
+        files.emplace_back(std::stoull(stem), path.string());
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+size_t WriteAheadLog::replay(const std::function<void(const std::string &, const std::string &)> &apply)
+{
+    size_t replayed = 0;
+    for (const auto &file : existing_files())
+    {
+        std::ifstream in(file.second, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        size_t pos = 0;
+        std::string_view key;
+        std::string_view value;
+        while (pos < data.size())
+        {
+            if (!decode(data, pos, key, value))
+            {
+                std::cerr << "WAL " << file.second << ": ignoring torn or corrupt tail at offset " << pos << std::endl;
+                break;
+            }
+            apply(std::string(key), std::string(value));
+            ++replayed;
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _live.push_back(file.second);
+        _next_number = std::max(_next_number, file.first + 1);
+    }
+    return replayed;
+}
+
+bool WriteAheadLog::open()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return open_next_file();
+}
+
+// Switches writes to a new file. The caller holds _mutex.
+bool WriteAheadLog::open_next_file()
+{
+    std::error_code ec;
+    if (!_directory.empty())
+    {
+        fs::create_directories(_directory, ec);
+    }
+    for (const auto &file : existing_files())
+    {
+        _next_number = std::max(_next_number, file.first + 1);
+    }
+    std::string path = file_path(_next_number++);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Error: Could not open write-ahead log " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (_fd != -1)
+    {
+        close(_fd);
+    }
+    _fd = fd;
+    _dirty = false;
+    _sync_failed = false; // The old file's records reach an SSTable with the MemTable they are in
+    _live.push_back(path);
+    if (_policy != WalSync::NONE)
+    {
+        sync_file(_directory.empty() ? "." : _directory); // Make the new file's name durable
+    }
+    return true;
+}
+
+void WriteAheadLog::encode(std::string &out, std::string_view key, std::string_view value)
+{
+    size_t start = out.size();
+    out.resize(start + RECORD_HEADER_SIZE);
+    put_uint32(&out[start + 4], static_cast<uint32_t>(key.size()));
+    put_uint32(&out[start + 8], static_cast<uint32_t>(value.size()));
+    out.append(key.data(), key.size());
+    out.append(value.data(), value.size());
+    put_uint32(&out[start], crc32(out.data() + start + 4, out.size() - start - 4));
+}
+
+bool WriteAheadLog::decode(std::string_view data, size_t &pos, std::string_view &key, std::string_view &value)
+{
+    if (pos > data.size() || data.size() - pos < RECORD_HEADER_SIZE)
+    {
+        return false;
+    }
+    uint32_t checksum = get_uint32(data.data() + pos);
+    uint64_t key_length = get_uint32(data.data() + pos + 4);
+    uint64_t value_length = get_uint32(data.data() + pos + 8);
+    uint64_t body_length = 8 + key_length + value_length;
+    if (data.size() - pos - 4 < body_length || crc32(data.data() + pos + 4, body_length) != checksum)
+    {
+        return false;
+    }
+    key = data.substr(pos + RECORD_HEADER_SIZE, key_length);
+    value = data.substr(pos + RECORD_HEADER_SIZE + key_length, value_length);
+    pos += RECORD_HEADER_SIZE + key_length + value_length;
+    return true;
+}
+
+bool WriteAheadLog::write(const std::string &records)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_fd == -1)
+    {
+        return false;
+    }
+    // Records after a failed sync are not acknowledged until a sync of the file succeeds
+    if (_sync_failed && !sync_current())
+    {
+        return false;
+    }
+    size_t written = 0;
+    while (written < records.size())
+    {
+        ssize_t n = ::write(_fd, records.data() + written, records.size() - written);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            std::cerr << "Error: Write-ahead log append failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        written += n;
+    }
+    _writes++;
+    _dirty = true;
+    if (_policy == WalSync::EVERY_WRITE)
+    {
+        return sync_current();
+    }
+    return true;
+}
+
+// Syncs the current file. The caller holds _mutex.
+bool WriteAheadLog::sync_current()
+{
+    if (fdatasync(_fd) != 0)
+    {
+        std::cerr << "Error: Write-ahead log sync failed: " << strerror(errno) << std::endl;
+        _sync_failed = true;
+        return false;
+    }
+    _syncs++;
+    _dirty = false;
+    _sync_failed = false;
+    return true;
+}
+
+void WriteAheadLog::stop_syncer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop_syncer = true;
+    }
+    _syncer_cv.notify_all();
+    if (_syncer.joinable())
+    {
+        _syncer.join();
+    }
+}
+
+void WriteAheadLog::set_sync(WalSync policy, unsigned interval_ms)
+{
+    stop_syncer();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _policy = policy;
+    _interval_ms = std::max(1u, interval_ms);
+    _stop_syncer = false;
+    if (policy == WalSync::INTERVAL)
+    {
+        _syncer = std::thread([this]()
+                              { run_syncer(); });
+    }
+}
+
+// Syncs the current file every interval while it has unsynced writes.
+void WriteAheadLog::run_syncer()
+{
+    while (true)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _syncer_cv.wait_for(lock, std::chrono::milliseconds(_interval_ms), [this]()
+                            { return _stop_syncer; });
+        if (_stop_syncer)
+        {
+            return;
+        }
+        if (!_dirty || _fd == -1)
+        {
+            continue;
+        }
+        int fd = _fd;
+        uint64_t file_number = _next_number;
+        uint64_t writes = _writes.load();
+        // Writers may append while the sync runs; rotate() waits for it before closing fd
+        std::unique_lock<std::mutex> sync_lock(_sync_mutex);
+        lock.unlock();
+        bool ok = fdatasync(fd) == 0;
+        int error = errno;
+        sync_lock.unlock();
+
+        lock.lock();
+        if (file_number != _next_number)
+        {
+            continue; // rotate() synced and replaced the file meanwhile
+        }
+        if (!ok)
+        {
+            // Stays dirty, so the next interval tries again; writes fail until a sync succeeds
+            std::cerr << "Error: Write-ahead log sync failed: " << strerror(error) << std::endl;
+            _sync_failed = true;
+            continue;
+        }
+        _syncs++;
+        _sync_failed = false;
+        _dirty = _writes.load() != writes; // Appended during the sync
+    }
+}
+
+std::vector<std::string> WriteAheadLog::rotate()
+{
+    std::vector<std::string> previous;
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::lock_guard<std::mutex> sync_lock(_sync_mutex);
+    if (_fd != -1 && _dirty && _policy != WalSync::NONE)
+    {
+        fdatasync(_fd);
+        _syncs++;
+    }
+    previous.swap(_live);
+    if (!open_next_file() && !previous.empty())
+    {
+        // Writes still go to the current file, so it covers the next MemTable as well
+        _live.push_back(previous.back());
+        previous.pop_back();
+    }
+    return previous;
+}
+
+void WriteAheadLog::remove(const std::vector<std::string> &files)
+{
+    for (const std::string &file : files)
+    {
+        std::error_code ec;
+        fs::remove(file, ec);
+    }
+}
+
+void WriteAheadLog::retain(const std::vector<std::string> &files)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _live.insert(_live.begin(), files.begin(), files.end());
+}
+
+bool WriteAheadLog::sync_file(const std::string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,161 @@
+#ifndef WAL_H
+#define WAL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief When appended log records are forced to stable storage.
+ */
+enum class WalSync
+{
+    EVERY_WRITE, // fdatasync before a write is acknowledged
+    INTERVAL,    // fdatasync from a background thread every sync interval
+    NONE         // leave it to the operating system
+};
+
+/**
+ * @brief Append-only write-ahead log of puts, kept in numbered files in a storage's directory.
+ * Each record is: CRC-32 (4 bytes) of the rest, key length (4 bytes), value length (4 bytes),
+ * key, value; integers are little-endian. Replay stops at the first record that is torn or
+ * fails its checksum, which is where a crash interrupted the last append.
+ * A new file is started whenever the MemTable it covers is swapped out, and the older files
+ * are removed once that MemTable has reached an SSTable on disk.
+ */
+class WriteAheadLog
+{
+public:
+    /**
+     * @brief File name extension of log files.
+     */
+    static const char *const EXTENSION;
+
+    /**
+     * @brief Creates a log over a directory; nothing is opened until open() is called.
+     * @param directory The directory holding the log files, with a trailing slash.
+     */
+    explicit WriteAheadLog(const std::string &directory);
+
+    /**
+     * @brief Syncs what the policy promises and closes the current file.
+     */
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    /**
+     * @brief Replays the records of every existing log file, oldest first.
+     * The replayed files stay live until the next rotate().
+     * @param apply Called with the key and value of each record, in log order.
+     * @return The number of records replayed.
+     */
+    size_t replay(const std::function<void(const std::string &, const std::string &)> &apply);
+
+    /**
+     * @brief Starts a new log file numbered after every existing one.
+     * @return False if the file cannot be created.
+     */
+    bool open();
+
+    /**
+     * @brief Appends the encoding of one put to a buffer of records.
+     */
+    static void encode(std::string &out, std::string_view key, std::string_view value);
+
+    /**
+     * @brief Decodes the record that starts at pos, written by encode(), and moves pos past it.
+     * Other append-only files reuse the record format for its checksum.
+     * @param key Receives a view of the key inside data.
+     * @param value Receives a view of the value inside data.
+     * @return False if the record is torn or fails its checksum; pos is left alone then.
+     */
+    static bool decode(std::string_view data, size_t &pos, std::string_view &key, std::string_view &value);
+
+    /**
+     * @brief Appends already encoded records with one write call, syncing them when the
+     * policy is EVERY_WRITE. Callers serialize their writes; the log does not reorder them.
+     * After a failed sync, foreground or background, writes fail until a sync of the file
+     * succeeds, so the error reaches the writers of the next group.
+     * @return False if the records could not be written (or synced) completely.
+     */
+    bool write(const std::string &records);
+
+    /**
+     * @brief Changes the sync policy, starting or stopping the background syncer.
+     * @param policy The new policy.
+     * @param interval_ms Time between background syncs under WalSync::INTERVAL.
+     */
+    void set_sync(WalSync policy, unsigned interval_ms = 10);
+
+    /**
+     * @brief Starts a new file for subsequent writes. If it cannot be created, writes go on to
+     * the current file, which then stays live.
+     * @return The files that were live before, which may be removed once the MemTable they
+     * cover is safely on disk.
+     */
+    std::vector<std::string> rotate();
+
+    /**
+     * @brief Deletes log files returned by rotate().
+     */
+    void remove(const std::vector<std::string> &files);
+
+    /**
+     * @brief Returns to the live set files returned by rotate() whose MemTable could not be
+     * flushed and is still the one taking writes, so they are replayed after a restart and the
+     * next rotate() hands them over again with that MemTable.
+     */
+    void retain(const std::vector<std::string> &files);
+
+    /**
+     * @brief Forces a file that was written and closed by someone else to stable storage.
+     * @return False if the file cannot be opened or synced.
+     */
+    static bool sync_file(const std::string &path);
+
+    /**
+     * @brief Number of write() calls so far.
+     */
+    uint64_t write_count() const { return _writes.load(); }
+
+    /**
+     * @brief Number of fdatasync calls so far, foreground and background.
+     */
+    uint64_t sync_count() const { return _syncs.load(); }
+
+private:
+    bool open_next_file();
+    bool sync_current();
+    void stop_syncer();
+    std::string file_path(uint64_t number) const;
+    std::vector<std::pair<uint64_t, std::string>> existing_files() const;
+    void run_syncer();
+
+    std::string _directory;
+    std::mutex _mutex;      // Guards the fields below and serializes writes to _fd
+    std::mutex _sync_mutex; // Held while the syncer syncs _fd, so rotate() never closes it underneath
+    int _fd = -1;
+    uint64_t _next_number = 1;
+    std::vector<std::string> _live; // Files whose records are not yet in any SSTable
+    bool _dirty = false;            // Written since the last successful sync
+    bool _sync_failed = false;      // The last sync of the current file failed
+    WalSync _policy = WalSync::INTERVAL;
+    unsigned _interval_ms = 10;
+
+    std::thread _syncer;
+    std::condition_variable _syncer_cv;
+    bool _stop_syncer = false;
+
+    std::atomic<uint64_t> _writes{0};
+    std::atomic<uint64_t> _syncs{0};
+};
+
+#endif // WAL_H
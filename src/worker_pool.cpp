@@ -0,0 +1,177 @@
+#include "worker_pool.h"
+#include <cstdint>
+
+// Rounds of stealing a worker attempts before it parks.
+const int SPIN_ROUNDS = 64;
+
+TaskQueue::TaskQueue(size_t capacity)
+{
+    size_t size = 2;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    _cells.reset(new Cell[size]);
+    _mask = size - 1;
+    for (size_t i = 0; i < size; ++i)
+    {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+bool TaskQueue::push(std::function<void()> &task)
+{
+    size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Cell &cell = _cells[pos & _mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+        if (diff == 0)
+        {
+            // The cell is free for this position; claim the position
+            if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.task = std::move(task);
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // The cell still holds a task from one lap ago
+        }
+        else
+        {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool TaskQueue::pop(std::function<void()> &task)
+{
+    size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+    while (true)
+    {
+        Cell &cell = _cells[pos & _mask];
+        size_t sequence = cell.sequence.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+        if (diff == 0)
+        {
+            if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                task = std::move(cell.task);
+                cell.task = nullptr;
+                cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // Nothing published at this position yet
+        }
+        else
+        {
+            pos = _dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+WorkerPool::WorkerPool(size_t threads, size_t queue_capacity)
+{
+    if (threads == 0)
+    {
+        threads = 1;
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        _workers.push_back(std::make_unique<Worker>(queue_capacity));
+    }
+    for (size_t i = 0; i < threads; ++i)
+    {
+        _workers[i]->thread = std::thread([this, i]()
+                                          { run(i); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+        _stopping.store(true);
+    }
+    _wakeup.notify_all();
+    for (auto &worker : _workers)
+    {
+        worker->thread.join();
+    }
+}
+
+void WorkerPool::submit(std::function<void()> task)
+{
+    size_t start = _next_queue.fetch_add(1, std::memory_order_relaxed);
+    // Counted before the push, so a worker never sees a task it cannot account for
+    _queued.fetch_add(1);
+    for (size_t i = 0; i < _workers.size(); ++i)
+    {
+        if (_workers[(start + i) % _workers.size()]->queue.push(task))
+        {
+            if (_sleepers.load() > 0)
+            {
+                // Taking the mutex orders this wakeup after a worker's final check before it sleeps
+                std::lock_guard<std::mutex> lock(_sleep_mutex);
+                _wakeup.notify_one();
+            }
+            return;
+        }
+    }
+    _queued.fetch_sub(1);
+    task(); // Every queue is full
+}
+
+// Takes a task from the worker's own queue, or steals one from the other workers.
+bool WorkerPool::take(size_t index, std::function<void()> &task)
+{
+    for (size_t i = 0; i < _workers.size(); ++i)
+    {
+        if (_workers[(index + i) % _workers.size()]->queue.pop(task))
+        {
+            _queued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkerPool::run(size_t index)
+{
+    std::function<void()> task;
+    while (true)
+    {
+        bool found = false;
+        for (int round = 0; round < SPIN_ROUNDS && !found; ++round)
+        {
+            found = take(index, task);
+            if (!found)
+            {
+                std::this_thread::yield();
+            }
+        }
+        if (found)
+        {
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_sleep_mutex);
+        _sleepers.fetch_add(1);
+        _wakeup.wait(lock, [this]()
+                     { return _queued.load() > 0 || _stopping.load(); });
+        _sleepers.fetch_sub(1);
+        if (_stopping.load() && _queued.load() == 0)
+        {
+            return;
+        }
+    }
+}
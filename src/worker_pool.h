@@ -0,0 +1,113 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief A bounded multi-producer, multi-consumer queue that never takes a lock.
+ * Each cell carries a sequence number telling producers and consumers whose turn it is,
+ * so a push or pop is one compare-and-swap on the shared position plus a store to the cell.
+ */
+class TaskQueue
+{
+public:
+    /**
+     * @brief Creates an empty queue.
+     * @param capacity The number of cells, rounded up to a power of two.
+     */
+    explicit TaskQueue(size_t capacity);
+
+    TaskQueue(const TaskQueue &) = delete;
+    TaskQueue &operator=(const TaskQueue &) = delete;
+
+    /**
+     * @brief Appends a task.
+     * @return False if the queue is full; the task is left untouched.
+     */
+    bool push(std::function<void()> &task);
+
+    /**
+     * @brief Removes the oldest task.
+     * @return False if the queue is empty.
+     */
+    bool pop(std::function<void()> &task);
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        std::function<void()> task;
+    };
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    // Kept on separate cache lines so producers and consumers do not contend
+    alignas(64) std::atomic<size_t> _enqueue_pos{0};
+    alignas(64) std::atomic<size_t> _dequeue_pos{0};
+};
+
+/**
+ * @brief A fixed set of worker threads that run tasks submitted from any thread.
+ * Every worker owns a lock-free queue; submissions are spread over the queues round-robin,
+ * and a worker whose queue runs dry steals from the others before going to sleep.
+ */
+class WorkerPool
+{
+public:
+    /**
+     * @brief Starts the workers.
+     * @param threads The number of workers; at least one is started.
+     * @param queue_capacity The capacity of each worker's queue.
+     */
+    explicit WorkerPool(size_t threads, size_t queue_capacity = 4096);
+
+    /**
+     * @brief Runs the tasks still queued, then stops and joins the workers.
+     */
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    /**
+     * @brief Queues a task for the next free worker.
+     * If every queue is full, the task runs on the calling thread instead, which
+     * slows the submitter down until the workers catch up.
+     */
+    void submit(std::function<void()> task);
+
+    /**
+     * @brief Returns the number of worker threads.
+     */
+    size_t size() const { return _workers.size(); }
+
+private:
+    struct Worker
+    {
+        explicit Worker(size_t queue_capacity) : queue(queue_capacity) {}
+        TaskQueue queue;
+        std::thread thread;
+    };
+
+    void run(size_t index);
+    bool take(size_t index, std::function<void()> &task);
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+    std::atomic<size_t> _next_queue{0};
+    std::atomic<size_t> _queued{0}; // Tasks pushed but not yet taken
+    std::atomic<bool> _stopping{false};
+
+    // Only used to park idle workers; the queues themselves never lock
+    std::mutex _sleep_mutex;
+    std::condition_variable _wakeup;
+    std::atomic<size_t> _sleepers{0};
+};
+
+#endif // WORKER_POOL_H
@@ -46,6 +46,9 @@ int main()
 
     // Configure MemTable and Storage for performance test
     server.storage->main_mdb->max_size = 1000; // Small max_size to trigger frequent flushes
+    server.storage->second_mdb->max_size = 1000; // The MemTables swap roles on every flush
+    // Small levels and tables, so background compactions spread the flushed tables over levels
+    server.storage->set_compaction_options(4, 256 * 1024, 64 * 1024);
     const int num_items_to_insert = 10000;     // Insert many items
     const size_t key_length = 16;
     const size_t value_length = 64;
@@ -61,11 +64,14 @@ int main()
         // check_for_compaction is now triggered inside Server::put
     }
 
-    // Trigger merge if there are tables to merge
-    if (!server.storage->tables_to_merge.empty())
+    // Let the background flushes and compactions settle, then merge every table into one run
+    server.storage->wait_for_compaction();
+    size_t tables_before_merge = server.storage->tables().size();
+    if (tables_before_merge > 1)
     {
-        std::cout << "Triggering merge operation..." << std::endl;
+        std::cout << "Triggering merge of " << tables_before_merge << " SST files..." << std::endl;
         server.storage->merge();
+        std::cout << "Merged into one sorted run of " << server.storage->tables().size() << " SST file(s)." << std::endl;
     }
 
     auto total_end_time = chrono::high_resolution_clock::now();
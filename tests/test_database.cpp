@@ -1,11 +1,19 @@
 #include "../src/database.h"
 #include "../src/server.h" // For getCurrentUnixTimeString
+#include "../src/compress.h"
+#include "../src/table_cache.h"
+#include "../src/fence_index.h"
+#include "../src/version_set.h"
 #include <iostream>
 #include <string>
 #include <vector>
 #include <filesystem>
 #include <map>
 #include <algorithm> // For std::sort
+#include <thread>
+#include <cstring>
+#include <fstream>
+#include <sys/resource.h>
 
 // Simple assertion macro
 #define ASSERT_EQ(expected, actual, message)                                          \
@@ -36,6 +44,8 @@
 
 namespace fs = std::filesystem;
 
+const std::string DATADIR = "data/"; // MemTable::flush and Storage write their tables here
+
 // Helper to clean up test files
 void cleanup_test_files()
 {
@@ -46,6 +56,16 @@ void cleanup_test_files()
             fs::remove(entry.path());
         }
     }
+    if (fs::exists(DATADIR))
+    {
+        for (const auto &entry : fs::directory_iterator(DATADIR))
+        {
+            if (entry.is_regular_file() && entry.path().extension() == ".sst")
+            {
+                fs::remove(entry.path());
+            }
+        }
+    }
 }
 
 TEST(MemTable_put_get)
@@ -83,11 +103,11 @@ TEST(MemTable_flush)
     mt.put("flushkey2", "flushvalue2");
     SSTable *sst = mt.flush("test_flush.sst");
     ASSERT_TRUE(sst != nullptr, "MemTable::flush should return a valid SSTable pointer");
-    ASSERT_TRUE(fs::exists("test_flush.sst"), "Flushed SSTable file should exist");
+    ASSERT_TRUE(fs::exists(DATADIR + "test_flush.sst"), "Flushed SSTable file should exist");
     ASSERT_TRUE(mt.is_empty(), "MemTable should be empty after flush");
 
     // Verify content of flushed SSTable
-    SSTable loaded_sst("test_flush.sst", true);
+    SSTable loaded_sst(DATADIR + "test_flush.sst", true);
     ASSERT_EQ(std::string("flushvalue1"), loaded_sst.get("flushkey1"), "Flushed SSTable content for flushkey1 incorrect");
     ASSERT_EQ(std::string("flushvalue2"), loaded_sst.get("flushkey2"), "Flushed SSTable content for flushkey2 incorrect");
     ASSERT_EQ(std::string(""), loaded_sst.get("nonexistent_flush_key"), "Flushed SSTable content for nonexistent key incorrect");
@@ -97,6 +117,133 @@ TEST(MemTable_flush)
 }
 END_TEST
 
+TEST(MemTable_concurrent_put)
+{
+    MemTable mt;
+    const int threads = 4;
+    const int keys_per_thread = 2000;
+    std::atomic<bool> writing{true};
+    bool ordered = true;
+    std::thread reader([&]()
+                       {
+        // Iterates while the writers insert; keys must always come out in order
+        while (writing.load())
+        {
+            std::string previous;
+            SkipList::Iterator it(&mt.entries());
+            for (it.seek_to_first(); it.valid(); it.next())
+            {
+                if (!previous.empty() && !(previous < it.key()))
+                {
+                    ordered = false;
+                }
+                previous = it.key();
+            }
+        } });
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; ++t)
+    {
+        writers.emplace_back([&mt, t]()
+                             {
+            for (int i = 0; i < keys_per_thread; ++i)
+            {
+                mt.put("key" + std::to_string(i * threads + t), "v" + std::to_string(t));
+                mt.put("shared" + std::to_string(i % 100), "s" + std::to_string(t)); // Contended updates
+            } });
+    }
+    for (auto &writer : writers)
+    {
+        writer.join();
+    }
+    writing.store(false);
+    reader.join();
+
+    ASSERT_TRUE(ordered, "Iteration during concurrent puts should be in key order");
+    ASSERT_EQ(static_cast<size_t>(threads * keys_per_thread + 100), mt.entries().size(), "Every distinct key should be stored once");
+    for (int i = 0; i < threads * keys_per_thread; ++i)
+    {
+        ASSERT_EQ("v" + std::to_string(i % threads), mt.get("key" + std::to_string(i)), "Concurrent put lost a value");
+    }
+    ASSERT_EQ(std::string("s"), mt.get("shared7").substr(0, 1), "Updated key should hold one writer's value");
+}
+END_TEST
+
+TEST(MemTable_byte_budget)
+{
+    MemTable mt;
+    mt.put("k1", std::string(100, 'a'));
+    mt.put("k2", std::string(50, 'b'));
+    ASSERT_EQ(static_cast<long long>(2 + 100 + 2 + 50), mt.get_size_bytes(), "Size should count key and value bytes");
+    mt.put("k1", "short"); // Replacing a value adjusts the count by the difference
+    ASSERT_EQ(static_cast<long long>(2 + 5 + 2 + 50), mt.get_size_bytes(), "Size should follow replaced values");
+    ASSERT_TRUE(mt.memory_usage() >= static_cast<size_t>(mt.get_size_bytes()), "Memory usage should include overhead");
+    ASSERT_TRUE(!mt.oversize(), "A few small entries should fit the default budget");
+
+    mt.max_bytes = 1 << 20;
+    for (int i = 0; !mt.oversize(); ++i)
+    {
+        mt.put("big" + std::to_string(i), std::string(64 * 1024, 'x'));
+        ASSERT_TRUE(i < 16, "A 1 MiB budget should fill within 16 values of 64 KiB");
+    }
+    ASSERT_TRUE(mt.memory_usage() >= mt.max_bytes, "Oversize should mean the budget is used up");
+
+    mt.clear();
+    ASSERT_EQ(0LL, mt.get_size_bytes(), "Clear should reset the size");
+    ASSERT_TRUE(!mt.oversize(), "Clear should release the memory");
+
+    // Replaced versions stay allocated for lock-free readers, so they count against the budget
+    const std::string value(100, 'o');
+    int overwrites = 0;
+    for (; !mt.oversize(); ++overwrites)
+    {
+        mt.put("hot_key", value);
+        ASSERT_TRUE(overwrites < (1 << 20) / 100, "Overwriting one key should fill the budget");
+    }
+    ASSERT_EQ(static_cast<long long>(7 + 100), mt.get_size_bytes(), "Size should count only the newest value");
+    ASSERT_TRUE(mt.memory_usage() >= static_cast<size_t>(overwrites) * 100, "Memory usage should count every retained version");
+}
+END_TEST
+
+TEST(Arena_allocate_reset)
+{
+    Arena arena;
+    const int threads = 4;
+    const int allocations = 5000;
+    std::vector<std::vector<char *>> blocks(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&arena, &blocks, t]()
+                             {
+            for (int i = 0; i < allocations; ++i)
+            {
+                char *p = arena.allocate(24);
+                memset(p, t, 24); // Overlapping allocations would corrupt each other's bytes
+                blocks[t].push_back(p);
+            } });
+    }
+    for (auto &worker : workers)
+    {
+        worker.join();
+    }
+    for (int t = 0; t < threads; ++t)
+    {
+        for (char *p : blocks[t])
+        {
+            ASSERT_TRUE(reinterpret_cast<uintptr_t>(p) % alignof(void *) == 0, "Arena allocations should be pointer-aligned");
+            ASSERT_TRUE(p[0] == t && p[23] == t, "Concurrent arena allocations should not overlap");
+        }
+    }
+    size_t before_large = arena.memory_usage();
+    ASSERT_TRUE(before_large >= threads * allocations * 24, "Arena usage should cover every allocation");
+    arena.allocate(Arena::BLOCK_SIZE); // Larger than a block: gets one of its own
+    ASSERT_TRUE(arena.memory_usage() >= before_large + Arena::BLOCK_SIZE, "Large allocations should get their own block");
+
+    arena.reset();
+    ASSERT_EQ(static_cast<size_t>(0), arena.memory_usage(), "Reset should release every block");
+}
+END_TEST
+
 TEST(SSTable_writeFromMemory_find)
 {
     // cleanup_test_files(); // Commented out to preserve SST files
@@ -176,15 +323,654 @@ TEST(SSTable_get_first_key_pop_first_item)
 }
 END_TEST
 
+TEST(SSTable_bloom_filter)
+{
+    std::vector<KeyValuePair> kvs;
+    for (int i = 0; i < 2000; ++i)
+    {
+        kvs.push_back({"bloom_key" + std::to_string(i), "value" + std::to_string(i)});
+    }
+    std::sort(kvs.begin(), kvs.end());
+    SSTable sst(DATADIR + "test_bloom.sst");
+    ASSERT_TRUE(sst.writeFromMemory(kvs), "Writing the SSTable should succeed");
+
+    for (const auto &kv : kvs)
+    {
+        ASSERT_EQ(kv.value, sst.get(kv.key), "The filter must never rule out a present key");
+    }
+    uint64_t reads_for_hits = sst.getBlockReads();
+    int misses = 2000;
+    for (int i = 0; i < misses; ++i)
+    {
+        ASSERT_TRUE(!sst.find("bloom_key" + std::to_string(i) + "_absent").has_value(), "Absent keys should not be found");
+    }
+    uint64_t reads_for_misses = sst.getBlockReads() - reads_for_hits;
+    // 10 bits per key gives about 1% false positives; allow some slack
+    ASSERT_TRUE(reads_for_misses < static_cast<uint64_t>(misses / 20), "Most misses should be answered by the filter without I/O");
+
+    // Files from before filters existed end with only the index offset
+    {
+        std::ofstream legacy(DATADIR + "test_legacy.sst", std::ios::binary | std::ios::trunc);
+        auto u64 = [&legacy](uint64_t v)
+        { legacy.write(reinterpret_cast<const char *>(&v), sizeof(v)); };
+        auto str = [&](const std::string &v)
+        { u64(v.size()); legacy.write(v.data(), v.size()); };
+        u64(1);
+        str("legacy_key");
+        str("legacy_value");
+        uint64_t index_offset = legacy.tellp();
+        u64(1);
+        str("legacy_key");
+        u64(0);
+        u64(index_offset);
+    }
+    SSTable legacy_sst(DATADIR + "test_legacy.sst");
+    ASSERT_EQ(std::string("legacy_value"), legacy_sst.get("legacy_key"), "Files without a filter block should stay readable");
+    SSTable legacy_loaded(DATADIR + "test_legacy.sst", true);
+    ASSERT_EQ(std::string("legacy_key"), legacy_loaded.get_first_key(), "Files without a filter block should load fully");
+}
+END_TEST
+
+TEST(SSTable_sized_blocks_with_restarts)
+{
+    size_t saved_block_size = SSTable::blockSize;
+    SSTable::blockSize = 512; // Many blocks, each with several restart intervals
+    std::vector<KeyValuePair> kvs;
+    for (int i = 0; i < 3000; ++i)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "tenant/table/%06d", i * 2); // Odd ids stay absent
+        // Mostly tiny values, with the occasional one far larger than a block
+        kvs.push_back({key, i % 500 == 7 ? std::string(4000, 'L') : "v" + std::to_string(i)});
+    }
+    SSTable sst(DATADIR + "test_blocks.sst");
+    ASSERT_TRUE(sst.writeFromMemory(kvs), "Writing the SSTable should succeed");
+    SSTable::blockSize = saved_block_size;
+
+    // Keys share their "tenant/table/" prefix and most digits, which delta encoding drops
+    size_t key_bytes = 0;
+    size_t value_bytes = 0;
+    for (const auto &kv : kvs)
+    {
+        key_bytes += kv.key.size();
+        value_bytes += kv.value.size();
+    }
+    size_t data_bytes = fs::file_size(DATADIR + "test_blocks.sst");
+    ASSERT_TRUE(data_bytes < value_bytes + key_bytes / 2, "Prefix-compressed keys should take less than half their raw size");
+
+    for (size_t i = 0; i < kvs.size(); ++i)
+    {
+        ASSERT_EQ(kvs[i].value, sst.get(kvs[i].key), "Every key should be found through its restart interval");
+    }
+    ASSERT_EQ(static_cast<uint64_t>(kvs.size()), sst.getBlockReads(), "A lookup should read exactly one block");
+    SSTable::bloomBitsPerKey = 0; // Let absent keys reach the block search
+    SSTable unfiltered(DATADIR + "test_blocks_unfiltered.sst");
+    ASSERT_TRUE(unfiltered.writeFromMemory(kvs), "Writing the SSTable should succeed");
+    SSTable::bloomBitsPerKey = BloomFilter::DEFAULT_BITS_PER_KEY;
+    for (int i = 0; i < 6000; i += 7)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "tenant/table/%06d", i);
+        std::optional<std::string> found = unfiltered.find(key);
+        bool even = i % 2 == 0;
+        ASSERT_EQ(even, found.has_value(), "Only even ids should be found");
+    }
+    ASSERT_TRUE(!unfiltered.find("tenant/table/999999").has_value(), "Keys past the last block should be absent");
+
+    SSTable loaded(DATADIR + "test_blocks.sst", true);
+    ASSERT_EQ(kvs.size(), loaded.getAllKeyValues().size(), "Loading should decode every block");
+    ASSERT_EQ(kvs.front().key, loaded.get_first_key(), "Loaded pairs should start at the smallest key");
+}
+END_TEST
+
+TEST(LzCodec_round_trip)
+{
+    std::vector<std::string> inputs = {"", "a", "abcd", std::string(10000, 'x'), "abcabcabcabcabcabcabcabc"};
+    std::string noise;
+    uint32_t state = 12345;
+    for (int i = 0; i < 70000; ++i) // Longer than the maximum match offset
+    {
+        state = state * 1103515245 + 12345;
+        noise.push_back(static_cast<char>(state >> 16));
+    }
+    inputs.push_back(noise);
+    inputs.push_back(noise + noise); // Repeats beyond the 64 KiB window must not match
+    for (const std::string &input : inputs)
+    {
+        std::string output;
+        ASSERT_TRUE(LzCodec::decompress(LzCodec::compress(input), output), "Compressed data should decompress");
+        ASSERT_TRUE(output == input, "Decompression should restore the input");
+    }
+    std::string packed = LzCodec::compress(std::string(10000, 'x'));
+    ASSERT_TRUE(packed.size() < 100, "Runs should compress to almost nothing");
+    std::string output;
+    ASSERT_TRUE(!LzCodec::decompress(packed.substr(0, packed.size() - 1), output), "Truncated input should be rejected");
+}
+END_TEST
+
+TEST(SSTable_compressed_blocks)
+{
+    std::vector<KeyValuePair> json;
+    std::vector<KeyValuePair> noise;
+    uint32_t state = 99;
+    for (int i = 0; i < 500; ++i)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "user:%05d", i);
+        json.push_back({key, "{\"id\":" + std::to_string(i) + ",\"name\":\"user" + std::to_string(i) +
+                                 "\",\"active\":true,\"roles\":[\"reader\",\"writer\"],\"settings\":{\"theme\":\"dark\",\"lang\":\"en\"}}"});
+        std::string random_value;
+        for (int j = 0; j < 100; ++j)
+        {
+            state = state * 1103515245 + 12345;
+            random_value.push_back(static_cast<char>(state >> 16));
+        }
+        noise.push_back({key, random_value});
+    }
+    size_t json_bytes = 0;
+    for (const auto &kv : json)
+    {
+        json_bytes += kv.key.size() + kv.value.size();
+    }
+
+    SSTable compressed(DATADIR + "test_compressed.sst");
+    ASSERT_TRUE(compressed.writeFromMemory(json), "Writing the compressed SSTable should succeed");
+    ASSERT_TRUE(fs::file_size(DATADIR + "test_compressed.sst") * 3 < json_bytes, "JSON blocks should compress at least 3x");
+    for (const auto &kv : json)
+    {
+        ASSERT_EQ(kv.value, compressed.get(kv.key), "Values should be read back through decompression");
+    }
+    SSTable compressed_loaded(DATADIR + "test_compressed.sst", true);
+    ASSERT_EQ(json.size(), compressed_loaded.getAllKeyValues().size(), "Loading should decompress every block");
+
+    SSTable raw(DATADIR + "test_incompressible.sst");
+    ASSERT_TRUE(raw.writeFromMemory(noise), "Writing the incompressible SSTable should succeed");
+    ASSERT_TRUE(fs::file_size(DATADIR + "test_incompressible.sst") > 500 * 100, "Incompressible blocks should be stored raw");
+    for (const auto &kv : noise)
+    {
+        ASSERT_TRUE(kv.value == raw.get(kv.key), "Raw blocks should read back unchanged");
+    }
+}
+END_TEST
+
+TEST(SSTable_mmap_zero_copy_values)
+{
+    std::vector<KeyValuePair> data;
+    for (int i = 0; i < 300; ++i)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "mmap_key%05d", i);
+        data.push_back({key, "value_" + std::to_string(i)});
+    }
+    bool saved_compress = SSTable::compressBlocks;
+    bool saved_mmap = SSTable::mmapReads;
+    SSTable::compressBlocks = false;
+    {
+        SSTable writer(DATADIR + "test_mmap.sst");
+        ASSERT_TRUE(writer.writeFromMemory(data), "Writing the SSTable should succeed");
+    }
+
+    ValueRef kept;
+    {
+        SSTable table(DATADIR + "test_mmap.sst");
+        ASSERT_TRUE(table.findRef("mmap_key00123", kept), "A present key should be found");
+        ASSERT_TRUE(kept.zero_copy(), "Values of raw mapped blocks should not be copied");
+        ValueRef missing;
+        ASSERT_TRUE(!table.findRef("mmap_key00123x", missing), "An absent key should not be found");
+    }
+    ASSERT_EQ(std::string("value_123"), std::string(kept.view()), "The view should outlive the table");
+
+    SSTable::mmapReads = false;
+    {
+        SSTable table(DATADIR + "test_mmap.sst");
+        ValueRef copied;
+        ASSERT_TRUE(table.findRef("mmap_key00200", copied), "Reads without a mapping should still find keys");
+        ASSERT_TRUE(!copied.zero_copy(), "Values read from the file should be copies");
+        ASSERT_EQ(std::string("value_200"), std::string(copied.view()), "The copied value should match");
+        ASSERT_EQ(data.size(), SSTable(DATADIR + "test_mmap.sst", true).getAllKeyValues().size(), "Loading should work without a mapping");
+    }
+    SSTable::mmapReads = saved_mmap;
+
+    SSTable::compressBlocks = true;
+    {
+        std::vector<KeyValuePair> repetitive;
+        for (int i = 0; i < 300; ++i)
+        {
+            repetitive.push_back({data[i].key, std::string(200, 'r')});
+        }
+        SSTable table(DATADIR + "test_mmap_lz.sst");
+        ASSERT_TRUE(table.writeFromMemory(repetitive), "Writing the compressed SSTable should succeed");
+        ValueRef copied;
+        ASSERT_TRUE(table.findRef("mmap_key00007", copied), "Compressed blocks should be searchable");
+        ASSERT_TRUE(!copied.zero_copy(), "Decompressed values should be copies");
+        ASSERT_EQ(std::string(200, 'r'), std::string(copied.view()), "The decompressed value should match");
+    }
+    SSTable::compressBlocks = saved_compress;
+}
+END_TEST
+
+TEST(SSTable_pread_concurrent_reads)
+{
+    std::vector<KeyValuePair> data;
+    for (int i = 0; i < 2000; ++i)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "pread_key%05d", i);
+        data.push_back({key, "value_" + std::to_string(i) + std::string(i % 50, 'p')});
+    }
+    uint64_t saved_limit = SSTable::mmapLimit;
+    SSTable::mmapLimit = 0; // Every table is read with pread
+    {
+        SSTable writer(DATADIR + "test_pread.sst");
+        ASSERT_TRUE(writer.writeFromMemory(data), "Writing the SSTable should succeed");
+    }
+
+    SSTable table(DATADIR + "test_pread.sst");
+    ValueRef first;
+    ASSERT_TRUE(table.findRef("pread_key00000", first), "A present key should be found");
+    ASSERT_TRUE(!first.zero_copy(), "Tables over the mmap limit should not be mapped");
+
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t)
+    {
+        readers.emplace_back([&, t]()
+                             {
+            for (int i = t; i < 2000; i += 3)
+            {
+                auto value = table.find(data[i].key);
+                if (!value || *value != data[i].value)
+                {
+                    ++mismatches;
+                }
+                if (table.find(data[i].key + "_absent"))
+                {
+                    ++mismatches;
+                }
+            } });
+    }
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    ASSERT_EQ(0, mismatches.load(), "Threads sharing one descriptor should all read correct values");
+    ASSERT_EQ(data.size(), SSTable(DATADIR + "test_pread.sst", true).getAllKeyValues().size(), "Loading should read every block");
+    SSTable::mmapLimit = saved_limit;
+}
+END_TEST
+
+TEST(BlockCache_lru_eviction)
+{
+    BlockCache cache(BlockCache::SHARDS * 4096);
+    auto block = std::make_shared<const std::string>(1000, 'b');
+    ASSERT_TRUE(cache.lookup(1, 0) == nullptr, "An empty cache should miss");
+    cache.insert(1, 0, block);
+    ASSERT_TRUE(cache.lookup(1, 0) == block, "An inserted block should be found");
+    ASSERT_TRUE(cache.lookup(2, 0) == nullptr, "Blocks of other files should not match");
+    ASSERT_EQ(static_cast<uint64_t>(1), cache.hits(), "One lookup should have hit");
+    ASSERT_EQ(static_cast<uint64_t>(2), cache.misses(), "Two lookups should have missed");
+
+    for (uint64_t offset = 0; offset < 1000 * 4096; offset += 4096)
+    {
+        cache.insert(3, offset, std::make_shared<const std::string>(1000, 'x'));
+    }
+    ASSERT_TRUE(cache.usage() <= cache.capacity(), "The cache should stay within its capacity");
+    ASSERT_TRUE(cache.lookup(3, 999 * 4096) != nullptr, "The newest block should still be cached");
+    ASSERT_TRUE(cache.lookup(3, 0) == nullptr, "The oldest blocks should have been evicted");
+    ASSERT_EQ(1000, static_cast<int>(block->size()), "An evicted block should stay valid for its holders");
+
+    cache.set_capacity(0);
+    ASSERT_EQ(static_cast<size_t>(0), cache.usage(), "A zero capacity should empty the cache");
+    cache.insert(4, 0, block);
+    ASSERT_TRUE(cache.lookup(4, 0) == nullptr, "A zero capacity should disable caching");
+}
+END_TEST
+
+TEST(SSTable_block_cache_hits)
+{
+    std::vector<KeyValuePair> data;
+    for (int i = 0; i < 1000; ++i)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "cache_key%05d", i);
+        data.push_back({key, "{\"id\":" + std::to_string(i) + ",\"payload\":\"" + std::string(40, 'c') + "\"}"});
+    }
+    SSTable writer(DATADIR + "test_block_cache.sst");
+    ASSERT_TRUE(writer.writeFromMemory(data), "Writing the SSTable should succeed");
+
+    SSTable::blockCache.clear();
+    uint64_t misses_before = SSTable::blockCache.misses();
+    {
+        SSTable table(DATADIR + "test_block_cache.sst");
+        for (const auto &kv : data)
+        {
+            ASSERT_EQ(kv.value, table.get(kv.key), "Values should read back through the cache");
+        }
+    }
+    uint64_t cold_misses = SSTable::blockCache.misses() - misses_before;
+    ASSERT_TRUE(cold_misses > 0 && cold_misses < data.size() / 10, "Each compressed block should be decoded about once");
+
+    // A new reader of the same file shares the cached blocks
+    uint64_t hits_before = SSTable::blockCache.hits();
+    SSTable again(DATADIR + "test_block_cache.sst");
+    for (const auto &kv : data)
+    {
+        ASSERT_EQ(kv.value, again.get(kv.key), "Cached values should match");
+    }
+    ASSERT_EQ(static_cast<uint64_t>(data.size()), SSTable::blockCache.hits() - hits_before, "Every lookup should hit the cache");
+
+    // Rewriting the file must not serve blocks of the old version
+    data[0].value = "rewritten";
+    ASSERT_TRUE(writer.writeFromMemory(data), "Rewriting the SSTable should succeed");
+    SSTable rewritten(DATADIR + "test_block_cache.sst");
+    ASSERT_EQ(std::string("rewritten"), rewritten.get(data[0].key), "A rewritten file should not reuse cached blocks");
+}
+END_TEST
+
+TEST(TableCache_lru_readers)
+{
+    std::vector<KeyValuePair> data = {{"tc_a", "1"}, {"tc_b", "2"}};
+    for (int i = 0; i < 3; ++i)
+    {
+        SSTable writer(DATADIR + "test_table_cache" + std::to_string(i) + ".sst");
+        ASSERT_TRUE(writer.writeFromMemory(data), "Writing the SSTable should succeed");
+    }
+    TableCache cache(2);
+    auto first = cache.get(DATADIR + "test_table_cache0.sst");
+    ASSERT_TRUE(first == cache.get(DATADIR + "test_table_cache0.sst"), "A cached reader should be reused");
+    ASSERT_EQ(std::string("2"), first->get("tc_b"), "The cached reader should find keys");
+    cache.get(DATADIR + "test_table_cache1.sst");
+    cache.get(DATADIR + "test_table_cache0.sst"); // Now the most recently used
+    cache.get(DATADIR + "test_table_cache2.sst");
+    ASSERT_EQ(static_cast<size_t>(2), cache.size(), "The cache should hold at most its capacity");
+    uint64_t misses = cache.misses();
+    cache.get(DATADIR + "test_table_cache0.sst");
+    ASSERT_EQ(misses, cache.misses(), "The recently used reader should have survived");
+    cache.get(DATADIR + "test_table_cache1.sst");
+    ASSERT_EQ(misses + 1, cache.misses(), "The least recently used reader should have been closed");
+
+    cache.evict(DATADIR + "test_table_cache0.sst");
+    ASSERT_TRUE(first != cache.get(DATADIR + "test_table_cache0.sst"), "An evicted reader should be reopened");
+    ASSERT_EQ(std::string("1"), first->get("tc_a"), "An evicted reader should stay usable by its holders");
+}
+END_TEST
+
+TEST(FenceIndex_find)
+{
+    FenceIndex index;
+    ASSERT_EQ(static_cast<size_t>(0), index.find("anything"), "An empty index should find nothing");
+    // Keys sharing their first eight bytes force comparisons past the prefix
+    std::vector<std::string> keys = {"b", "bb", "common_prefix_1", "common_prefix_2", "common_prefix_20", "d\xff", "e"};
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        ASSERT_TRUE(index.add(keys[i], i * 100), "Ascending keys should be accepted");
+    }
+    ASSERT_TRUE(!index.add("a", 1000), "A key out of order should be rejected");
+    ASSERT_EQ(keys.size(), index.size(), "A rejected key should not be added");
+
+    ASSERT_EQ(index.size(), index.find("a"), "A key before every fence should have no block");
+    ASSERT_EQ(static_cast<size_t>(0), index.find("b"), "An exact first key should select its block");
+    ASSERT_EQ(static_cast<size_t>(0), index.find("ba"), "A key between fences should select the earlier block");
+    ASSERT_EQ(static_cast<size_t>(1), index.find("common"), "A shorter key should sort before its extensions");
+    ASSERT_EQ(static_cast<size_t>(3), index.find("common_prefix_2"), "Ties on the prefix should compare whole keys");
+    ASSERT_EQ(static_cast<size_t>(2), index.find("common_prefix_1z"), "Ties on the prefix should compare whole keys");
+    ASSERT_EQ(static_cast<size_t>(4), index.find("common_prefix_3"), "A key past a fence should select it");
+    ASSERT_EQ(static_cast<size_t>(5), index.find("d\xff\x01"), "High bytes should compare as unsigned");
+    ASSERT_EQ(static_cast<size_t>(6), index.find("zzz"), "A key past every fence should select the last block");
+    ASSERT_EQ(static_cast<uint64_t>(300), index.offset(3), "Offsets should be kept per fence");
+
+    // Every key must land in the same block as a plain binary search would pick
+    FenceIndex large;
+    std::vector<std::string> fences;
+    for (int i = 0; i < 1000; ++i)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "user:%06d", i * 7);
+        fences.push_back(key);
+        large.add(key, i);
+    }
+    for (int i = 0; i < 7000; i += 3)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "user:%06d", i);
+        size_t expected = std::upper_bound(fences.begin(), fences.end(), std::string(key)) - fences.begin() - 1;
+        ASSERT_EQ(expected, large.find(key), "The branchless search should agree with upper_bound");
+    }
+
+    // A corrupt fence count in a table's index must fail the lookup, not the process
+    const std::string path = DATADIR + "test_fence_corrupt.sst";
+    {
+        SSTable table(path, false);
+        ASSERT_TRUE(table.writeFromMemory({{"fence_key0", "value"}}), "The table should be written");
+    }
+    uint64_t index_offset = 0;
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(-16, std::ios::end); // The footer: filter offset, index offset, magic number
+        file.read(reinterpret_cast<char *>(&index_offset), sizeof(index_offset));
+        uint64_t count = 2; // One fence is stored, and two would need more bytes than the block has
+        file.seekp(index_offset);
+        file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    }
+    SSTable corrupt(path, false);
+    ASSERT_TRUE(!corrupt.find("fence_key0").has_value(), "A table with a corrupt index should find nothing");
+    fs::remove(path);
+}
+END_TEST
+
+TEST(SSTable_iterator_walks_blocks)
+{
+    std::vector<KeyValuePair> data;
+    for (int i = 0; i < 3000; ++i)
+    {
+        char key[32];
+        snprintf(key, sizeof(key), "iter_key%05d", i);
+        data.push_back({key, "value" + std::to_string(i)});
+    }
+    SSTable writer(DATADIR + "test_iterator.sst");
+    ASSERT_TRUE(writer.writeFromMemory(data), "Writing the SSTable should succeed");
+
+    SSTable table(DATADIR + "test_iterator.sst");
+    size_t count = 0;
+    bool in_order = true;
+    uint64_t misses_before = SSTable::blockCache.misses();
+    size_t usage_before = SSTable::blockCache.usage();
+    for (SSTable::Iterator it(table); it.valid(); it.next())
+    {
+        in_order = in_order && count < data.size() && it.key() == data[count].key && it.value() == data[count].value;
+        ++count;
+    }
+    ASSERT_EQ(data.size(), count, "The iterator should visit every pair");
+    ASSERT_TRUE(in_order, "The iterator should visit pairs in key order");
+    ASSERT_TRUE(SSTable::blockCache.misses() > misses_before, "The walk should span several blocks");
+    ASSERT_EQ(usage_before, SSTable::blockCache.usage(), "A scan should not fill the block cache");
+
+    SSTable empty_writer(DATADIR + "test_iterator_empty.sst");
+    ASSERT_TRUE(empty_writer.writeFromMemory({}), "Writing an empty SSTable should succeed");
+    SSTable empty(DATADIR + "test_iterator_empty.sst");
+    SSTable::Iterator it(empty);
+    ASSERT_TRUE(!it.valid() && it.ok(), "An empty table should have nothing to visit");
+
+    SSTable missing(DATADIR + "test_iterator_missing.sst");
+    SSTable::Iterator broken(missing);
+    ASSERT_TRUE(!broken.valid() && !broken.ok(), "A missing file should fail the iterator");
+}
+END_TEST
+
+TEST(SSTableBuilder_streams_pairs)
+{
+    const std::string path = DATADIR + "test_builder.sst";
+    uint64_t size = 0;
+    {
+        SSTableBuilder builder(path);
+        for (int i = 0; i < 20000; ++i)
+        {
+            char key[32];
+            snprintf(key, sizeof(key), "build_key%06d", i);
+            ASSERT_TRUE(builder.add(key, "value" + std::to_string(i)), "Adding ascending keys should succeed");
+        }
+        ASSERT_TRUE(builder.fileSize() > 0, "Finished blocks should be counted before they are written");
+        ASSERT_TRUE(builder.finish(), "Finishing the table should succeed");
+        ASSERT_EQ(20000u, builder.entries(), "The builder should count every pair");
+        size = builder.fileSize();
+    }
+    ASSERT_EQ(size, std::filesystem::file_size(path), "The tracked size should match the file");
+
+    SSTable table(path);
+    ASSERT_EQ(std::string("value0"), table.find("build_key000000").value_or(""), "The first key should be found");
+    ASSERT_EQ(std::string("value12345"), table.find("build_key012345").value_or(""), "A middle key should be found");
+    ASSERT_EQ(std::string("value19999"), table.find("build_key019999").value_or(""), "The last key should be found");
+    ASSERT_TRUE(!table.find("build_key020000").has_value(), "A missing key should not be found");
+
+    const std::string abandoned = DATADIR + "test_builder_abandoned.sst";
+    {
+        SSTableBuilder builder(abandoned);
+        ASSERT_TRUE(builder.add("b", "1"), "The first key should be accepted");
+        ASSERT_TRUE(!builder.add("a", "2"), "A key before the previous one should be rejected");
+        ASSERT_TRUE(!builder.add("c", "3") && !builder.ok(), "A failed builder should stay failed");
+        ASSERT_TRUE(!builder.finish(), "A failed builder should not finish");
+    }
+    ASSERT_TRUE(!std::filesystem::exists(abandoned), "An unfinished table should be deleted");
+
+    // A builder that could not open its file must leave a file of that name alone
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    struct rlimit exhausted = limit;
+    exhausted.rlim_cur = 0; // Every open fails with EMFILE
+    setrlimit(RLIMIT_NOFILE, &exhausted);
+    {
+        SSTableBuilder builder(path);
+        ASSERT_TRUE(!builder.ok(), "A builder should fail when its file cannot be opened");
+    }
+    setrlimit(RLIMIT_NOFILE, &limit);
+    ASSERT_TRUE(std::filesystem::exists(path) && std::filesystem::file_size(path) == size,
+                "A builder that never opened the file should not delete it");
+}
+END_TEST
+
+TEST(VersionSet_manifest_and_picking)
+{
+    const std::string dir = DATADIR + "version_test/";
+    std::filesystem::remove_all(dir);
+    auto write_table = [&dir](const std::string &name, std::vector<std::string> keys)
+    {
+        SSTableBuilder builder(dir + name);
+        for (const std::string &key : keys)
+        {
+            builder.add(key, "value_" + key);
+        }
+        return builder.finish();
+    };
+    ASSERT_TRUE(write_table("a.sst", {"apple", "cherry"}) && write_table("b.sst", {"banana", "date"}) &&
+                    write_table("c.sst", {"x", "y", "z"}) && write_table("d.sst", {"orphan"}),
+                "Writing the tables should succeed");
+    {
+        VersionSet versions(dir);
+        versions.l0_compaction_trigger = 2;
+        ASSERT_TRUE(versions.open({"a.sst", "b.sst"}), "Adopting a directory without a MANIFEST should succeed");
+        ASSERT_EQ(static_cast<size_t>(2), versions.level(0).size(), "Adopted tables should go to level 0");
+        ASSERT_EQ(std::string("cherry"), versions.level(0)[0].largest, "Adopted tables should know their last key");
+        ASSERT_EQ(std::string("b.sst"), versions.tables()[0], "The newest level 0 table should be listed first");
+
+        Compaction compaction;
+        ASSERT_TRUE(versions.pick_compaction(compaction), "A full level 0 should be compacted");
+        ASSERT_EQ(1, compaction.level, "Level 0 should compact into level 1");
+        ASSERT_EQ(static_cast<size_t>(2), compaction.inputs.size(), "Overlapping level 0 tables should be compacted together");
+        ASSERT_EQ(std::string("a.sst"), compaction.inputs[0].second.name, "Inputs should be ordered oldest first");
+
+        // Stand in c.sst for the output of that compaction
+        VersionEdit edit;
+        edit.removed = {{0, "a.sst"}, {0, "b.sst"}};
+        TableFile output;
+        ASSERT_TRUE(versions.describe("c.sst", output), "Describing a table should succeed");
+        edit.added = {{1, output}};
+        ASSERT_TRUE(versions.apply(edit), "Logging an edit should succeed");
+        ASSERT_TRUE(versions.level(0).empty() && versions.level(1).size() == 1, "The edit should move the data to level 1");
+        ASSERT_EQ(static_cast<size_t>(0), versions.find(1, "y"), "A key in a table's range should find the table");
+        ASSERT_EQ(static_cast<size_t>(1), versions.find(1, "apple"), "A key outside every range should find nothing");
+        ASSERT_TRUE(!versions.pick_compaction(compaction), "Levels within their budget should not be compacted");
+    }
+    // A torn append at the end of the MANIFEST is ignored
+    std::ofstream(dir + VersionSet::MANIFEST, std::ios::binary | std::ios::app) << std::string("\x12\x34\x56", 3);
+    {
+        VersionSet versions(dir);
+        ASSERT_TRUE(versions.open({"a.sst", "b.sst", "c.sst", "d.sst"}), "Reopening should succeed");
+        ASSERT_TRUE(versions.level(0).empty() && versions.level(1).size() == 1, "Reopening should restore the levels");
+        ASSERT_EQ(std::string("c.sst"), versions.level(1)[0].name, "Reopening should restore the tables");
+        ASSERT_EQ(std::string("x"), versions.level(1)[0].smallest, "Reopening should restore key ranges");
+        ASSERT_TRUE(!std::filesystem::exists(dir + "a.sst") && !std::filesystem::exists(dir + "d.sst"),
+                    "Tables the MANIFEST does not list should be deleted");
+        ASSERT_TRUE(std::filesystem::exists(dir + "c.sst"), "Live tables should be kept");
+
+        // Round-robin picking over level 1, which is always over a one-byte budget
+        ASSERT_TRUE(write_table("e.sst", {"fig", "grape"}) && write_table("f.sst", {"kiwi", "lemon"}) &&
+                        write_table("g.sst", {"melon"}),
+                    "Writing the tables should succeed");
+        VersionEdit edit;
+        for (const char *name : {"e.sst", "f.sst"})
+        {
+            TableFile file;
+            ASSERT_TRUE(versions.describe(name, file), "Describing a table should succeed");
+            edit.added.emplace_back(1, file);
+        }
+        ASSERT_TRUE(versions.apply(edit), "Logging an edit should succeed");
+        versions.level1_bytes = 1;
+        Compaction compaction;
+        ASSERT_TRUE(versions.pick_compaction(compaction) && compaction.inputs.back().second.name == "e.sst",
+                    "Picking should start from the first key range");
+        ASSERT_TRUE(versions.pick_compaction(compaction) && compaction.inputs.back().second.name == "e.sst",
+                    "Picking should not move on before the compaction's output is installed");
+        // Stand in an edit carrying only the pointer for the one installing that output
+        edit = VersionEdit();
+        edit.compact_pointers = compaction.compact_pointers;
+        ASSERT_TRUE(versions.apply(edit), "Logging an edit should succeed");
+        ASSERT_TRUE(versions.pick_compaction(compaction) && compaction.inputs.back().second.name == "f.sst",
+                    "Picking should move on to the next key range");
+        // That compaction never completes, so an unrelated edit must not record its pointer
+        edit = VersionEdit();
+        TableFile flushed;
+        ASSERT_TRUE(versions.describe("g.sst", flushed), "Describing a table should succeed");
+        edit.added = {{0, flushed}};
+        ASSERT_TRUE(versions.apply(edit), "Logging an edit should succeed");
+    }
+    {
+        // The installed compaction's pointer was logged, so picking does not start over
+        VersionSet versions(dir);
+        ASSERT_TRUE(versions.open({"c.sst", "e.sst", "f.sst", "g.sst"}), "Reopening should succeed");
+        versions.level1_bytes = 1;
+        Compaction compaction;
+        ASSERT_TRUE(versions.pick_compaction(compaction) && compaction.inputs.back().second.name == "f.sst",
+                    "Picking should resume after the key range compacted last");
+    }
+    std::filesystem::remove_all(dir);
+}
+END_TEST
+
 int main()
 {
     std::cout << "Running all database tests..." << std::endl;
     RUN_TEST(MemTable_put_get);
     RUN_TEST(MemTable_oversize_clear);
     RUN_TEST(MemTable_flush);
+    RUN_TEST(MemTable_concurrent_put);
+    RUN_TEST(Arena_allocate_reset);
+    RUN_TEST(MemTable_byte_budget);
     RUN_TEST(SSTable_writeFromMemory_find);
     RUN_TEST(SSTable_get_disk_vs_memory);
     RUN_TEST(SSTable_get_first_key_pop_first_item);
+    RUN_TEST(SSTable_bloom_filter);
+    RUN_TEST(SSTable_sized_blocks_with_restarts);
+    RUN_TEST(LzCodec_round_trip);
+    RUN_TEST(SSTable_compressed_blocks);
+    RUN_TEST(SSTable_mmap_zero_copy_values);
+    RUN_TEST(SSTable_pread_concurrent_reads);
+    RUN_TEST(BlockCache_lru_eviction);
+    RUN_TEST(SSTable_block_cache_hits);
+    RUN_TEST(TableCache_lru_readers);
+    RUN_TEST(FenceIndex_find);
+    RUN_TEST(SSTable_iterator_walks_blocks);
+    RUN_TEST(SSTableBuilder_streams_pairs);
+    RUN_TEST(VersionSet_manifest_and_picking);
     std::cout << "All database tests passed!" << std::endl;
     return 0;
 }
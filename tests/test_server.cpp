@@ -6,6 +6,13 @@
 #include <filesystem>
 #include <chrono>    // For getCurrentUnixTimeString
 #include <algorithm> // For std::sort
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
 
 // Simple assertion macros
 #define ASSERT_EQ(expected, actual, message)                                          \
@@ -36,6 +43,8 @@
 
 namespace fs = std::filesystem;
 
+const std::string DATADIR = "data/"; // MemTable::flush and Storage write their tables here
+
 // Helper to clean up test files
 void cleanup_test_files()
 {
@@ -46,10 +55,99 @@ void cleanup_test_files()
             fs::remove(entry.path());
         }
     }
+    if (fs::exists(DATADIR))
+    {
+        for (const auto &entry : fs::recursive_directory_iterator(DATADIR))
+        {
+            if (entry.is_regular_file() && (entry.path().extension() == ".sst" || entry.path().extension() == WriteAheadLog::EXTENSION ||
+                                            entry.path().filename() == VersionSet::MANIFEST))
+            {
+                fs::remove(entry.path());
+            }
+        }
+    }
+}
+
+// Connects to a local test server, retrying while it is still starting up
+int connect_to_server(int port)
+{
+    for (int attempt = 0; attempt < 200; ++attempt)
+    {
+        int sock = socket(AF_INET, SOCK_STREAM, 0);
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+        if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        {
+            return sock;
+        }
+        close(sock);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return -1;
+}
+
+void send_all(int sock, const std::string &data)
+{
+    size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = send(sock, data.data() + sent, data.size() - sent, 0);
+        if (n <= 0)
+        {
+            return;
+        }
+        sent += n;
+    }
+}
+
+// Reads exactly `count` bytes, or fewer if the connection closes
+std::string read_bytes(int sock, size_t count)
+{
+    std::string result;
+    char buffer[4096];
+    while (result.size() < count)
+    {
+        ssize_t n = read(sock, buffer, std::min(sizeof(buffer), count - result.size()));
+        if (n <= 0)
+        {
+            break;
+        }
+        result.append(buffer, n);
+    }
+    return result;
+}
+
+// Reads one binary response frame
+Response read_binary_response(int sock)
+{
+    std::string frame = read_bytes(sock, BinaryProtocol::RESPONSE_HEADER_SIZE);
+    if (frame.size() < BinaryProtocol::RESPONSE_HEADER_SIZE)
+    {
+        return Response(false, "connection closed");
+    }
+    frame += read_bytes(sock, BinaryProtocol::read_uint32(frame.data() + 1));
+    Response res;
+    Response::deserialize_binary(frame.data(), frame.size(), res);
+    return res;
+}
+
+// Reads one newline-terminated text response, without the newline
+std::string read_line(int sock)
+{
+    std::string line;
+    char c;
+    while (read(sock, &c, 1) == 1 && c != '\n')
+    {
+        line += c;
+    }
+    return line;
 }
 
 TEST(Server_put_get)
 {
+    cleanup_test_files(); // Storage picks up leftover tables from data/
     Server server("127.0.0.1", 8080); // Dummy server instance
     server.put("server_key1", "server_value1");
     ASSERT_EQ(std::string("server_value1"), server.get("server_key1"), "Server::put/get failed for server_key1");
@@ -61,7 +159,7 @@ END_TEST
 
 TEST(Storage_check_for_compaction)
 {
-    // cleanup_test_files(); // Commented out to preserve SST files
+    cleanup_test_files(); // Start from an empty data/ so only this test's flush is listed
     Server server("127.0.0.1", 8081); // Dummy server instance
     // Storage storage(&server); // This is now created by Server constructor
 
@@ -73,15 +171,18 @@ TEST(Storage_check_for_compaction)
     // We check its side effects directly
     ASSERT_TRUE(server.storage->main_mdb->is_empty(), "main_mdb should be empty after compaction");
     ASSERT_TRUE(server.storage->second_mdb->readonly, "second_mdb should be readonly after compaction");
-    ASSERT_TRUE(server.storage->tables_to_merge.size() == 1, "tables_to_merge should contain one flushed SSTable");
-    ASSERT_TRUE(fs::exists(server.storage->tables_to_merge[0]), "Flushed SSTable file should exist");
+    ASSERT_EQ(std::string("v1"), server.get("k1"), "Keys should stay readable while the flush runs");
+    server.storage->wait_for_flush(); // The flush itself runs on the storage's flush thread
+    ASSERT_TRUE(server.storage->second_mdb->is_empty(), "second_mdb should be emptied once its SSTable is written");
+    ASSERT_TRUE(server.storage->tables().size() == 1, "The storage should list one flushed SSTable");
+    ASSERT_TRUE(fs::exists(DATADIR + server.storage->tables()[0]), "Flushed SSTable file should exist");
     // cleanup_test_files(); // Commented out to preserve SST files
 }
 END_TEST
 
 TEST(Storage_merge)
 {
-    // cleanup_test_files(); // Commented out to preserve SST files
+    cleanup_test_files(); // Start from an empty data/ so only this test's tables are merged
     Server server("127.0.0.1", 8082); // Dummy server instance
 
     // Create two SSTables to merge
@@ -95,21 +196,21 @@ TEST(Storage_merge)
     mt2.put("date", "D");
     SSTable *sst2 = mt2.flush("test_merge_2.sst");
 
-    ASSERT_TRUE(fs::exists("test_merge_1.sst"), "test_merge_1.sst should exist");
-    ASSERT_TRUE(fs::exists("test_merge_2.sst"), "test_merge_2.sst should exist");
+    ASSERT_TRUE(fs::exists(DATADIR + "test_merge_1.sst"), "test_merge_1.sst should exist");
+    ASSERT_TRUE(fs::exists(DATADIR + "test_merge_2.sst"), "test_merge_2.sst should exist");
 
-    server.storage->tables_to_merge.push_back("test_merge_1.sst");
-    server.storage->tables_to_merge.push_back("test_merge_2.sst");
+    ASSERT_TRUE(server.storage->add_table("test_merge_1.sst"), "test_merge_1.sst should be added");
+    ASSERT_TRUE(server.storage->add_table("test_merge_2.sst"), "test_merge_2.sst should be added");
 
     server.storage->merge();
 
-    ASSERT_TRUE(server.storage->tables_to_merge.size() == 1, "After merge, tables_to_merge should have one entry");
-    std::string merged_sst_name = server.storage->tables_to_merge[0];
-    ASSERT_TRUE(fs::exists(merged_sst_name), "Merged SSTable file should exist");
-    ASSERT_TRUE(!fs::exists("test_merge_1.sst"), "Original test_merge_1.sst should be removed");
-    ASSERT_TRUE(!fs::exists("test_merge_2.sst"), "Original test_merge_2.sst should be removed");
+    ASSERT_TRUE(server.storage->tables().size() == 1, "After merge, the storage should list one table");
+    std::string merged_sst_name = server.storage->tables()[0];
+    ASSERT_TRUE(fs::exists(DATADIR + merged_sst_name), "Merged SSTable file should exist");
+    ASSERT_TRUE(!fs::exists(DATADIR + "test_merge_1.sst"), "Original test_merge_1.sst should be removed");
+    ASSERT_TRUE(!fs::exists(DATADIR + "test_merge_2.sst"), "Original test_merge_2.sst should be removed");
 
-    SSTable loaded_merged_sst(merged_sst_name, true);
+    SSTable loaded_merged_sst(DATADIR + merged_sst_name, true);
     ASSERT_EQ(std::string("A"), loaded_merged_sst.get("apple"), "Merged SSTable content for apple incorrect");
     ASSERT_EQ(std::string("B"), loaded_merged_sst.get("banana"), "Merged SSTable content for banana incorrect");
     ASSERT_EQ(std::string("C"), loaded_merged_sst.get("cherry"), "Merged SSTable content for cherry incorrect");
@@ -122,12 +223,833 @@ TEST(Storage_merge)
 }
 END_TEST
 
+TEST(Server_event_loop_persistent_connections)
+{
+    cleanup_test_files();
+    Server server("127.0.0.1", 8083);
+    std::thread loop([&server]()
+                     { server.start(); });
+
+    int first = connect_to_server(8083);
+    int second = connect_to_server(8083);
+    ASSERT_TRUE(first >= 0 && second >= 0, "Clients should connect to the event loop");
+
+    // Both connections stay open and are served interleaved on the single loop thread
+    send_all(first, "PUT loop_key1 loop_value1\n");
+    ASSERT_EQ(std::string("OK"), read_line(first), "PUT over first connection should succeed");
+    send_all(second, "PUT loop_key2 loop_value2\n");
+    ASSERT_EQ(std::string("OK"), read_line(second), "PUT over second connection should succeed");
+    send_all(first, "GET loop_key2\n");
+    ASSERT_EQ(std::string("VALUE loop_value2"), read_line(first), "GET should reuse the first connection");
+    send_all(second, "GET missing_loop_key\n");
+    ASSERT_EQ(std::string("ERROR Key not found: missing_loop_key"), read_line(second), "GET of missing key should report an error");
+
+    // A request split across several writes is buffered until its newline arrives
+    send_all(first, "GET loop_");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    send_all(first, "key1\n");
+    ASSERT_EQ(std::string("VALUE loop_value1"), read_line(first), "Partial request should be reassembled");
+
+    close(first);
+    close(second);
+    server.stop();
+    loop.join();
+}
+END_TEST
+
+TEST(Server_sharded_routing)
+{
+    cleanup_test_files();
+    Server server("127.0.0.1", 8084, 4);
+    ASSERT_EQ(size_t(4), server.shard_count(), "Server should run four shards");
+    std::thread loop([&server]()
+                     { server.start(); });
+
+    // Connections land on arbitrary shards; every request must still reach the key's owner
+    std::vector<int> clients;
+    for (int i = 0; i < 4; ++i)
+    {
+        clients.push_back(connect_to_server(8084));
+        ASSERT_TRUE(clients.back() >= 0, "Client should connect to a shard");
+    }
+    for (int i = 0; i < 40; ++i)
+    {
+        int sock = clients[i % clients.size()];
+        send_all(sock, "PUT shard_key" + std::to_string(i) + " shard_value" + std::to_string(i) + "\n");
+        ASSERT_EQ(std::string("OK"), read_line(sock), "Sharded PUT should succeed");
+    }
+    for (int i = 0; i < 40; ++i)
+    {
+        int sock = clients[(i + 1) % clients.size()];
+        send_all(sock, "GET shard_key" + std::to_string(i) + "\n");
+        ASSERT_EQ("VALUE shard_value" + std::to_string(i), read_line(sock), "Sharded GET should find the key on its owner");
+    }
+    for (int sock : clients)
+    {
+        close(sock);
+    }
+    server.stop();
+    loop.join();
+
+    // Each key lives only in its owning shard's storage
+    std::vector<int> keys_per_shard(server.shard_count(), 0);
+    for (int i = 0; i < 40; ++i)
+    {
+        std::string key = "shard_key" + std::to_string(i);
+        Storage *owner = server.storage_for(key);
+        ASSERT_EQ("shard_value" + std::to_string(i), owner->main_mdb->get(key), "Key should be stored by its owning shard");
+        keys_per_shard[server.shard_for(key)]++;
+    }
+    ASSERT_TRUE(std::count(keys_per_shard.begin(), keys_per_shard.end(), 0) < 3, "Keys should spread over several shards");
+    ASSERT_EQ(DATADIR + "shard-0/", server.storage->data_dir, "Each shard should keep its tables in its own directory");
+}
+END_TEST
+
+TEST(Server_binary_protocol)
+{
+    cleanup_test_files();
+    Server server("127.0.0.1", 8085);
+    std::thread loop([&server]()
+                     { server.start(); });
+    int sock = connect_to_server(8085);
+    ASSERT_TRUE(sock >= 0, "Client should connect");
+
+    // Keys may contain spaces and values may be far larger than one read, with any bytes in them
+    std::string key = "tenant 1/table with spaces";
+    std::string value(300 * 1024, 'x');
+    value[10] = '\n';
+    value[20] = ' ';
+    value[30] = '\0';
+    send_all(sock, Request(RequestType::PUT, key, value).serialize_binary());
+    Response put_res = read_binary_response(sock);
+    ASSERT_TRUE(put_res.success && put_res.message == "OK", "Binary PUT should succeed");
+
+    send_all(sock, Request(RequestType::GET, key).serialize_binary());
+    Response get_res = read_binary_response(sock);
+    ASSERT_TRUE(get_res.success && get_res.message == "VALUE", "Binary GET should return a value");
+    ASSERT_TRUE(get_res.value == value, "Binary GET should return the exact bytes stored");
+
+    send_all(sock, Request(RequestType::GET, "missing binary key").serialize_binary());
+    ASSERT_TRUE(!read_binary_response(sock).success, "Binary GET of a missing key should fail");
+
+    // Text commands keep working on the same connection
+    send_all(sock, "PUT text_key text_value\n");
+    ASSERT_EQ(std::string("OK"), read_line(sock), "Text PUT should still work after binary frames");
+    send_all(sock, Request(RequestType::GET, "text_key").serialize_binary());
+    ASSERT_EQ(std::string("text_value"), read_binary_response(sock).value, "Binary GET should see text PUT");
+
+    close(sock);
+    server.stop();
+    loop.join();
+}
+END_TEST
+
+TEST(RequestView_parse_binary_in_place)
+{
+    std::string frame = Request(RequestType::PUT, "k", "v1").serialize_binary();
+    RequestView view;
+    uint64_t frame_size = 0;
+    ASSERT_EQ(size_t(0), RequestView::parse_binary(frame.data(), 4, view, frame_size), "Partial header should not parse");
+    ASSERT_EQ(size_t(0), RequestView::parse_binary(frame.data(), frame.size() - 1, view, frame_size), "Partial payload should not parse");
+    ASSERT_EQ(frame.size(), frame_size, "Frame size should be known once the header is in");
+    ASSERT_EQ(frame.size(), RequestView::parse_binary(frame.data(), frame.size(), view, frame_size), "Whole frame should parse");
+    ASSERT_TRUE(view.type == RequestType::PUT, "Opcode should decode to PUT");
+    ASSERT_TRUE(view.key.data() == frame.data() + BinaryProtocol::REQUEST_HEADER_SIZE, "Key should point into the buffer");
+    ASSERT_EQ(std::string("v1"), std::string(view.value), "Value should decode in place");
+}
+END_TEST
+
+TEST(Server_pipelining)
+{
+    cleanup_test_files();
+    Server server("127.0.0.1", 8086, 4);
+    server.max_pending_output = 256; // Force backpressure while the client is not reading
+    std::thread loop([&server]()
+                     { server.start(); });
+    int sock = connect_to_server(8086);
+    ASSERT_TRUE(sock >= 0, "Client should connect");
+
+    // Many requests in one write, for keys owned by different shards, mixing both protocols
+    std::string batch;
+    for (int i = 0; i < 200; ++i)
+    {
+        batch += "PUT pipe_key" + std::to_string(i) + " pipe_value" + std::to_string(i) + "\n";
+    }
+    for (int i = 0; i < 200; ++i)
+    {
+        if (i % 2 == 0)
+        {
+            batch += "GET pipe_key" + std::to_string(i) + "\n";
+        }
+        else
+        {
+            batch += Request(RequestType::GET, "pipe_key" + std::to_string(i)).serialize_binary();
+        }
+    }
+    send_all(sock, batch);
+
+    for (int i = 0; i < 200; ++i)
+    {
+        ASSERT_EQ(std::string("OK"), read_line(sock), "Pipelined PUT should be answered in order");
+    }
+    for (int i = 0; i < 200; ++i)
+    {
+        std::string expected = "pipe_value" + std::to_string(i);
+        if (i % 2 == 0)
+        {
+            ASSERT_EQ("VALUE " + expected, read_line(sock), "Pipelined text GET should be answered in order");
+        }
+        else
+        {
+            ASSERT_EQ(expected, read_binary_response(sock).value, "Pipelined binary GET should be answered in order");
+        }
+    }
+
+    close(sock);
+    server.stop();
+    loop.join();
+}
+END_TEST
+
+TEST(Server_io_uring_engine)
+{
+    cleanup_test_files();
+    if (!IoRing::supported())
+    {
+        std::cout << "  io_uring unavailable, exercising the epoll fallback" << std::endl;
+    }
+    Server server("127.0.0.1", 8087);
+    server.use_io_uring = true;
+    server.storage->main_mdb->max_size = 10; // Flush early so GETs read SSTable blocks through the ring
+    std::thread loop([&server]()
+                     { server.start(); });
+    int first = connect_to_server(8087);
+    int second = connect_to_server(8087);
+    ASSERT_TRUE(first >= 0 && second >= 0, "Clients should connect");
+
+    std::string batch;
+    for (int i = 0; i < 50; ++i)
+    {
+        batch += "PUT ring_key" + std::to_string(i) + " ring_value" + std::to_string(i) + "\n";
+    }
+    send_all(first, batch);
+    for (int i = 0; i < 50; ++i)
+    {
+        ASSERT_EQ(std::string("OK"), read_line(first), "PUT over io_uring should succeed");
+    }
+    server.storage->wait_for_flush();
+    ASSERT_TRUE(!server.storage->tables().empty(), "Early PUTs should have been flushed to an SSTable");
+
+    for (int i = 0; i < 50; ++i)
+    {
+        send_all(second, Request(RequestType::GET, "ring_key" + std::to_string(i)).serialize_binary());
+        ASSERT_EQ("ring_value" + std::to_string(i), read_binary_response(second).value, "GET over io_uring should find memtable and SSTable keys");
+    }
+    std::string big(200 * 1024, 'r');
+    send_all(first, Request(RequestType::PUT, "ring_big", big).serialize_binary());
+    ASSERT_TRUE(read_binary_response(first).success, "Large PUT over io_uring should succeed");
+    send_all(first, "GET ring_big\n");
+    ASSERT_EQ("VALUE " + big, read_line(first), "Large value should come back whole over io_uring");
+
+    close(first);
+    close(second);
+    server.stop();
+    loop.join();
+}
+END_TEST
+
+TEST(Server_batch_commands)
+{
+    cleanup_test_files();
+    Server server("127.0.0.1", 8088, 4);
+    std::thread loop([&server]()
+                     { server.start(); });
+    int sock = connect_to_server(8088);
+    ASSERT_TRUE(sock >= 0, "Client should connect");
+
+    // MPUT spanning every shard, followed in the same write by an MGET that must see it
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+    for (int i = 0; i < 40; ++i)
+    {
+        keys.push_back("batch_key" + std::to_string(i));
+        values.push_back("batch_value" + std::to_string(i));
+    }
+    std::vector<std::string> wanted = {"batch_key7", "batch_missing", "batch_key0", "batch_key39"};
+    send_all(sock, Request(RequestType::MPUT, keys, values).serialize() + "\n" +
+                       Request(RequestType::MGET, wanted).serialize_binary());
+    ASSERT_EQ(std::string("OK"), read_line(sock), "Text MPUT should be acknowledged once");
+    Response res = read_binary_response(sock);
+    ASSERT_TRUE(res.success && res.message == "VALUES", "Binary MGET should answer with a value list");
+    ASSERT_EQ(size_t(4), res.values.size(), "MGET should answer every key");
+    ASSERT_EQ(std::string("batch_value7"), res.values[0], "MGET values should follow the request order");
+    ASSERT_EQ(std::string(""), res.values[1], "A missing key should come back empty");
+    ASSERT_EQ(std::string("batch_value0"), res.values[2], "MGET values should follow the request order");
+    ASSERT_EQ(std::string("batch_value39"), res.values[3], "MGET values should follow the request order");
+
+    // Text MGET answers with one line per key after a count line
+    send_all(sock, "MGET batch_key1 nope batch_key2\nGET batch_key3\n");
+    ASSERT_EQ(std::string("VALUES 3"), read_line(sock), "Text MGET should start with the count");
+    ASSERT_EQ(std::string("VALUE batch_value1"), read_line(sock), "Text MGET should list found values");
+    ASSERT_EQ(std::string("NOT_FOUND"), read_line(sock), "Text MGET should mark missing keys");
+    ASSERT_EQ(std::string("VALUE batch_value2"), read_line(sock), "Text MGET should list found values");
+    ASSERT_EQ(std::string("VALUE batch_value3"), read_line(sock), "A request after MGET should still be answered in order");
+
+    send_all(sock, "MPUT odd_count\n");
+    ASSERT_EQ(std::string("ERROR Unknown request type"), read_line(sock), "MPUT without a value per key should be rejected");
+
+    close(sock);
+    server.stop();
+    loop.join();
+}
+END_TEST
+
+TEST(Storage_get_many_reads_sstables)
+{
+    cleanup_test_files();
+    Server server("127.0.0.1", 8089);
+    server.storage->main_mdb->max_size = 10; // Spread the keys over several SSTables
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+    for (int i = 0; i < 35; ++i)
+    {
+        keys.push_back("many_key" + std::to_string(100 + i));
+        values.push_back("many_value" + std::to_string(i));
+    }
+    ASSERT_TRUE(server.multi_put(std::vector<std::string_view>(keys.begin(), keys.end()),
+                                 std::vector<std::string_view>(values.begin(), values.end())),
+                "MPUT should succeed");
+    server.storage->wait_for_flush();
+    ASSERT_TRUE(!server.storage->tables().empty(), "Keys should have been flushed to SSTables");
+
+    std::vector<std::string_view> wanted = {"many_key134", "many_key100", "zzz", "many_key117", "many_key101", "aaa"};
+    std::vector<std::string> found = server.multi_get(wanted);
+    ASSERT_EQ(size_t(6), found.size(), "Every key should get an answer");
+    ASSERT_EQ(std::string("many_value34"), found[0], "Memtable key should be found");
+    ASSERT_EQ(std::string("many_value0"), found[1], "SSTable key should be found");
+    ASSERT_EQ(std::string(""), found[2], "Key past the last block should be missing");
+    ASSERT_EQ(std::string("many_value17"), found[3], "SSTable key should be found");
+    ASSERT_EQ(std::string("many_value1"), found[4], "Key sharing a block should be found");
+    ASSERT_EQ(std::string(""), found[5], "Key before the first block should be missing");
+    for (size_t i = 0; i < wanted.size(); ++i)
+    {
+        ASSERT_EQ(server.get(wanted[i]), found[i], "MGET should agree with GET");
+    }
+}
+END_TEST
+
+TEST(Storage_empty_values_read_alike)
+{
+    cleanup_test_files();
+    Storage storage(nullptr);
+    storage.put("empty_in_memtable", "old");
+    storage.put("empty_in_sstable", "older");
+    storage.flush_all_memtables_to_disk();
+    storage.put("empty_in_sstable", "");
+    storage.flush_all_memtables_to_disk();
+    storage.put("empty_in_memtable", "");
+
+    std::vector<std::string_view> wanted = {"empty_in_memtable", "empty_in_sstable"};
+    std::vector<std::string> found = storage.get_many(wanted);
+    ASSERT_EQ(std::string("old"), storage.get("empty_in_memtable"), "GET should skip an empty MemTable value");
+    ASSERT_EQ(std::string("older"), storage.get("empty_in_sstable"), "GET should skip an empty SSTable value");
+    for (size_t i = 0; i < wanted.size(); ++i)
+    {
+        ASSERT_EQ(storage.get(wanted[i]), found[i], "MGET should treat empty values like GET");
+    }
+}
+END_TEST
+
+TEST(WorkerPool_runs_every_task)
+{
+    std::atomic<int> done{0};
+    {
+        WorkerPool pool(3, 8); // Small queues, so some submissions find them full
+        for (int i = 0; i < 10000; ++i)
+        {
+            pool.submit([&done]()
+                        { done.fetch_add(1); });
+        }
+    } // The destructor drains the queues before joining
+    ASSERT_EQ(10000, done.load(), "Every submitted task should run exactly once");
+}
+END_TEST
+
+TEST(Server_worker_pool)
+{
+    cleanup_test_files();
+    Server server("127.0.0.1", 8090, 2);
+    server.worker_threads = 3;
+    std::thread loop([&server]()
+                     { server.start(); });
+
+    // Several clients pipelining at once; each must still see its own writes in order
+    std::vector<std::thread> clients;
+    std::atomic<int> failures{0};
+    for (int c = 0; c < 4; ++c)
+    {
+        clients.emplace_back([c, &failures]()
+                             {
+                                 int sock = connect_to_server(8090);
+                                 if (sock < 0)
+                                 {
+                                     failures++;
+                                     return;
+                                 }
+                                 std::string batch;
+                                 for (int i = 0; i < 100; ++i)
+                                 {
+                                     std::string key = "pool_key" + std::to_string(c) + "_" + std::to_string(i);
+                                     batch += "PUT " + key + " v" + std::to_string(i) + "\nGET " + key + "\n";
+                                 }
+                                 send_all(sock, batch);
+                                 for (int i = 0; i < 100; ++i)
+                                 {
+                                     if (read_line(sock) != "OK" || read_line(sock) != "VALUE v" + std::to_string(i))
+                                     {
+                                         failures++;
+                                     }
+                                 }
+                                 close(sock); });
+    }
+    for (auto &client : clients)
+    {
+        client.join();
+    }
+    ASSERT_EQ(0, failures.load(), "Pipelined requests should be answered in order through the pool");
+
+    int sock = connect_to_server(8090);
+    send_all(sock, Request(RequestType::MGET, std::vector<std::string>{"pool_key0_5", "pool_key3_99", "pool_none"}).serialize_binary());
+    Response res = read_binary_response(sock);
+    ASSERT_EQ(size_t(3), res.values.size(), "MGET through the pool should answer every key");
+    ASSERT_EQ(std::string("v5"), res.values[0], "MGET through the pool should find keys of every shard");
+    ASSERT_EQ(std::string("v99"), res.values[1], "MGET through the pool should find keys of every shard");
+    ASSERT_EQ(std::string(""), res.values[2], "Missing key should come back empty");
+
+    close(sock);
+    server.stop();
+    loop.join();
+}
+END_TEST
+
+TEST(Storage_wal_replay_after_crash)
+{
+    const std::string dir = DATADIR + "wal_test/";
+    fs::remove_all(dir);
+    Storage *crashed = new Storage(nullptr, dir);
+    for (int i = 0; i < 20; ++i)
+    {
+        crashed->put("wal_key" + std::to_string(i), "old" + std::to_string(i));
+    }
+    crashed->put("wal_key5", "new5");
+    delete crashed; // Never flushed, so the puts exist only in the log
+
+    // A crash in the middle of an append leaves a torn record at the tail
+    std::string last_log;
+    for (const auto &entry : fs::directory_iterator(dir))
+    {
+        if (entry.path().extension() == WriteAheadLog::EXTENSION && entry.path().string() > last_log)
+        {
+            last_log = entry.path().string();
+        }
+    }
+    ASSERT_TRUE(!last_log.empty(), "Puts should have been logged");
+    std::ofstream(last_log, std::ios::binary | std::ios::app) << std::string("\x12\x34\x56\x78\x05\x00", 6);
+
+    Storage recovered(nullptr, dir);
+    ASSERT_EQ(std::string("old0"), recovered.get("wal_key0"), "Logged puts should be replayed");
+    ASSERT_EQ(std::string("old19"), recovered.get("wal_key19"), "Logged puts should be replayed");
+    ASSERT_EQ(std::string("new5"), recovered.get("wal_key5"), "Replay should keep the latest value");
+    ASSERT_TRUE(recovered.tables().empty(), "Replay should fill the MemTable, not write SSTables");
+
+    recovered.flush_all_memtables_to_disk();
+    size_t logs = 0;
+    for (const auto &entry : fs::directory_iterator(dir))
+    {
+        logs += entry.path().extension() == WriteAheadLog::EXTENSION;
+    }
+    ASSERT_EQ(size_t(1), logs, "Logs covered by flushed SSTables should be removed, leaving the fresh one");
+    fs::remove_all(dir);
+}
+END_TEST
+
+TEST(Storage_wal_rotates_between_groups)
+{
+    const std::string dir = DATADIR + "wal_rotate_test/";
+    fs::remove_all(dir);
+    const int threads = 4;
+    const int puts_per_thread = 300;
+    Storage *crashed = new Storage(nullptr, dir);
+    std::atomic<int> running{threads};
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; ++t)
+    {
+        writers.emplace_back([crashed, &running, t]()
+                             {
+                                 for (int i = 0; i < puts_per_thread; ++i)
+                                 {
+                                     crashed->put("rotate_key" + std::to_string(t) + "_" + std::to_string(i), "v" + std::to_string(i));
+                                 }
+                                 running--; });
+    }
+    // Every flush rotates the log and removes the old files while groups are being committed
+    while (running > 0)
+    {
+        crashed->flush_all_memtables_to_disk();
+    }
+    for (auto &writer : writers)
+    {
+        writer.join();
+    }
+    delete crashed; // Whatever was not flushed last exists only in the log
+
+    {
+        Storage recovered(nullptr, dir);
+        for (int t = 0; t < threads; ++t)
+        {
+            for (int i = 0; i < puts_per_thread; ++i)
+            {
+                ASSERT_EQ("v" + std::to_string(i), recovered.get("rotate_key" + std::to_string(t) + "_" + std::to_string(i)),
+                          "Every acknowledged put should be in an SSTable or a retained log");
+            }
+        }
+    }
+    fs::remove_all(dir);
+}
+END_TEST
+
+TEST(Storage_flush_failure_keeps_memtable)
+{
+    const std::string dir = DATADIR + "flush_failure_test/";
+    fs::remove_all(dir);
+    const std::string value(32 * 1024, 'f');
+    {
+        Storage storage(nullptr, dir);
+        storage.set_memtable_budget(1 << 20);
+        struct rlimit limit;
+        getrlimit(RLIMIT_NOFILE, &limit);
+        struct rlimit exhausted = limit;
+        exhausted.rlim_cur = 0; // The flush cannot create its table
+        setrlimit(RLIMIT_NOFILE, &exhausted);
+        for (int i = 0; i < 36; ++i) // Enough for one swap, not enough to fill main_mdb again
+        {
+            storage.put("failed_key" + std::to_string(i), value);
+        }
+        for (int wait = 0; wait < 500 && storage.get_flush_failures() == 0; ++wait)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        // Flushing everything fails as well, and must leave both MemTables and their logs alone
+        storage.flush_all_memtables_to_disk();
+        setrlimit(RLIMIT_NOFILE, &limit);
+        ASSERT_TRUE(storage.get_flush_failures() > 0, "The flush should fail while no file can be opened");
+        ASSERT_TRUE(storage.tables().empty(), "No table should be published while no file can be opened");
+
+        // Later swaps must not drop the rows of the table that failed to flush
+        for (int i = 0; i < 80; ++i)
+        {
+            storage.put("later_key" + std::to_string(i), value);
+        }
+        storage.wait_for_flush();
+        ASSERT_EQ(value, storage.get("failed_key0"), "Rows of a failed flush should stay readable");
+    } // Closed without flush_all, so whatever is not in an SSTable exists only in the logs
+
+    {
+        Storage recovered(nullptr, dir);
+        for (int i = 0; i < 36; ++i)
+        {
+            ASSERT_EQ(value, recovered.get("failed_key" + std::to_string(i)), "Rows of a failed flush should survive a restart");
+        }
+        for (int i = 0; i < 80; ++i)
+        {
+            ASSERT_EQ(value, recovered.get("later_key" + std::to_string(i)), "Later rows should survive a restart");
+        }
+    }
+    fs::remove_all(dir);
+}
+END_TEST
+
+TEST(Storage_memtable_byte_budget)
+{
+    const std::string dir = DATADIR + "budget_test/";
+    fs::remove_all(dir);
+    {
+        Storage storage(nullptr, dir);
+        storage.set_memtable_budget(1 << 20);
+        const std::string value(32 * 1024, 'v');
+        for (int i = 0; i < 32; ++i) // 1 MiB of values: at least one swap
+        {
+            storage.put("budget_key" + std::to_string(i), value);
+            ASSERT_TRUE(storage.memory_usage() <= 3 << 20, "MemTables should stay near their byte budget");
+        }
+        storage.wait_for_flush();
+        ASSERT_TRUE(!storage.tables().empty(), "Filling the byte budget should flush a MemTable");
+        ASSERT_TRUE(storage.main_mdb->max_bytes == (1u << 20) && storage.second_mdb->max_bytes == (1u << 20),
+                    "The budget should apply to both MemTables across swaps");
+        ASSERT_EQ(value, storage.get("budget_key0"), "Flushed keys should still be readable");
+        ASSERT_EQ(value, storage.get("budget_key31"), "Recent keys should still be readable");
+    }
+    fs::remove_all(dir);
+    {
+        // Overwrites of one key grow the MemTable by a version each, and still trigger flushes
+        Storage storage(nullptr, dir);
+        storage.set_memtable_budget(1 << 20);
+        const std::string value(1024, 'h');
+        for (int i = 0; i < 4096; ++i) // 4 MiB of versions of a single key
+        {
+            storage.put("hot_key", value + std::to_string(i));
+            ASSERT_TRUE(storage.memory_usage() <= 3 << 20, "Replaced versions should count against the budget");
+        }
+        storage.wait_for_flush();
+        ASSERT_TRUE(!storage.tables().empty(), "Overwriting one key should flush once the budget is used up");
+        ASSERT_EQ(value + "4095", storage.get("hot_key"), "The newest version should be read");
+    }
+    fs::remove_all(dir);
+}
+END_TEST
+
+TEST(Storage_table_cache)
+{
+    const std::string dir = DATADIR + "table_cache_test/";
+    fs::remove_all(dir);
+    {
+        Storage storage(nullptr, dir);
+        storage.set_memtable_budget(256 << 10);
+        storage.set_compaction_options(100, 10 << 20, 2 << 20); // Keep every flushed table in level 0
+        const std::string value(16 * 1024, 't');
+        for (int i = 0; i < 48; ++i) // Several flushes, so several older tables
+        {
+            storage.put("table_key" + std::to_string(i), value);
+        }
+        storage.wait_for_flush();
+        ASSERT_TRUE(storage.tables().size() >= 2, "The puts should have flushed several tables");
+
+        uint64_t misses_before = storage.table_cache.misses();
+        uint64_t misses_first_round = 0;
+        for (int round = 0; round < 5; ++round)
+        {
+            ASSERT_EQ(value, storage.get("table_key0"), "Flushed keys should be readable");
+            ASSERT_EQ(std::string(""), storage.get("table_key_absent"), "Absent keys should not be found");
+            misses_first_round = round == 0 ? storage.table_cache.misses() : misses_first_round;
+        }
+        // Lookups skip the tables whose key range misses the key, and open each of the others
+        size_t in_range = 0;
+        for (const TableFile &file : storage.versions.level(0))
+        {
+            bool holds_key0 = file.smallest <= "table_key0" && "table_key0" <= file.largest;
+            bool holds_absent = file.smallest <= "table_key_absent" && "table_key_absent" <= file.largest;
+            in_range += holds_key0 || holds_absent;
+        }
+        ASSERT_TRUE(in_range > 0, "Some table should hold the key looked up");
+        ASSERT_EQ(in_range, storage.table_cache.misses() - misses_before, "Each table in range should be opened once");
+        ASSERT_EQ(misses_first_round, storage.table_cache.misses(), "Repeated lookups should not reopen tables");
+        ASSERT_EQ(in_range, storage.table_cache.size(), "Every table lookups opened should stay open");
+
+        storage.merge();
+        ASSERT_EQ(static_cast<size_t>(0), storage.table_cache.size(), "A merge should close the readers of the files it deletes");
+        ASSERT_EQ(value, storage.get("table_key0"), "Keys should be readable after the merge");
+        ASSERT_EQ(value, storage.get("table_key47"), "Keys should be readable after the merge");
+    }
+    fs::remove_all(dir);
+}
+END_TEST
+
+TEST(Storage_merge_keeps_newest)
+{
+    const std::string dir = DATADIR + "merge_test/";
+    fs::remove_all(dir);
+    {
+        Storage storage(nullptr, dir);
+        storage.set_memtable_budget(64 << 10);
+        storage.set_compaction_options(100, 10 << 20, 2 << 20); // Only the explicit merge compacts
+        // Three generations of the same keys, each flushed to its own tables
+        for (int generation = 0; generation < 3; ++generation)
+        {
+            for (int i = 0; i < 200; ++i)
+            {
+                storage.put("merge_key" + std::to_string(i), "gen" + std::to_string(generation) + std::string(400, 'm'));
+            }
+            storage.wait_for_flush();
+        }
+        storage.flush_all_memtables_to_disk();
+        ASSERT_TRUE(storage.tables().size() >= 3, "Every generation should have reached SSTables");
+        const std::string newest = "gen2" + std::string(400, 'm');
+        ASSERT_EQ(newest, storage.get("merge_key7"), "Lookups should find the newest version before merging");
+
+        storage.merge();
+        ASSERT_EQ(static_cast<size_t>(1), storage.tables().size(), "A merge should leave one table");
+        SSTable merged(dir + storage.tables()[0], true);
+        ASSERT_EQ(static_cast<size_t>(200), merged.getAllKeyValues().size(), "Older versions should be dropped");
+        for (int i = 0; i < 200; i += 13)
+        {
+            ASSERT_EQ(newest, storage.get("merge_key" + std::to_string(i)), "The newest version should survive the merge");
+        }
+    }
+    {
+        // Reopening orders the files by age, so a later flush still shadows the merged table
+        Storage storage(nullptr, dir);
+        storage.put("merge_key7", "after_restart");
+        storage.flush_all_memtables_to_disk();
+    }
+    {
+        Storage storage(nullptr, dir);
+        ASSERT_EQ(std::string("after_restart"), storage.get("merge_key7"), "Newer tables should shadow older ones after a restart");
+    }
+    fs::remove_all(dir);
+}
+END_TEST
+
+TEST(Storage_leveled_compaction)
+{
+    const std::string dir = DATADIR + "leveled_test/";
+    fs::remove_all(dir);
+    const int keys = 4000;
+    auto key = [](int i)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "level_key%05d", i);
+        return std::string(name);
+    };
+    // Values that do not compress, so tables reach their sizes
+    unsigned seed = 1;
+    auto value = [&seed](int round)
+    {
+        std::string v = std::to_string(round) + ":";
+        for (int i = 0; i < 25; ++i)
+        {
+            seed = seed * 1103515245 + 12345;
+            char word[9];
+            snprintf(word, sizeof(word), "%08x", seed);
+            v += word;
+        }
+        return v;
+    };
+    // Checks that every level below 0 is one sorted run and returns the tables held there
+    auto check_levels = [](Storage &storage)
+    {
+        std::shared_lock<std::shared_mutex> lock(storage.mutex);
+        size_t deeper = 0;
+        for (int level = 1; level < VersionSet::NUM_LEVELS; ++level)
+        {
+            const std::vector<TableFile> &files = storage.versions.level(level);
+            for (size_t i = 1; i < files.size(); ++i)
+            {
+                ASSERT_TRUE(files[i - 1].largest < files[i].smallest, "Tables of a level should not overlap");
+            }
+            ASSERT_TRUE(storage.versions.level_bytes(level) <= storage.versions.max_bytes(level),
+                        "Compactions should keep every level within its budget");
+            deeper += files.size();
+        }
+        ASSERT_TRUE(storage.versions.level(0).size() < storage.versions.l0_compaction_trigger,
+                    "Compactions should keep level 0 below its trigger");
+        return deeper;
+    };
+    std::vector<std::string> newest(keys);
+    {
+        Storage storage(nullptr, dir);
+        storage.set_memtable_budget(300 << 10);
+        storage.set_compaction_options(2, 256 << 10, 64 << 10);
+        // Every flush spreads over the whole key space, so level 0 tables overlap
+        for (int round = 0; round < 3; ++round)
+        {
+            for (int i = 0; i < keys; ++i)
+            {
+                int k = (i * 7919) % keys;
+                newest[k] = value(round);
+                storage.put(key(k), newest[k]);
+            }
+        }
+        storage.flush_all_memtables_to_disk();
+        storage.wait_for_compaction();
+        ASSERT_TRUE(check_levels(storage) >= 2, "The data should have been compacted into several tables below level 0");
+        ASSERT_TRUE(storage.get_merge_bytes_operated() > 0, "Compactions should have run in the background");
+        for (int i = 0; i < keys; i += 37)
+        {
+            ASSERT_EQ(newest[i], storage.get(key(i)), "Lookups should find the newest version");
+        }
+        std::vector<std::string> wanted = {key(0), key(777), "absent", key(keys - 1)};
+        std::vector<std::string> found = storage.get_many(std::vector<std::string_view>(wanted.begin(), wanted.end()));
+        ASSERT_TRUE(found[0] == newest[0] && found[1] == newest[777] && found[2].empty() && found[3] == newest[keys - 1],
+                    "Batched lookups should search the levels like single ones");
+    }
+    {
+        // The MANIFEST brings back the levels rather than adopting every table into level 0
+        Storage storage(nullptr, dir);
+        storage.set_compaction_options(2, 256 << 10, 64 << 10);
+        storage.wait_for_compaction();
+        ASSERT_TRUE(check_levels(storage) >= 2, "Reopening should restore the levels");
+        size_t files = 0;
+        for (const auto &entry : fs::directory_iterator(dir))
+        {
+            files += entry.path().extension() == ".sst";
+        }
+        ASSERT_EQ(storage.tables().size(), files, "Only live tables should be left on disk");
+        for (int i = 0; i < keys; i += 41)
+        {
+            ASSERT_EQ(newest[i], storage.get(key(i)), "Reopened lookups should find the newest version");
+        }
+    }
+    fs::remove_all(dir);
+}
+END_TEST
+
+TEST(Storage_wal_group_commit)
+{
+    cleanup_test_files();
+    Server server("127.0.0.1", 8091);
+    server.storage->wal.set_sync(WalSync::EVERY_WRITE);
+    const int threads = 8;
+    const int puts_per_thread = 50;
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; ++t)
+    {
+        writers.emplace_back([&server, t]()
+                             {
+                                 for (int i = 0; i < puts_per_thread; ++i)
+                                 {
+                                     server.storage->put("group_key" + std::to_string(t) + "_" + std::to_string(i), "v" + std::to_string(i));
+                                 } });
+    }
+    for (auto &writer : writers)
+    {
+        writer.join();
+    }
+    uint64_t writes = server.storage->wal.write_count();
+    std::cout << "  " << threads * puts_per_thread << " puts took " << writes << " log writes" << std::endl;
+    ASSERT_TRUE(writes <= static_cast<uint64_t>(threads * puts_per_thread), "Each log write should carry at least one put");
+    ASSERT_EQ(writes, server.storage->wal.sync_count(), "Every log write should be synced under EVERY_WRITE");
+    for (int t = 0; t < threads; ++t)
+    {
+        ASSERT_EQ(std::string("v49"), server.storage->get("group_key" + std::to_string(t) + "_49"), "Group-committed puts should be applied");
+    }
+}
+END_TEST
+
 int main()
 {
     std::cout << "Running all server tests..." << std::endl;
     RUN_TEST(Server_put_get);
     RUN_TEST(Storage_check_for_compaction);
     RUN_TEST(Storage_merge);
+    RUN_TEST(Server_event_loop_persistent_connections);
+    RUN_TEST(Server_sharded_routing);
+    RUN_TEST(Server_binary_protocol);
+    RUN_TEST(RequestView_parse_binary_in_place);
+    RUN_TEST(Server_pipelining);
+    RUN_TEST(Server_io_uring_engine);
+    RUN_TEST(Server_batch_commands);
+    RUN_TEST(Storage_get_many_reads_sstables);
+    RUN_TEST(Storage_empty_values_read_alike);
+    RUN_TEST(WorkerPool_runs_every_task);
+    RUN_TEST(Server_worker_pool);
+    RUN_TEST(Storage_wal_replay_after_crash);
+    RUN_TEST(Storage_wal_rotates_between_groups);
+    RUN_TEST(Storage_flush_failure_keeps_memtable);
+    RUN_TEST(Storage_memtable_byte_budget);
+    RUN_TEST(Storage_wal_group_commit);
+    RUN_TEST(Storage_table_cache);
+    RUN_TEST(Storage_merge_keeps_newest);
+    RUN_TEST(Storage_leveled_compaction);
     std::cout << "All server tests passed!" << std::endl;
     return 0;
 }
@@ -7,21 +7,30 @@
 #include <unistd.h>
 #include <algorithm>
 #include <sstream>
-#include <limits> // Required for std::numeric_limits
+#include <limits>  // Required for std::numeric_limits
+#include <cstdlib> // For std::atol
 
 const int PORT = 5991;               // Default server port
 const char *SERVER_IP = "127.0.0.1"; // Default server IP
 
-// Function to send a request and receive a response
-std::string send_request(const std::string &request_str)
+// Socket kept open across commands; the server serves many requests per connection
+int server_sock = -1;
+
+// Opens the connection to the server if it is not already open
+bool ensure_connected()
 {
+    if (server_sock >= 0)
+    {
+        return true;
+    }
+
     int sock = 0;
     struct sockaddr_in serv_addr;
 
     if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0)
     {
         std::cerr << "Error: Socket creation failed\n";
-        return "ERROR Socket creation failed";
+        return false;
     }
 
     serv_addr.sin_family = AF_INET;
@@ -31,23 +40,79 @@ std::string send_request(const std::string &request_str)
     {
         std::cerr << "Error: Invalid address/ Address not supported\n";
         close(sock);
-        return "ERROR Invalid address/ Address not supported";
+        return false;
     }
 
     if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
     {
         std::cerr << "Error: Connection Failed\n";
         close(sock);
-        return "ERROR Connection Failed";
+        return false;
+    }
+    server_sock = sock;
+    return true;
+}
+
+void disconnect()
+{
+    if (server_sock >= 0)
+    {
+        close(server_sock);
+        server_sock = -1;
     }
+}
 
-    send(sock, request_str.c_str(), request_str.length(), 0);
+// Reads one newline-terminated line from the server (without the newline)
+bool read_line(std::string &line)
+{
+    line.clear();
+    char c;
+    while (true)
+    {
+        long valread = read(server_sock, &c, 1);
+        if (valread <= 0)
+        {
+            disconnect();
+            return false;
+        }
+        if (c == '\n')
+        {
+            return true;
+        }
+        line += c;
+    }
+}
+
+// Function to send a request and receive a response.
+// Requests and responses are newline-terminated text lines; a "VALUES <n>" answer
+// is followed by one line per key.
+std::string send_request(const std::string &request_str)
+{
+    if (!ensure_connected())
+    {
+        return "ERROR Connection Failed";
+    }
 
-    char buffer[1024] = {0};
-    long valread = read(sock, buffer, 1024);
-    std::string response_str(buffer, valread);
+    std::string line = request_str + "\n";
+    if (send(server_sock, line.c_str(), line.length(), MSG_NOSIGNAL) < 0)
+    {
+        disconnect();
+        return "ERROR Connection lost";
+    }
 
-    close(sock);
+    std::string response_str;
+    if (!read_line(response_str))
+    {
+        return response_str.empty() ? "ERROR Connection lost" : response_str;
+    }
+    if (response_str.rfind("VALUES ", 0) == 0)
+    {
+        long count = std::atol(response_str.c_str() + 7);
+        for (long i = 0; i < count && read_line(line); ++i)
+        {
+            response_str += "\n" + line;
+        }
+    }
     return response_str;
 }
 
@@ -56,11 +121,14 @@ void display_help()
     std::cout << "\nAvailable commands:\n";
     std::cout << "  put <key> <value> - Stores a key-value pair.\n";
     std::cout << "  get <key>         - Retrieves the value for a given key.\n";
+    std::cout << "  mput <k1> <v1> ...- Stores several key-value pairs in one request.\n";
+    std::cout << "  mget <k1> <k2> ...- Retrieves several keys in one request.\n";
     std::cout << "  help              - Displays this help message.\n";
     std::cout << "  exit              - Exits the client.\n";
     std::cout << "\nExamples:\n";
     std::cout << "  put mykey myvalue\n";
     std::cout << "  get mykey\n";
+    std::cout << "  mget mykey otherkey\n";
     std::cout << "  exit\n";
 }
 
@@ -139,10 +207,51 @@ int main()
                 std::cerr << "Usage: get <key>\n";
             }
         }
+        else if (command == "mput" || command == "mget")
+        {
+            std::vector<std::string> words;
+            std::string word;
+            while (iss >> word)
+            {
+                words.push_back(word);
+            }
+            if (words.empty() || (command == "mput" && words.size() % 2 != 0))
+            {
+                std::cerr << "Usage: " << (command == "mput" ? "mput <k1> <v1> [<k2> <v2> ...]" : "mget <k1> [<k2> ...]") << "\n";
+                continue;
+            }
+            Request req(RequestType::MGET, words);
+            if (command == "mput")
+            {
+                req = Request(RequestType::MPUT, std::vector<std::string>());
+                for (size_t i = 0; i < words.size(); i += 2)
+                {
+                    req.keys.push_back(words[i]);
+                    req.values.push_back(words[i + 1]);
+                }
+            }
+            Response res = Response::deserialize(send_request(req.serialize()));
+            if (res.success && res.message == "VALUES")
+            {
+                for (size_t i = 0; i < res.values.size() && i < req.keys.size(); ++i)
+                {
+                    std::cout << req.keys[i] << ": " << (res.values[i].empty() ? "(not found)" : res.values[i]) << std::endl;
+                }
+            }
+            else if (res.success)
+            {
+                std::cout << "Server: " << res.message << std::endl;
+            }
+            else
+            {
+                std::cerr << "Error: " << res.message << std::endl;
+            }
+        }
         else if (!command.empty())
         {
             std::cerr << "Unknown command: " << command << ". Type 'help' for commands.\n";
         }
     }
+    disconnect();
     return 0;
 }